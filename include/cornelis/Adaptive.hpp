@@ -0,0 +1,145 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <stdint.h>
+
+#include <cornelis/Color.hpp>
+#include <cornelis/RenderOptions.hpp>
+#include <cornelis/Span.hpp>
+
+namespace cornelis {
+/**
+ * The light of the samples of a pixel added up in fixed point. Unlike a float sum, this doesn't
+ * depend on the order the samples are added in, which for the wavefront integrator depends on the
+ * tile and wave sizes. Both integrators use it, so they give the same image.
+ */
+struct PixelSum {
+    // 24 fractional bits, and the light of a sample is clamped to 2^19, so that MaxSamplesAA
+    // samples, 2^19 of them, add up to less than 2^62 and can't overflow.
+    static constexpr float Scale = 0x1.0p24f;
+    static constexpr float MaxLight = RenderOptions::MaxSampleLight;
+    static_assert(static_cast<double>(MaxLight) * Scale * RenderOptions::MaxSamplesAA < 0x1.0p63);
+
+    /**
+     * Whether the light of a sample is a bug: NaN or negative in some channel.
+     */
+    static auto invalid(RGB const &light) -> bool {
+        return !(light(0) >= 0.0f && light(1) >= 0.0f && light(2) >= 0.0f);
+    }
+
+    /**
+     * The light of a sample as it is added up, see RenderOptions::MaxSampleLight.
+     */
+    static auto clamp(RGB const &light) -> RGB {
+        RGB clamped;
+        for (int c = 0; c < 3; c++) {
+            // Written so that NaNs become zero.
+            clamped(c) = light(c) >= 0.0f ? std::min(light(c), MaxLight) : 0.0f;
+        }
+        return clamped;
+    }
+
+    auto operator+=(RGB const &light) -> PixelSum & {
+        auto const clamped = clamp(light);
+        for (int c = 0; c < 3; c++)
+            sum[c] += std::llround(clamped(c) * Scale);
+        return *this;
+    }
+
+    auto operator+=(PixelSum const &other) -> PixelSum & {
+        for (int c = 0; c < 3; c++)
+            sum[c] += other.sum[c];
+        return *this;
+    }
+
+    auto operator-=(PixelSum const &other) -> PixelSum & {
+        for (int c = 0; c < 3; c++)
+            sum[c] -= other.sum[c];
+        return *this;
+    }
+
+    /**
+     * The average light of the samples, given how many there are.
+     */
+    auto average(std::size_t samples) const -> RGB {
+        double const scale = 1.0 / (Scale * static_cast<double>(samples));
+        return RGB(static_cast<float>(sum[0] * scale),
+                   static_cast<float>(sum[1] * scale),
+                   static_cast<float>(sum[2] * scale));
+    }
+
+    std::array<int64_t, 3> sum{};
+};
+
+/**
+ * The running mean and variance of the samples of a pixel, updated one sample at a time with
+ * Welford's algorithm, which doesn't lose precision like a sum of squares does.
+ */
+class RunningVariance {
+  public:
+    auto add(float x) noexcept -> void {
+        count_++;
+        double const delta = x - mean_;
+        mean_ += delta / count_;
+        m2_ += delta * (x - mean_);
+    }
+
+    auto count() const noexcept -> uint32_t { return count_; }
+    auto mean() const noexcept -> double { return mean_; }
+
+    /**
+     * The sample variance, zero for fewer than two samples.
+     */
+    auto variance() const noexcept -> double { return count_ > 1 ? m2_ / (count_ - 1) : 0.0; }
+
+    /**
+     * The standard error of the mean, relative to the mean. Means below 1/256 count as 1/256:
+     * errors in pixels that dark don't show. Infinite for fewer than two samples.
+     */
+    auto relativeError() const noexcept -> double;
+
+  private:
+    uint32_t count_ = 0;
+    double mean_ = 0.0;
+    double m2_ = 0.0;
+};
+
+/**
+ * Plans the next pass of adaptive sampling, see RenderOptions::adaptiveErrorTarget: how many more
+ * samples each pixel takes, given what is known of the pixels so far, row by row in a frame width
+ * pixels wide. A pixel counts as having the largest relative error of it and its eight
+ * neighbours. If that is above the target, the pixel gets as many samples as it would need to
+ * reach the target if the error goes down as one over the square root of the samples, but never
+ * more than it already has, since the variance of a few samples is a rough estimate, and never
+ * more than adaptiveMaxSamples in all. If the pixels want more than budget samples together, each
+ * gets its share of the budget, rounded so that all of it is used.
+ *
+ * Returns the number of samples planned, zero once every pixel is done.
+ */
+auto planAdaptivePass(span<RunningVariance const> pixels,
+                      std::size_t width,
+                      RenderOptions const &options,
+                      std::size_t budget,
+                      span<uint32_t> samples) -> std::size_t;
+
+/**
+ * Estimates the relative mean squared error of a whole image from two halves of its samples: the
+ * mean luminance of the even samples of every pixel, that of the odd samples, and how many samples
+ * the pixel has in all, the even ones being the larger half. The two halves are independent
+ * estimates of the pixel, so how far apart they are tells how far off their combined mean is,
+ * without knowing the converged image.
+ *
+ * The squared errors are summed over the image and divided by the summed squared luminance,
+ * instead of pixel by pixel: a dark pixel whose few samples all missed a light would look
+ * converged relative to itself. The squared luminance is taken as the product of the halves,
+ * which unlike the square of their mean isn't inflated by the noise.
+ *
+ * Infinite if a pixel has fewer than two samples.
+ */
+auto halfBufferRelativeMSE(span<float const> even,
+                           span<float const> odd,
+                           span<uint32_t const> samples) -> double;
+} // namespace cornelis
@@ -0,0 +1,165 @@
+#pragma once
+
+#include <cmath>
+#include <stdint.h>
+#include <vector>
+
+#include <cornelis/Math.hpp>
+#include <cornelis/RenderOptions.hpp>
+#include <cornelis/Span.hpp>
+
+namespace cornelis {
+/**
+ * An axis aligned bounding box. The default constructed box is empty, and merging anything into it
+ * yields that thing.
+ */
+struct AABB {
+    float3 min{INFINITY};
+    float3 max{-INFINITY};
+};
+
+/**
+ * The smallest box enclosing both a and b.
+ */
+inline auto merge(AABB const &a, AABB const &b) -> AABB {
+    AABB result;
+    for (std::size_t i = 0; i < 3; i++) {
+        result.min(i) = std::min(a.min(i), b.min(i));
+        result.max(i) = std::max(a.max(i), b.max(i));
+    }
+    return result;
+}
+
+/**
+ * The smallest box enclosing both a and the point p.
+ */
+inline auto merge(AABB const &a, float3 const &p) -> AABB { return merge(a, AABB{p, p}); }
+
+inline auto centroid(AABB const &a) -> float3 { return (a.min + a.max) * 0.5f; }
+
+/**
+ * Surface area of the box. The empty box has zero area.
+ */
+inline auto surfaceArea(AABB const &a) -> float {
+    auto [dx, dy, dz] = a.max - a.min;
+    if (dx < 0.0f || dy < 0.0f || dz < 0.0f)
+        return 0.0f;
+    return 2.0f * (dx * dy + dy * dz + dz * dx);
+}
+
+/**
+ * The 30 bit Morton code of p, with bounds quantized to 1024 steps along each axis. Points close in
+ * space tend to get close codes. Points outside bounds are clamped to it.
+ */
+auto mortonCode(float3 const &p, AABB const &bounds) -> uint32_t;
+
+/**
+ * Slab test between a ray and a box. The ray is given by its origin and the componentwise
+ * reciprocal of its direction, and only the interval [0, tMax] is considered.
+ */
+inline auto intersectsAABB(AABB const &box, float3 const &origin, float3 const &invDir, float tMax)
+    -> bool {
+    float tMin = 0.0f;
+    for (std::size_t i = 0; i < 3; i++) {
+        float t0 = (box.min(i) - origin(i)) * invDir(i);
+        float t1 = (box.max(i) - origin(i)) * invDir(i);
+        tMin = std::max(tMin, std::min(t0, t1));
+        tMax = std::min(tMax, std::max(t0, t1));
+    }
+    return tMin <= tMax;
+}
+
+/**
+ * A node in a flattened binary BVH. The nodes are stored in depth first order, so the first child
+ * of an interior node always directly follows its parent.
+ */
+struct BVHNode {
+    AABB bounds;
+    /**
+     * For interior nodes this is the index of the second child. For leaves it is the index of the
+     * first primitive in BVH::primitives.
+     */
+    uint32_t offset;
+    /**
+     * Number of primitives in a leaf. Interior nodes have a count of zero.
+     */
+    uint16_t count;
+    /**
+     * The axis the children were split along. Used to visit the nearest child first.
+     */
+    uint8_t axis;
+
+    auto isLeaf() const noexcept -> bool { return count > 0; }
+};
+
+/**
+ * A bounding volume hierarchy over an abstract set of primitives, which are only known by their
+ * bounds. Primitive k is the k:th box given at construction, and it is up to the user to map these
+ * numbers back to the actual geometry.
+ *
+ * The tree is built in parallel, by the algorithm chosen with builder. See BVHBuilder.
+ */
+struct BVH {
+    BVH() = default;
+    BVH(span<const AABB> primitiveBounds, BVHBuilder builder = BVHBuilder::BinnedSAH);
+
+    auto empty() const noexcept -> bool { return nodes.empty(); }
+
+    std::vector<BVHNode> nodes;
+    /**
+     * Primitive numbers in leaf order. A leaf refers to a contiguous range of this.
+     */
+    std::vector<uint32_t> primitives;
+};
+
+/**
+ * A node in a WideBVH, with up to Width children. The bounds of the children are stored as a
+ * structure of arrays, so a ray can be tested against all of them at once with SIMD instructions.
+ */
+struct alignas(32) WideBVHNode {
+    static constexpr std::size_t Width = 8;
+
+    float minX[Width];
+    float minY[Width];
+    float minZ[Width];
+    float maxX[Width];
+    float maxY[Width];
+    float maxZ[Width];
+    /**
+     * For interior children this is the index of the child node. For leaves it is the index of the
+     * first primitive in BVH::primitives.
+     */
+    uint32_t offset[Width];
+    /**
+     * Number of primitives in leaf children. Interior children have a count of zero.
+     */
+    uint16_t count[Width];
+    /**
+     * How many of the slots are in use. The unused ones have empty bounds.
+     */
+    uint8_t numChildren;
+};
+
+/**
+ * A BVH collapsed so that every node has up to WideBVHNode::Width children, which makes the tree
+ * much shallower. Tracing a single ray through it touches fewer nodes, which suits incoherent rays
+ * that don't benefit from being traversed together.
+ *
+ * The leaves are the same as in the BVH it was collapsed from, and refer to its primitives.
+ */
+struct WideBVH {
+    WideBVH() = default;
+    explicit WideBVH(BVH const &bvh);
+
+    auto empty() const noexcept -> bool { return nodes.empty(); }
+
+    std::vector<WideBVHNode> nodes;
+};
+
+/**
+ * The expected cost of tracing a random ray through the BVH according to the surface area
+ * heuristic, in units of primitive tests. Lower is better, and it is mostly useful for comparing
+ * trees built over the same primitives.
+ */
+auto sahCost(BVH const &bvh) -> float;
+} // namespace cornelis
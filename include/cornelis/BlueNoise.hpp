@@ -0,0 +1,73 @@
+#pragma once
+
+#include <filesystem>
+#include <iosfwd>
+#include <stdint.h>
+#include <vector>
+
+namespace cornelis {
+/**
+ * An ordering of the pixels of a square that tiles the plane: every pixel has a rank from 0 to
+ * size² - 1. The ordering is hierarchical, like a space filling curve: the pixels of every aligned
+ * square of 2^k by 2^k pixels have consecutive ranks. Each square visits its four quarters in an
+ * order of its own, chosen so that pixels that share a sequence of samples in that order get errors
+ * that cancel out over small neighbourhoods, see SamplePattern::BlueNoise. This is the
+ * hierarchical ordering of Ahmed and Wonka, "Screen-Space Blue-Noise Diffusion of Monte Carlo
+ * Sampling Error via Hierarchical Ordering of Pixels" (2020), with the orders of the quarters
+ * optimised like the ranking keys of Heitz et al., "A Low-Discrepancy Sampler that Distributes
+ * Monte Carlo Errors as a Blue Noise in Screen Space" (2019).
+ *
+ * The optimisation takes a while, so orderings are made offline by the cornelis-makebluenoise
+ * tool and saved as a small binary file, see save.
+ */
+class BlueNoiseOrdering {
+  public:
+    /**
+     * Makes an ordering, starting from random orders of the quarters and then improving them.
+     * Size must be a power of two, at most 256.
+     */
+    static auto generate(uint32_t size, uint64_t seed) -> BlueNoiseOrdering;
+
+    /**
+     * Reads an ordering written by save. Throws std::runtime_error if the file is missing or is
+     * not an ordering.
+     */
+    static auto load(std::filesystem::path const &path) -> BlueNoiseOrdering;
+
+    /**
+     * Writes the ordering as a magic number, a version, the size, and then the ranks row by row,
+     * all little endian: 2 bytes per pixel.
+     */
+    auto save(std::filesystem::path const &path) const -> void;
+
+    auto size() const noexcept -> uint32_t { return size_; }
+
+    /**
+     * The rank of pixel (x, y), with the square repeated over the plane.
+     */
+    auto rank(uint32_t x, uint32_t y) const noexcept -> uint32_t {
+        return ranks_[(y % size_) * size_ + x % size_];
+    }
+
+  private:
+    BlueNoiseOrdering(uint32_t size, std::vector<uint16_t> ranks)
+        : size_(size), ranks_(std::move(ranks)) {}
+
+    /**
+     * Reads an ordering from a stream, as load does from a file. The path only goes into the
+     * error messages.
+     */
+    static auto read(std::istream &in, std::filesystem::path const &path) -> BlueNoiseOrdering;
+
+    friend auto defaultBlueNoiseOrdering() -> BlueNoiseOrdering const &;
+
+    uint32_t size_;
+    std::vector<uint16_t> ranks_;
+};
+
+/**
+ * The ordering that comes with cornelis, data/bluenoise.bin, which is compiled into the library and
+ * read on first use. Use BlueNoiseOrdering::load for others.
+ */
+auto defaultBlueNoiseOrdering() -> BlueNoiseOrdering const &;
+} // namespace cornelis
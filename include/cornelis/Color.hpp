@@ -56,9 +56,20 @@ struct RGB {
     float values[3];
 };
 
+/**
+ * The relative luminance of a linear sRGB triplet, the Y of CIE XYZ.
+ */
+auto luminance(RGB const &rgb) noexcept -> float;
+
 /**
  * Gamma corrects a RGB triplet using the sRGB transfer function. This is an invertible operation.
  */
 auto toSRGB(RGB const &) -> SRGB;
 
+/**
+ * Same as toSRGB(rgb), but with the power function from FastMath.hpp if accuracy is
+ * MathAccuracy::Fast.
+ */
+auto toSRGB(RGB const &rgb, MathAccuracy accuracy) -> SRGB;
+
 } // namespace cornelis
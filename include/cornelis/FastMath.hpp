@@ -0,0 +1,175 @@
+#pragma once
+
+#include <bit>
+#include <cmath>
+#include <cstdint>
+#include <utility>
+
+#include <xsimd/xsimd.hpp>
+
+/*
+    Polynomial approximations of the transcendental functions used while shading. They avoid the
+    calls into libm, and share work the standard functions can't, like the range reduction of sine
+    and cosine.
+
+    Every function is a template that works both on float and on xsimd::batch<float, N>, computing
+    the same thing lane by lane. The error bounds are the largest errors measured over the stated
+    domains with some margin, see tests/test_FastMath.cpp. Outside the stated domains the results
+    are unspecified.
+*/
+namespace cornelis::fastmath {
+namespace detail {
+// The few operations that are spelled differently for floats and batches.
+inline auto sqrt(float x) -> float { return std::sqrt(x); }
+inline auto abs(float x) -> float { return std::abs(x); }
+inline auto bits(float x) -> int32_t { return std::bit_cast<int32_t>(x); }
+inline auto fromBits(int32_t x) -> float { return std::bit_cast<float>(x); }
+inline auto toFloat(int32_t x) -> float { return static_cast<float>(x); }
+// The conditions are often random, so this must not become a branch.
+inline auto select(bool condition, float a, float b) -> float {
+    int32_t const mask = -static_cast<int32_t>(condition);
+    return fromBits((bits(a) & mask) | (bits(b) & ~mask));
+}
+
+template <std::size_t N>
+auto select(xsimd::batch_bool<float, N> const &condition,
+            xsimd::batch<float, N> const &a,
+            xsimd::batch<float, N> const &b) -> xsimd::batch<float, N> {
+    return xsimd::select(condition, a, b);
+}
+template <std::size_t N>
+auto sqrt(xsimd::batch<float, N> const &x) -> xsimd::batch<float, N> {
+    return xsimd::sqrt(x);
+}
+template <std::size_t N>
+auto abs(xsimd::batch<float, N> const &x) -> xsimd::batch<float, N> {
+    return xsimd::abs(x);
+}
+template <std::size_t N>
+auto bits(xsimd::batch<float, N> const &x) -> xsimd::batch<int32_t, N> {
+    return xsimd::bitwise_cast<xsimd::batch<int32_t, N>>(x);
+}
+template <std::size_t N>
+auto fromBits(xsimd::batch<int32_t, N> const &x) -> xsimd::batch<float, N> {
+    return xsimd::bitwise_cast<xsimd::batch<float, N>>(x);
+}
+template <std::size_t N>
+auto toFloat(xsimd::batch<int32_t, N> const &x) -> xsimd::batch<float, N> {
+    return xsimd::to_float(x);
+}
+
+// Adding this to a float with magnitude below 2^22 rounds it to the nearest integer, which ends up
+// in the low bits of the sum: bits(x + RoundingBias) == RoundingBiasBits + round(x).
+inline constexpr float RoundingBias = 12582912.0f;
+inline constexpr int32_t RoundingBiasBits = 0x4b400000;
+} // namespace detail
+
+/**
+ * Sine and cosine of x, in that order. The range reduction is shared between the two.
+ *
+ * Maximum absolute error 1.5e-7 for |x| <= 2^13.
+ */
+template <typename T>
+auto sincos(T const &x) -> std::pair<T, T> {
+    using namespace detail;
+    using I = decltype(bits(x));
+    // x = q * Pi / 2 + r, with |r| <= Pi / 4. Pi / 2 is split in three parts so that q times the
+    // first two are exact.
+    T const k = x * 0.636619772f + RoundingBias;
+    T const q = k - RoundingBias;
+    T const r = ((x - q * 1.5703125f) - q * 4.837512969970703125e-4f) - q * 7.54978995489e-8f;
+    T const quadrant = toFloat(bits(k) & I(3));
+
+    // Minimax polynomials for sine and cosine on [-Pi / 4, Pi / 4], from Cephes.
+    T const r2 = r * r;
+    T const sinr =
+        r + r * r2 * (-1.6666654611e-1f + r2 * (8.3321608736e-3f + r2 * -1.9515295891e-4f));
+    T const cosr = 1.0f - 0.5f * r2 +
+                   r2 * r2 *
+                       (4.166664568298827e-2f +
+                        r2 * (-1.388731625493765e-3f + r2 * 2.443315711809948e-5f));
+
+    auto const odd = (quadrant == T(1.0f)) | (quadrant == T(3.0f));
+    T const s = select(odd, cosr, sinr);
+    T const c = select(odd, sinr, cosr);
+    return {select(quadrant >= T(2.0f), -s, s),
+            select((quadrant == T(1.0f)) | (quadrant == T(2.0f)), -c, c)};
+}
+
+/**
+ * Arc cosine of x, for x in [-1, 1]. This is formula 4.4.46 in Abramowitz and Stegun.
+ *
+ * Maximum absolute error 5e-7.
+ */
+template <typename T>
+auto acos(T const &x) -> T {
+    using namespace detail;
+    T const a = abs(x);
+    T const p =
+        1.5707963050f +
+        a * (-0.2145988016f +
+             a * (0.0889789874f +
+                  a * (-0.0501743046f +
+                       a * (0.0308918810f +
+                            a * (-0.0170881256f + a * (0.0066700901f + a * -0.0012624911f))))));
+    T const r = sqrt(select(a < T(1.0f), 1.0f - a, T(0.0f))) * p;
+    return select(x < T(0.0f), 3.14159265359f - r, r);
+}
+
+/**
+ * 2 raised to x. Gives 0 for x below -126, and x must not be above 127.
+ *
+ * Maximum relative error 1.5e-7.
+ */
+template <typename T>
+auto exp2(T const &x) -> T {
+    using namespace detail;
+    using I = decltype(bits(x));
+    // 2^x = 2^n * 2^f, with n the integer closest to x, and |f| <= 0.5.
+    T const clamped = select(x < T(-126.0f), T(-126.0f), x);
+    T const k = clamped + RoundingBias;
+    T const f = clamped - (k - RoundingBias);
+    T const scale = fromBits((bits(k) + I(127 - RoundingBiasBits)) << 23);
+    // The Taylor series of e^(f ln 2) up to the seventh power.
+    T const p =
+        1.0f +
+        f * (0.693147181f +
+             f * (0.240226507f +
+                  f * (0.0555041087f +
+                       f * (0.00961812911f +
+                            f * (0.00133335581f + f * (1.54035304e-4f + f * 1.52527338e-5f))))));
+    return select(x < T(-126.0f), T(0.0f), p * scale);
+}
+
+/**
+ * Base 2 logarithm of x, for positive and normal x.
+ *
+ * Maximum absolute error 2e-7 times max(1, |log2(x)|).
+ */
+template <typename T>
+auto log2(T const &x) -> T {
+    using namespace detail;
+    using I = decltype(bits(x));
+    // x = 2^e * m, with m in [sqrt(2) / 2, sqrt(2)). Offsetting the bits by those of sqrt(2) / 2
+    // makes the exponent field e, and what is left in the mantissa field gives m.
+    I const offset = bits(x) - I(0x3f3504f3);
+    T const e = toFloat(offset >> 23);
+    T const m = fromBits(bits(x) - (offset & I(~0x007fffff)));
+    // log2(m) = 2 atanh(t) / ln 2 with t = (m - 1) / (m + 1), and |t| <= 0.172. This is the Taylor
+    // series of atanh up to the seventh power.
+    T const t = (m - 1.0f) / (m + 1.0f);
+    T const t2 = t * t;
+    return e + t * (2.88539008f + t2 * (0.961796694f + t2 * (0.577078016f + t2 * 0.412198583f)));
+}
+
+/**
+ * x raised to y, for x >= 0. Gives 0 when x is 0. Computed as exp2(y * log2(x)).
+ *
+ * Maximum relative error 3e-7 times max(1, |y * log2(x)|), while |y * log2(x)| <= 126.
+ */
+template <typename T>
+auto pow(T const &x, T const &y) -> T {
+    using namespace detail;
+    return select(x == T(0.0f), T(0.0f), exp2(y * log2(x)));
+}
+} // namespace cornelis::fastmath
@@ -12,18 +12,28 @@ struct IntersectionData : public SoAObject<tags::Intersected,
                                            tags::NormalX,
                                            tags::NormalY,
                                            tags::NormalZ,
-                                           tags::MaterialId> {
+                                           tags::MaterialId,
+                                           tags::PrimitiveId> {
     IntersectionData(std::size_t n);
 
     auto reset() -> void;
 };
 
+/**
+ * Whether the directions of a set of rays are known to be of unit length, which lets some kernels
+ * skip a bit of work.
+ */
+enum class RayDirections { Arbitrary, Normalized };
+
 /**
  * Checks for intersections between rays stored in rayOrigins and rayDirs and a sphere.
  *
  * Naturally, rayOrigins, rayDirs and the spans of IntersectionData must share a mutual size
  * (strictly, all spans must be greater or equal to rayOrigins x-span's size).
  *
+ * Hits store materialId and primitiveId, the number of the sphere in the scene, see
+ * SceneData::isSphere.
+ *
  * Only iterates over active rays.
  */
 auto intersectSphere(SoATuple3f rayOrigins,
@@ -31,8 +41,30 @@ auto intersectSphere(SoATuple3f rayOrigins,
                      float3 sphereCenter,
                      float sphereRadius,
                      std::size_t materialId,
+                     uint32_t primitiveId,
                      IntersectionData &data,
-                     std::vector<std::size_t> const &activeRayIds) -> void;
+                     span<const std::size_t> activeRayIds) -> void;
+
+/**
+ * Does the same as intersectSphere, but tests several rays at a time with SIMD instructions.
+ *
+ * Rays with consecutive ids are loaded straight from the spans, others are gathered. Whatever
+ * doesn't fill a whole batch is handed to intersectSphereScalar in Geometry.cpp, which handles the
+ * directions the same way as the lanes do, so a ray gets the same hit whichever part of the batch
+ * it is in.
+ *
+ * If directions is RayDirections::Normalized, the rays are assumed to have unit length directions,
+ * and the results may differ from intersectSphere by rounding.
+ */
+auto intersectSphereWide(SoATuple3f rayOrigins,
+                         SoATuple3f rayDirs,
+                         float3 sphereCenter,
+                         float sphereRadius,
+                         std::size_t materialId,
+                         uint32_t primitiveId,
+                         IntersectionData &data,
+                         span<const std::size_t> activeRayIds,
+                         RayDirections directions = RayDirections::Arbitrary) -> void;
 
 auto intersectPlane(SoATuple3f rayOrigins,
                      SoATuple3f rayDirs,
@@ -41,7 +73,87 @@ auto intersectPlane(SoATuple3f rayOrigins,
                      float width,
                      float height,
                      std::size_t materialId,
+                     uint32_t primitiveId,
                      IntersectionData &data,
-                     std::vector<std::size_t> const &activeRayIds) -> void;
+                     span<const std::size_t> activeRayIds) -> void;
+
+/**
+ * Does the same as intersectPlane, but tests several rays at a time with SIMD instructions, and
+ * takes the tangent frame of the plane instead of computing it.
+ *
+ * planeTangent and planeBitangent are the T and B vectors of constructBasis(planeNormal), and the
+ * inverse extents are 2 / width and 2 / height. PlaneData stores all of these.
+ */
+auto intersectPlaneWide(SoATuple3f rayOrigins,
+                        SoATuple3f rayDirs,
+                        float3 planeNormal,
+                        float3 planePoint,
+                        float3 planeTangent,
+                        float3 planeBitangent,
+                        float invHalfWidth,
+                        float invHalfHeight,
+                        std::size_t materialId,
+                        uint32_t primitiveId,
+                        IntersectionData &data,
+                        span<const std::size_t> activeRayIds) -> void;
+
+/**
+ * A direction from a point towards a point on the surface of a shape, sampled by sampleSphere or
+ * sampleRectangle.
+ */
+struct ShapeSample {
+    /**
+     * Unit direction from the point towards the shape.
+     */
+    float3 wi;
+    /**
+     * How far along wi the sampled point on the shape is.
+     */
+    float distance = 0.0f;
+    /**
+     * Probability density of wi, with respect to solid angle. Zero when the shape can't be sampled
+     * from the point, in which case wi and distance mean nothing.
+     */
+    float pdf = 0.0f;
+};
+
+/**
+ * Samples a direction from P uniformly within the cone that a sphere covers as seen from P, so
+ * every direction hits the sphere and none are wasted on its far side. The pdf is zero for points
+ * inside the sphere.
+ *
+ * @param x Two sample floats.
+ */
+auto sampleSphere(float3 const &P, float3 const &center, float radius, float2 const &x)
+    -> ShapeSample;
+
+/**
+ * The pdf of sampleSphere for a direction from P that hits the sphere. The same for all of them,
+ * so the direction isn't needed.
+ */
+auto sphereSamplePdf(float3 const &P, float3 const &center, float radius) -> float;
 
+/**
+ * Samples a point uniformly on the area of a rectangle, and gives the direction from P to it. The
+ * rectangle is the one intersectPlane tests against, both of its sides included, with tangent and
+ * bitangent as in intersectPlaneWide. The pdf is converted from area to solid angle at P, and is
+ * zero if P is in the plane of the rectangle.
+ *
+ * @param x Two sample floats.
+ */
+auto sampleRectangle(float3 const &P,
+                     float3 const &center,
+                     float3 const &normal,
+                     float3 const &tangent,
+                     float3 const &bitangent,
+                     float width,
+                     float height,
+                     float2 const &x) -> ShapeSample;
+
+/**
+ * The pdf of sampleRectangle for the direction wi, of unit length, from a point that sees the
+ * rectangle distance away along it.
+ */
+auto rectangleSamplePdf(
+    float3 const &wi, float distance, float3 const &normal, float width, float height) -> float;
 } // namespace cornelis
@@ -0,0 +1,105 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+#include <cornelis/BVH.hpp>
+#include <cornelis/Math.hpp>
+#include <cornelis/Span.hpp>
+
+namespace cornelis {
+/**
+ * A light, or a cluster of lights, as the light BVH sees it from afar: where it is, how much light
+ * it sends out in all, and in which directions. The normals of the light are within a cone of
+ * angle theta_o around axis, and it emits up to theta_e past its normals. A two sided light also
+ * emits around -axis. The angles are stored as their cosines.
+ *
+ * The default constructed bounds are empty, and merging anything into them yields that thing.
+ */
+struct LightBounds {
+    AABB bounds;
+    float power = 0.0f;
+    float3 axis{0.0f, 0.0f, 1.0f};
+    float cosThetaO = 1.0f;
+    float cosThetaE = 1.0f;
+    bool twoSided = false;
+};
+
+/**
+ * Bounds for both a and b: the box around both, their power added up, and a cone of normals that
+ * covers the cones of both.
+ */
+auto merge(LightBounds const &a, LightBounds const &b) -> LightBounds;
+
+/**
+ * An estimate of how much of the light of the bounds reaches the point P on a surface with normal
+ * N, for picking lights. The power over the squared distance, times bounds on the cosines at the
+ * light and at the surface, as in Conty Estevez and Kulla, "Importance Sampling of Many Lights with
+ * Adaptive Tree Splitting" (2018). Only zero if no light in the bounds can reach P from the front
+ * or the back of the surface. A zero N leaves out the cosine at the surface.
+ */
+auto importance(LightBounds const &light, float3 const &P, float3 const &N) -> float;
+
+/**
+ * A node in a flattened LightBVH. The nodes are stored in depth first order, so the first child of
+ * an interior node always directly follows its parent, as in BVHNode.
+ */
+struct LightBVHNode {
+    LightBounds bounds;
+    /**
+     * For interior nodes this is the index of the second child. For leaves it is the index of
+     * their light.
+     */
+    uint32_t offset;
+    /**
+     * The index of the parent node, zero for the root.
+     */
+    uint32_t parent;
+    bool leaf;
+};
+
+/**
+ * A light picked by LightBVH::sample, and the probability that it was.
+ */
+struct LightChoice {
+    uint32_t light = 0;
+    /**
+     * Zero if no light was picked, when the tree ran into a cluster of lights where neither half
+     * can reach the point.
+     */
+    float probability = 0.0f;
+};
+
+/**
+ * A binary tree over a set of lights, which picks one of them for a point on a surface in time
+ * proportional to the depth of the tree, with a probability that follows its importance for the
+ * point. Light k is the k:th bounds given at construction. Every leaf holds one light.
+ *
+ * The tree is built top down, splitting where the surface area orientation heuristic of Conty
+ * Estevez and Kulla is lowest: clusters of lights that are small, dim and point the same way are
+ * cheap.
+ */
+struct LightBVH {
+    LightBVH() = default;
+    explicit LightBVH(span<const LightBounds> lights);
+
+    auto empty() const noexcept -> bool { return nodes.empty(); }
+
+    /**
+     * Picks a light for P and N, with u a sample float. Walks down from the root, at each interior
+     * node going into either child with a probability proportional to its importance.
+     */
+    auto sample(float3 const &P, float3 const &N, float u) const -> LightChoice;
+
+    /**
+     * The probability that sample picks the given light for P and N.
+     */
+    auto probability(float3 const &P, float3 const &N, uint32_t light) const -> float;
+
+    std::vector<LightBVHNode> nodes;
+    /**
+     * The leaf of each light.
+     */
+    std::vector<uint32_t> leaves;
+};
+} // namespace cornelis
@@ -1,8 +1,13 @@
 #pragma once
 
+#include <tuple>
+#include <variant>
+
 #include <cornelis/Color.hpp>
+#include <cornelis/FastMath.hpp>
 #include <cornelis/Math.hpp>
 #include <cornelis/PRNG.hpp> // TODO: get rid of this include.
+#include <cornelis/SoA.hpp>
 
 namespace cornelis {
 // TODO: move this to .cpp
@@ -53,35 +58,60 @@ namespace detail {
 auto inline cosTheta(float3 const &w) -> float { return w(2); }
 } // namespace detail
 /**
- * Describes the "Bi-directional Reflectance Distribution Function". This function describes the
- * amount of light scattered for a certain pair of directions.
+ * A direction sampled from a BRDF, with everything the integrator needs to weigh it.
  */
-struct BRDF {
-    virtual ~BRDF() = default;
-
+struct BRDFSample {
     /**
-     * wi is the input direction, wo is the output direction. This returns the density of light
-     * scattered for these parameters.
-     *
-     * Note that wo "points toward the viewer", and wi "points toward the light".
-     *
-     * We assume this function treats wavelengths independently, and so for example red light in
-     * won't become green light out. This makes flouroscence impossible to model with this function.
-     *
-     * Furthermore, it returns the results for all wavelengths at the same time. They are thus in a
-     * sense, coupled.
-     *
-     * Note: this function is usually called f() in the rendering equation, and is what we usually
-     * call the BRDF.
-     *
-     * For this function to be physically plausible the following must hold:
-     *  - reciprocity so for a BRDF B we should have B(u, v) = B(v, u)
-     *  - energy conserving, i.e the integral of this function over the sphere is at most 1.
-     *  - np negative values
+     * Light in direction (world), commonly called the light.
+     */
+    float3 wi;
+    /**
+     * The BRDF for wi and the output direction it was sampled for.
+     */
+    RGB f;
+    /**
+     * Probability density of having sampled wi.
+     */
+    float pdf = 1.0f;
+    /**
+     * Absolute cosine of the angle between wi and the normal.
      */
-    virtual auto operator()(float3 const &wi, float3 const &wo, float3 const &N) const noexcept
-        -> RGB = 0;
+    float cosTheta = 0.0f;
+    /**
+     * Which lobe wi was sampled from, for BRDFs with more than one.
+     */
+    uint32_t lobe = 0;
+};
 
+/**
+ * Describes the "Bi-directional Reflectance Distribution Function". This function describes the
+ * amount of light scattered for a certain pair of directions.
+ *
+ * This is a base for the BRDF classes, which are all dispatched statically: Derived provides the
+ * function itself, and may replace the defaults for generateDirection, pdf and sample below.
+ *
+ *      auto operator()(float3 const &wi, float3 const &wo, float3 const &N) const noexcept -> RGB
+ *
+ * wi is the input direction, wo is the output direction. This returns the density of light
+ * scattered for these parameters.
+ *
+ * Note that wo "points toward the viewer", and wi "points toward the light".
+ *
+ * We assume this function treats wavelengths independently, and so for example red light in
+ * won't become green light out. This makes flouroscence impossible to model with this function.
+ *
+ * Furthermore, it returns the results for all wavelengths at the same time. They are thus in a
+ * sense, coupled.
+ *
+ * Note: this function is usually called f() in the rendering equation, and is what we usually
+ * call the BRDF.
+ *
+ * For this function to be physically plausible the following must hold:
+ *  - reciprocity so for a BRDF B we should have B(u, v) = B(v, u)
+ *  - energy conserving, i.e the integral of this function over the sphere is at most 1.
+ *  - np negative values
+ */
+template <typename Derived> struct BRDF {
     /**
      * This kitchen sink function generates a "reflected" direction from the output direction and
      * three random variables (x).
@@ -102,60 +132,105 @@ struct BRDF {
      * @param pdf Probability that this direction was chosen.
      * @return RGB The BRDF (f-value) for these directions.
      */
-    virtual auto
-    generateDirection(float3 const &wo, float3 x, Basis const &b, float3 &wi, float &pdf) const
+    auto generateDirection(float3 const &wo, float3 x, Basis const &b, float3 &wi, float &pdf) const
         -> RGB {
         wi = randomHemisphere(float2(x(0), x(1)), b);
-        pdf = this->pdf(wi, wo, b);
-        return (*this)(wi, wo, b.N);
+        pdf = self().pdf(wi, wo, b);
+        return self()(wi, wo, b.N);
     }
 
-    virtual auto pdf(float3 const &wi, float3 const &wo, Basis const &b) const noexcept -> float {
+    auto pdf(float3 const &wi, float3 const &wo, Basis const &b) const noexcept -> float {
         return randomHemispherePDF();
     }
 
+    /**
+     * Same as generateDirection, but returns everything in one record. BRDFs that can share work
+     * between sampling a direction and evaluating the BRDF and pdf for it should replace this, and
+     * implement generateDirection in terms of it.
+     */
+    auto sample(float3 const &wo, float3 x, Basis const &b) const -> BRDFSample {
+        BRDFSample s;
+        s.f = self().generateDirection(wo, x, b, s.wi, s.pdf);
+        s.cosTheta = abs(dot(s.wi, b.N));
+        return s;
+    }
+
     // TODO: support refracting materials.
+
+  private:
+    auto self() const noexcept -> Derived const & { return static_cast<Derived const &>(*this); }
 };
 
-class GlossyBRDF : public BRDF {
+class GlossyBRDF : public BRDF<GlossyBRDF> {
   public:
     /**
      * @param tint  Tint of highlights.
      * @param sigma Roughness parameter, between [0, 1].
      * @param refidx Refractive index.
+     * @param accuracy How to evaluate the trigonometric functions when sampling.
      */
-    GlossyBRDF(RGB tint, float alpha, float refidx = 1.5)
-        : tint_(tint), alpha_(alpha), refidx_(refidx) {}
+    GlossyBRDF(RGB tint,
+               float alpha,
+               float refidx = 1.5,
+               MathAccuracy accuracy = MathAccuracy::Exact)
+        : tint_(tint), alpha_(alpha), refidx_(refidx), accuracy_(accuracy) {}
 
     auto operator()(float3 const &wi, float3 const &wo, float3 const &N) const noexcept
-        -> RGB override {
+        -> RGB {
         // TODO: we could simplify and optimise this a lot by basis change.
         // TODO: probably numerically troublesome. Can be rewritten.
-
         float cos_thetaO = std::max(0.0f, dot(wo, N));
-        float sin_thetaO = sqrtf(1.0f - cos_thetaO * cos_thetaO);
         float cos_thetaI = std::max(0.0f, dot(wi, N));
-        float sin_thetaI = sqrtf(1.0f - cos_thetaI * cos_thetaI);
-        // This check is crucial, because if this starts generating NaNs the whole image can
-        // end up black or some other strange colour, and it's extremely annoying to find the cause.
-        if (isAlmostZero(cos_thetaO) || isAlmostZero(cos_thetaI))
-            return RGB::black();
-
         float3 h = normalize(wi + wo);
-        if (isAlmostZero(h(0)) && isAlmostZero(h(1)) && isAlmostZero(h(2)))
-            return RGB::black();
         float cos_theta_H = std::max(0.0f, dot(h, N));
-
         float D = models::distributionGTR2(cos_theta_H, alpha_);
-        float G = models::shadowMaskingTR(sin_thetaI / cos_thetaI, sin_thetaO / cos_thetaO, alpha_);
-        float F = models::schlick(cos_theta_H, 1.0f, refidx_);
-
-        return tint_ * (F * D * G / (4.0f * cos_thetaO * cos_thetaI));
+        return reflectance(h, cos_thetaI, cos_thetaO, cos_theta_H, D);
     }
 
     auto generateDirection(float3 const &wo, float3 x, Basis const &b, float3 &wi, float &pdf) const
-        -> RGB override {
-        // Todo: move this into a function.
+        -> RGB {
+        float3 h = sampleHalfVector(x, b);
+        if (dot(h, b.N) < 0.0f)
+            return RGB(0.0f, 0.0f, 0.0f);
+        wi = normalize(2.0 * dot(wo, h) * h - wo);
+
+        pdf = this->pdf(wi, wo, b);
+        return (*this)(wi, wo, b.N);
+    }
+
+    auto pdf(float3 const &wi, float3 const &wo, Basis const &b) const noexcept -> float {
+        float3 h = normalize(wi + wo);
+        float cos_theta_h = std::max(0.0f, dot(h, b.N));
+        return halfVectorPdf(wi, h, cos_theta_h, models::distributionGTR2(cos_theta_h, alpha_));
+    }
+
+    /**
+     * Does the work of operator() and pdf at once, sharing the half vector and the microfacet
+     * distribution between them.
+     *
+     * @param cos_thetaI  dot(wi, N), clamped to be non-negative.
+     * @param cos_thetaO  dot(wo, N), clamped to be non-negative.
+     * @param pdf   Set to pdf(wi, wo, b).
+     */
+    auto evaluate(float3 const &wi,
+                  float3 const &wo,
+                  float3 const &N,
+                  float cos_thetaI,
+                  float cos_thetaO,
+                  float &pdf) const noexcept -> RGB {
+        float3 h = normalize(wi + wo);
+        float cos_theta_H = std::max(0.0f, dot(h, N));
+        float D = models::distributionGTR2(cos_theta_H, alpha_);
+        pdf = halfVectorPdf(wi, h, cos_theta_H, D);
+        return reflectance(h, cos_thetaI, cos_thetaO, cos_theta_H, D);
+    }
+
+    /**
+     * Samples a microfacet normal from the distribution, in proportion to D * cos_theta_H.
+     *
+     * @param x Two sample floats are used.
+     */
+    auto sampleHalfVector(float3 const &x, Basis const &b) const noexcept -> float3 {
         float alpha2 = alpha_ * alpha_;
         float A = 1.0f - x(1);
         float B = 1.0f + (alpha2 - 1.0f) * x(1);
@@ -163,23 +238,51 @@ class GlossyBRDF : public BRDF {
         float sin_theta_H = sqrt(1.0f - cos_theta_H * cos_theta_H);
 
         float phih = 2.0f * Pi * x(0);
+        float cos_phih, sin_phih;
+        if (accuracy_ == MathAccuracy::Fast) {
+            std::tie(sin_phih, cos_phih) = fastmath::sincos(phih);
+        } else {
+            cos_phih = cos(phih);
+            sin_phih = sin(phih);
+        }
 
-        float3 h = normalize(sin_theta_H * cos(phih) * b.B + sin_theta_H * sin(phih) * b.T +
-                             cos_theta_H * b.N);
-        if (dot(h, b.N) < 0.0f)
-            return RGB(0.0f, 0.0f, 0.0f);
-        wi = normalize(2.0 * dot(wo, h) * h - wo);
+        return normalize(sin_theta_H * cos_phih * b.B + sin_theta_H * sin_phih * b.T +
+                         cos_theta_H * b.N);
+    }
 
-        pdf = this->pdf(wi, wo, b);
-        return (*this)(wi, wo, b.N);
+    auto tint() const noexcept -> RGB { return tint_; }
+
+    auto alpha() const noexcept -> float { return alpha_; }
+
+    auto ior() const noexcept -> float { return refidx_; }
+
+    auto accuracy() const noexcept -> MathAccuracy { return accuracy_; }
+
+  private:
+    auto reflectance(float3 const &h,
+                     float cos_thetaI,
+                     float cos_thetaO,
+                     float cos_theta_H,
+                     float D) const noexcept -> RGB {
+        // This check is crucial, because if this starts generating NaNs the whole image can
+        // end up black or some other strange colour, and it's extremely annoying to find the cause.
+        if (isAlmostZero(cos_thetaO) || isAlmostZero(cos_thetaI))
+            return RGB::black();
+        if (isAlmostZero(h(0)) && isAlmostZero(h(1)) && isAlmostZero(h(2)))
+            return RGB::black();
+        float sin_thetaO = sqrtf(1.0f - cos_thetaO * cos_thetaO);
+        float sin_thetaI = sqrtf(1.0f - cos_thetaI * cos_thetaI);
+
+        float G = models::shadowMaskingTR(sin_thetaI / cos_thetaI, sin_thetaO / cos_thetaO, alpha_);
+        float F = models::schlick(cos_theta_H, 1.0f, refidx_);
+
+        return tint_ * (F * D * G / (4.0f * cos_thetaO * cos_thetaI));
     }
 
-    auto pdf(float3 const &wi, float3 const &wo, Basis const &b) const noexcept -> float override {
-        float3 h = normalize(wi + wo);
-        float cos_theta_h = std::max(0.0f, dot(h, b.N));
+    auto halfVectorPdf(float3 const &wi, float3 const &h, float cos_theta_h, float D) const noexcept
+        -> float {
         if (isAlmostZero(cos_theta_h))
             return 1.0f;
-        float D = models::distributionGTR2(cos_theta_h, alpha_);
         float pdfh = D * abs(cos_theta_h);
         float wi_dot_h = dot(wi, h);
         if (isAlmostZero(wi_dot_h))
@@ -187,17 +290,13 @@ class GlossyBRDF : public BRDF {
         return pdfh / (4.0f * wi_dot_h);
     }
 
-    auto tint() const noexcept -> RGB { return tint_; }
-
-    auto ior() const noexcept -> float { return refidx_; }
-
-  private:
     RGB tint_;
     float alpha_;
     float refidx_;
+    MathAccuracy accuracy_;
 };
 
-class OrenNayarBRDF : public BRDF {
+class OrenNayarBRDF : public BRDF<OrenNayarBRDF> {
   public:
     /**
      * @param albedo  The underlying "colour"
@@ -209,26 +308,34 @@ class OrenNayarBRDF : public BRDF {
           b_(0.45f * sigma2_ / (sigma2_ + 0.09f)) {}
 
     auto operator()(float3 const &wi, float3 const &wo, float3 const &N) const noexcept
-        -> RGB override {
+        -> RGB {
         // TODO: we could simplify and optimise this a lot by basis change.
         // TODO: probably numerically troublesome. Can be rewritten.
         float cosThetaI = wi(2);
         float cosThetaO = wo(2);
         float sinThetaI = sqrtf(1.0f - cosThetaI * cosThetaI);
         float sinThetaO = sqrtf(1.0f - cosThetaO * cosThetaO);
-        float phiI = std::acos(wi(0) / sinThetaI);
-        float phiO = std::acos(wo(0) / sinThetaO);
-        float thetaO = std::acos(cosThetaO);
-        float thetaI = std::acos(cosThetaI);
-        float alpha = std::max(thetaI, thetaO);
-        float beta = std::min(thetaI, thetaO);
+        // The angles are never needed by themselves. With phi = acos(w(0) / sinTheta) we have
+        // cos(phiI - phiO) = cos(phiI)cos(phiO) + sin(phiI)sin(phiO), and since both thetas are in
+        // [0, Pi], sin(alpha) * sin(beta) = sinThetaI * sinThetaO.
+        float cosPhiI = wi(0) / sinThetaI;
+        float cosPhiO = wo(0) / sinThetaO;
+        float sinPhiI = sqrtf(1.0f - cosPhiI * cosPhiI);
+        float sinPhiO = sqrtf(1.0f - cosPhiO * cosPhiO);
+        float cosPhiDiff = cosPhiI * cosPhiO + sinPhiI * sinPhiO;
 
         return (albedo_ / cornelis::Pi) *
-               (a_ + b_ * std::max(0.0f, cosf(phiI - phiO)) * sin(alpha) * sin(beta));
+               (a_ + b_ * std::max(0.0f, cosPhiDiff) * sinThetaI * sinThetaO);
     }
 
     auto albedo() const noexcept -> RGB { return albedo_; }
 
+    /**
+     * The A and B terms of the model, which only depend on the roughness.
+     */
+    auto termA() const noexcept -> float { return a_; }
+    auto termB() const noexcept -> float { return b_; }
+
   private:
     RGB albedo_;
     float sigma2_;
@@ -242,18 +349,23 @@ class OrenNayarBRDF : public BRDF {
  * This is suitable for things like a painted surface, wood and so forth. It can probably be abused
  * to look like most opaque surfaces though.
  */
-class LayeredBRDF : public BRDF {
+class LayeredBRDF : public BRDF<LayeredBRDF> {
   public:
     /**
      * @param albedo  The underlying "colour"
      * @param sigma   Roughness parameter in radians.
+     * @param accuracy How to evaluate the trigonometric functions when sampling either lobe.
      */
-    LayeredBRDF(RGB albedo, RGB glossyTint, float perceptualRoughness, float ior)
+    LayeredBRDF(RGB albedo,
+                RGB glossyTint,
+                float perceptualRoughness,
+                float ior,
+                MathAccuracy accuracy = MathAccuracy::Exact)
         : diffuse_(albedo, diffuseRough(perceptualRoughness)),
-          glossy_(glossyTint, glossyRough(perceptualRoughness), ior) {}
+          glossy_(glossyTint, glossyRough(perceptualRoughness), ior, accuracy) {}
 
     auto operator()(float3 const &wi, float3 const &wo, float3 const &N) const noexcept
-        -> RGB override {
+        -> RGB {
         RGB D_f = diffuse_(wi, wo, N);
         RGB G_f = glossy_(wi, wo, N);
         // This is not very realistic but at least scales the diffuse at grazing angles.
@@ -262,7 +374,7 @@ class LayeredBRDF : public BRDF {
                G_f;
     }
 
-    auto pdf(float3 const &wi, float3 const &wo, Basis const &b) const noexcept -> float override {
+    auto pdf(float3 const &wi, float3 const &wo, Basis const &b) const noexcept -> float {
         /* Since we have chosen between two alternatives, we need to multiply our PDF by the
            probability of the chosen path. Let X be the probability of the generated direction, and
            K the probability of the choice.
@@ -277,21 +389,55 @@ class LayeredBRDF : public BRDF {
     }
 
     auto generateDirection(float3 const &wo, float3 x, Basis const &b, float3 &wi, float &pdf) const
-        -> RGB override {
-        float pdf_chosen = 0.0f;
-        RGB brdf;
+        -> RGB {
+        auto s = sample(wo, x, b);
+        wi = s.wi;
+        pdf = s.pdf;
+        return s.f;
+    }
+
+    static constexpr uint32_t DiffuseLobe = 0;
+    static constexpr uint32_t GlossyLobe = 1;
+
+    /**
+     * Picks a lobe with x(2), samples a direction from it, and evaluates operator() and pdf for
+     * that direction. The cosines and the glossy half vector are computed once for both lobes.
+     */
+    auto sample(float3 const &wo, float3 x, Basis const &b) const -> BRDFSample {
+        BRDFSample s;
         if (x(2) < 0.5f) {
-            x(2) *= 2.0f; // Readjust x(2) since we have made a choice on it.
-            brdf = diffuse_.generateDirection(wo, x, b, wi, pdf_chosen);
+            s.lobe = DiffuseLobe;
+            s.wi = randomHemisphere(float2(x(0), x(1)), b, accuracy());
         } else {
-            x(2) = (x(2) - 0.5f) * 2.0f;
-            brdf = glossy_.generateDirection(wo, x, b, wi, pdf_chosen);
+            s.lobe = GlossyLobe;
+            float3 h = glossy_.sampleHalfVector(x, b);
+            if (dot(h, b.N) < 0.0f) {
+                // Only possible through rounding. Give the path no weight.
+                s.wi = float3(b.N);
+                return s;
+            }
+            s.wi = normalize(2.0 * dot(wo, h) * h - wo);
         }
 
-        pdf = this->pdf(wi, wo, b);
-        return (*this)(wi, wo, b.N);
+        float const cos_wi = dot(s.wi, b.N);
+        float const cos_thetaI = std::max(0.0f, cos_wi);
+        float const cos_thetaO = std::max(0.0f, dot(wo, b.N));
+        float glossyPdf = 0.0f;
+        RGB G_f = glossy_.evaluate(s.wi, wo, b.N, cos_thetaI, cos_thetaO, glossyPdf);
+        RGB D_f = diffuse_(s.wi, wo, b.N);
+        // See operator() and pdf.
+        s.f = (1.0f - models::schlick(cos_thetaI, 1.0f, glossy_.ior())) * D_f + G_f;
+        s.pdf = 0.5f * (diffuse_.pdf(s.wi, wo, b) + glossyPdf);
+        s.cosTheta = abs(cos_wi);
+        return s;
     }
 
+    auto diffuse() const noexcept -> OrenNayarBRDF const & { return diffuse_; }
+
+    auto glossy() const noexcept -> GlossyBRDF const & { return glossy_; }
+
+    auto accuracy() const noexcept -> MathAccuracy { return glossy_.accuracy(); }
+
   private:
     static inline auto glossyRough(float perceptual) -> float {
         // This is a remapping suggested by Brent Burley in the Disney Principled Shader paper.
@@ -305,15 +451,15 @@ class LayeredBRDF : public BRDF {
     GlossyBRDF glossy_;
 };
 
-class LambertBRDF : public BRDF {
+class LambertBRDF : public BRDF<LambertBRDF> {
   public:
     LambertBRDF(RGB albedo) : albedo_(albedo) {}
 
     auto operator()(float3 const &wi, float3 const &wo, float3 const &N) const noexcept
-        -> RGB override {
+        -> RGB {
         return albedo_ / cornelis::Pi;
     }
-    auto pdf(float3 const &wi, float3 const &wo, Basis const &b) const noexcept -> float override {
+    auto pdf(float3 const &wi, float3 const &wo, Basis const &b) const noexcept -> float {
         // This is the area of a unit sphere and represents a completely uniform distribution.
         return 1.0f / (4.0f * cornelis::Pi);
     }
@@ -322,18 +468,80 @@ class LambertBRDF : public BRDF {
     RGB albedo_;
 };
 
+/**
+ * The material kinds below are all dispatched statically through Material. A kind provides
+ *
+ *      auto emission(float3 const &P) const noexcept -> RGB
+ *
+ * and, if Scatters is true, a brdf(P, N) returning the BRDF to sample at P.
+ */
 class StandardMaterial {
   public:
-    StandardMaterial(
-        RGB albedo, RGB emission, RGB reflectionTint, float roughness = 0.1f, float ior = 1.5f)
-        : emission_(emission), bsdf_(albedo, reflectionTint, roughness, ior) {}
-
-    auto brdf(float3 const &P, float3 const &N) const noexcept -> BRDF const & { return bsdf_; }
+    static constexpr bool Scatters = true;
+
+    StandardMaterial(RGB albedo,
+                     RGB emission,
+                     RGB reflectionTint,
+                     float roughness = 0.1f,
+                     float ior = 1.5f,
+                     MathAccuracy accuracy = MathAccuracy::Exact)
+        : emission_(emission), bsdf_(albedo, reflectionTint, roughness, ior, accuracy) {}
+
+    auto brdf(float3 const &P, float3 const &N) const noexcept -> LayeredBRDF const & {
+        return bsdf_;
+    }
 
     auto emission(float3 const &P) const noexcept -> RGB { return emission_; }
 
+    /**
+     * The material is the same all over, so these are the same as brdf(P, N) and emission(P) for
+     * any point. For kernels that shade many hits at once.
+     */
+    auto brdf() const noexcept -> LayeredBRDF const & { return bsdf_; }
+    auto emission() const noexcept -> RGB { return emission_; }
+
   private:
     RGB emission_;
     LayeredBRDF bsdf_;
 };
+
+/**
+ * A material that only emits light, and absorbs all light that hits it. Paths end when they hit it.
+ */
+class EmissiveMaterial {
+  public:
+    static constexpr bool Scatters = false;
+
+    EmissiveMaterial(RGB emission) : emission_(emission) {}
+
+    auto emission(float3 const &P) const noexcept -> RGB { return emission_; }
+
+  private:
+    RGB emission_;
+};
+
+using Material = std::variant<StandardMaterial, EmissiveMaterial>;
+
+/**
+ * Samples brdf for the rays in ids, several at a time with SIMD instructions. For every ray k this
+ * is the same as LayeredBRDF::sample(-rayDir, x, constructBasis(N)), up to rounding.
+ *
+ * Whatever doesn't fill a whole batch is padded to one, so a ray gets the same sample whichever
+ * part of ids it is in. Without SIMD, every ray is handed to LayeredBRDF::sample.
+ *
+ * @param rayDirs The directions of the rays that hit the surface, that is -wo.
+ * @param normals The surface normals at the hits.
+ * @param x       Three sample floats per ray.
+ * @param wi      Set to the sampled directions. May be the same spans as rayDirs.
+ * @param weight  Set to f * cosTheta / pdf for the sampled directions, one span per channel.
+ * @param pdf     Set to the pdf of the sampled directions.
+ */
+auto sampleWide(LayeredBRDF const &brdf,
+                SoATuple3f rayDirs,
+                SoATuple3f normals,
+                SoATuple3f x,
+                span<const std::size_t> ids,
+                SoATuple3f wi,
+                SoATuple3f weight,
+                span<float> pdf) -> void;
 } // namespace cornelis
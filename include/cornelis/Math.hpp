@@ -433,4 +433,18 @@ inline auto constructBasis(float3 const &N) -> Basis {
     return base;
 }
 
+/**
+ * How sines, cosines, powers and the like are evaluated while shading.
+ */
+enum class MathAccuracy {
+    /**
+     * The standard library functions, and xsimd's in the SIMD kernels.
+     */
+    Exact,
+    /**
+     * The approximations in FastMath.hpp. Their errors are far below what shows up in an image,
+     * but renders are no longer bit for bit the same as with Exact.
+     */
+    Fast,
+};
 } // namespace cornelis
\ No newline at end of file
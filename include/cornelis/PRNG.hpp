@@ -5,6 +5,10 @@
 
 #include <XoshiroCpp.hpp>
 
+#include <cornelis/FastMath.hpp>
+#include <cornelis/Math.hpp>
+#include <cornelis/Span.hpp>
+
 namespace cornelis {
 // TODO: clean up this place.
 using seed_type = uint64_t;
@@ -25,17 +29,51 @@ struct PRNG {
     auto operator()() noexcept -> float { return next(); }
 
     XoshiroCpp::Xoshiro128Plus xoroshiro;
-
-    friend auto cloneForThread(PRNG const &prng, std::size_t threadK) -> PRNG;
 };
 
-inline auto cloneForThread(PRNG const &prng, std::size_t threadK) -> PRNG {
-    PRNG copy(prng);
-    for (decltype(threadK) i = 0; i < threadK; i++)
-        copy.xoroshiro.jump();
-    return copy;
+namespace detail {
+// An integer hash with good avalanche: every input bit affects every output bit with a probability
+// close to one half. From Chris Wellons' hash prospector ("lowbias32").
+constexpr auto hash32(uint32_t x) noexcept -> uint32_t {
+    x ^= x >> 16;
+    x *= 0x7feb352du;
+    x ^= x >> 15;
+    x *= 0x846ca68bu;
+    x ^= x >> 16;
+    return x;
+}
+} // namespace detail
+
+/**
+ * A uniform number in [0, 1), for one dimension of one sample of a pixel. The pixel is its index in
+ * the frame, and the sample its index among the samples of the pixel.
+ *
+ * This is a counter-based generator: the numbers are hashes of their keys, instead of the states
+ * of a sequence. Any number can be computed on its own, so which numbers a path gets doesn't depend
+ * on what was drawn before it, in which tile, or on which thread.
+ */
+constexpr auto sampleRandom(uint32_t seed,
+                            uint32_t pixel,
+                            uint32_t sample,
+                            uint32_t dimension) noexcept -> float {
+    uint32_t h = detail::hash32(seed + pixel);
+    h = detail::hash32(h + sample);
+    h = detail::hash32(h + dimension);
+    // The top 24 bits fill the mantissa exactly.
+    return static_cast<float>(h >> 8) * 0x1.0p-24f;
 }
 
+/**
+ * out[k] = sampleRandom(seed, pixels[k], samples[k], dimensions[k]) for every k in ids, with
+ * several k at a time in SIMD lanes.
+ */
+auto sampleRandomWide(uint32_t seed,
+                      span<const uint32_t> pixels,
+                      span<const uint32_t> samples,
+                      span<const uint32_t> dimensions,
+                      span<const std::size_t> ids,
+                      span<float> out) -> void;
+
 inline auto randomHemisphere(float2 const x) -> float3 {
     auto [x1, x2] = x;
 
@@ -54,6 +92,19 @@ inline auto randomHemisphere(float2 x, Basis const &base) -> float3 {
     return base.B * v(0) + base.T * v(1) + base.N * v(2);
 }
 
+/**
+ * Same as randomHemisphere(x, base), but with the sine and cosine from FastMath.hpp if accuracy is
+ * MathAccuracy::Fast.
+ */
+inline auto randomHemisphere(float2 x, Basis const &base, MathAccuracy accuracy) -> float3 {
+    if (accuracy == MathAccuracy::Exact)
+        return randomHemisphere(x, base);
+    auto [x1, x2] = x;
+    auto [s, c] = fastmath::sincos(2.0f * Pi * x2);
+    float b = sqrt(1.0f - x1 * x1);
+    return base.B * (c * b) + base.T * (s * b) + base.N * x1;
+}
+
 inline auto randomHemisphere(PRNG &prng, Basis const &base) -> float3 {
     float3 v = randomHemisphere(prng);
     return base.B * v(0) + base.T * v(1) + base.N * v(2);
@@ -61,4 +112,17 @@ inline auto randomHemisphere(PRNG &prng, Basis const &base) -> float3 {
 
 constexpr auto randomHemispherePDF() -> float { return 1.0f / (2.0f * Pi); }
 
+/**
+ * The weight of a sample drawn with density pdf, when another strategy could have drawn it with
+ * density otherPdf: the power heuristic with an exponent of two (Veach, 1997). The weights the two
+ * strategies give a sample add up to one. Zero if pdf is.
+ */
+constexpr auto powerHeuristic(float pdf, float otherPdf) -> float {
+    if (!(pdf > 0.0f))
+        return 0.0f;
+    // As a ratio, since the squares of the densities of small lights overflow.
+    float const ratio = otherPdf / pdf;
+    return 1.0f / (1.0f + ratio * ratio);
+}
+
 } // namespace cornelis
@@ -1,7 +1,10 @@
 #pragma once
 
+#include <filesystem>
+#include <limits>
 #include <memory>
 
+#include <cornelis/FrameBuffer.hpp>
 #include <cornelis/RenderOptions.hpp>
 #include <cornelis/SceneDescription.hpp>
 #include <functional>
@@ -12,7 +15,18 @@ enum class RenderCommand {
     Abort,
 };
 enum class RenderStatus { Running, Done, Aborted, Failed };
-struct RenderProgress {};
+struct RenderProgress {
+    /**
+     * The passes over the whole frame finished so far. See RenderOptions::progressiveSamples.
+     */
+    int32_t passesCompleted = 0;
+    /**
+     * The relative mean squared error of the image after the last finished pass, estimated from
+     * its even and odd samples, see halfBufferRelativeMSE. Infinite until every pixel has two
+     * samples.
+     */
+    double relativeMSE = std::numeric_limits<double>::infinity();
+};
 class RenderSession {
   public:
     using ProgressCallback =
@@ -43,6 +57,17 @@ class RenderSession {
      */
     auto render(ProgressCallback onProgress) -> void;
 
+    /**
+     * The linear colours of the last render, before they are converted to sRGB and saved.
+     */
+    auto image() const -> RGBFrameBuffer const &;
+
+    /**
+     * Saves the image of the last render as an 8 bit sRGB PNG. Rendering doesn't save anything by
+     * itself.
+     */
+    auto saveImage(std::filesystem::path const &path) const -> void;
+
   private:
     struct State;
     std::unique_ptr<State> me_;
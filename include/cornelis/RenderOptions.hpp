@@ -2,16 +2,243 @@
 
 #include <stdint.h>
 
+#include <cornelis/Math.hpp>
+
 namespace cornelis {
+/**
+ * The algorithms available for building the scene BVH.
+ */
+enum class BVHBuilder {
+    /**
+     * Surface area heuristic evaluated over binned centroids. Gives trees that are fast to trace,
+     * and is what final renders should use.
+     */
+    BinnedSAH,
+    /**
+     * Linear BVH from Morton codes. Builds many times faster, but the trees are slower to trace.
+     * Meant for previews, where time to first pixel matters more.
+     */
+    Morton,
+};
+
+/**
+ * How camera rays are traced through the scene.
+ */
+enum class PrimaryRayTraversal {
+    /**
+     * All the rays of a pixel together through the binary BVH, each ray tested against each node.
+     */
+    Stream,
+    /**
+     * Like Stream, but nodes are first culled against the bounds of all the rays of the pixel. See
+     * intersectScenePacket.
+     */
+    Packet,
+};
+
+/**
+ * How rays that have bounced at least once are traced through the scene.
+ */
+enum class SecondaryRayTraversal {
+    /**
+     * All the rays of a pixel together through the binary BVH. Mostly useful for comparing against
+     * Wide.
+     */
+    BinaryStream,
+    /**
+     * One ray at a time through a wide BVH, testing all the children of a node at once with SIMD
+     * instructions.
+     */
+    Wide,
+};
+
+/**
+ * How the paths of a tile are organised while they are traced.
+ */
+enum class Integrator {
+    /**
+     * One pixel at a time: the samples of a pixel are traced together until they have all
+     * terminated.
+     */
+    PerPixel,
+    /**
+     * The samples of all the pixels in a tile are traced together in large waves, and the paths
+     * that are still alive are compacted after every bounce. See RenderOptions::wavefrontSize.
+     */
+    Wavefront,
+};
+
+/**
+ * Where the random numbers of the samples of a pixel come from. See Sampler.
+ */
+enum class SamplePattern {
+    /**
+     * Independent uniform numbers, see sampleRandom.
+     */
+    Random,
+    /**
+     * The Sobol sequence, shuffled and Owen scrambled differently for every pixel. The samples of
+     * a pixel are stratified against each other, so the noise falls off faster with the number of
+     * samples than with Random.
+     */
+    Sobol,
+    /**
+     * Tables of progressive multi-jittered (0, 2) sequences, made once per process, with every
+     * pair of dimensions of a pixel using its own table and order. Stratified in pairs instead of
+     * sets of four, for any power of two samples up to the length of the tables, and cheaper to
+     * draw than Sobol.
+     */
+    PMJ02,
+    /**
+     * Sobol points like above, but shared out between the pixels of each 128 by 128 square in a
+     * hierarchical order, so that the error of neighbouring pixels tends to cancel out. What error
+     * is left is high frequency noise, which looks much better at low sample counts, 4 to 16
+     * samples per pixel. Best with a power of two for samplesAA.
+     */
+    BlueNoise,
+};
+
 struct RenderOptions {
     static constexpr int32_t DefaultSamplesAA = 1 << 8;
+    /**
+     * The most samples a pixel can take. The samples of a pixel are added up in fixed point, which
+     * is exact for this many samples of light up to MaxSampleLight.
+     */
+    static constexpr int32_t MaxSamplesAA = 1 << 19;
+    /**
+     * The light of a sample is clamped to this in each channel. Samples with NaN or negative light
+     * count as black, and the render logs how many there were: they are bugs.
+     */
+    static constexpr float MaxSampleLight = 0x1.0p19f;
 
     /**
      * Number of samples to use for anti-aliasing a pixel. As Cornelis is a Monte-Carlo path tracer,
      * this generally improves all kind of noise.
      *
-     * As such, it's the main quality control parameter.
+     * As such, it's the main quality control parameter. At most MaxSamplesAA.
      */
     decltype(DefaultSamplesAA) samplesAA = DefaultSamplesAA;
+
+    /**
+     * Where the random numbers of the samples come from.
+     */
+    SamplePattern samplePattern = SamplePattern::Sobol;
+
+    /**
+     * If set, every hit on a surface that scatters light picks one of the lights of the scene, the
+     * ones that matter the most to it more often, samples a point on it and traces a shadow ray
+     * there. Light that bounced paths find by hitting a light is then weighed against the light
+     * sampled this way, with multiple importance sampling, so that it isn't counted twice: each
+     * counts for the most where it is the less noisy of the two. Far less noisy for small lights,
+     * which bounced paths rarely hit, while glossy surfaces still see large lights through their
+     * BRDF samples.
+     */
+    bool nextEventEstimation = true;
+
+    /**
+     * If above zero, pixels are sampled adaptively, in passes over the whole frame: after
+     * adaptiveMinSamples each, a pixel only takes more samples while the standard error of its
+     * mean luminance is above this fraction of the mean. The samples that converged pixels don't
+     * take go to the noisy ones instead, up to adaptiveMaxSamples per pixel, so samplesAA becomes
+     * the average number of samples per pixel the frame may take. See planAdaptivePass.
+     */
+    float adaptiveErrorTarget = 0.0f;
+
+    /**
+     * The samples every pixel takes before adaptive sampling decides anything. The variance of
+     * fewer than a handful of samples is too rough to go by.
+     */
+    int32_t adaptiveMinSamples = 16;
+
+    /**
+     * The most samples adaptive sampling gives a pixel. At most MaxSamplesAA.
+     */
+    int32_t adaptiveMaxSamples = 1 << 12;
+
+    /**
+     * If above zero, the frame is rendered progressively, in passes of this many samples per pixel
+     * over the whole of it, until it has samplesAA samples per pixel or timeBudget is used up. Each
+     * pass adds to the samples of the passes before it, so after every pass the image is a complete
+     * render, only a noisier one. Ignored with adaptive sampling, which sizes its own passes.
+     */
+    int32_t progressiveSamples = 0;
+
+    /**
+     * If above zero, the most seconds rendering may take, not counting loading the scene. Once the
+     * time is up, tiles that have not started yet are skipped, while those that finished keep their
+     * samples. The first pass is always finished, so the render may take longer than this if that
+     * pass does. Without progressive or adaptive sampling, the render is done in progressive passes
+     * of a few samples per pixel, so that running out of time doesn't leave part of the image
+     * black.
+     */
+    double timeBudget = 0.0;
+
+    /**
+     * If above zero, progressive and adaptive renders stop after the first pass that leaves the
+     * estimated relative mean squared error of the image at or below this, see
+     * halfBufferRelativeMSE. The estimate is passed to the progress callback after every pass
+     * whether this is set or not. samplesAA and timeBudget still limit the render.
+     */
+    float convergenceTarget = 0.0f;
+
+    /**
+     * The largest width and height of the tiles the frame is split into. Tiles are rendered in
+     * parallel, so smaller tiles balance better between threads, while larger tiles give the
+     * wavefront integrator larger batches. The image is the same for any tile size.
+     */
+    int32_t tileSize = 32;
+
+    /**
+     * How to organise the paths while tracing them.
+     */
+    Integrator integrator = Integrator::Wavefront;
+
+    /**
+     * The most paths the wavefront integrator traces at once. A tile with more samples than this is
+     * traced in several waves.
+     */
+    int32_t wavefrontSize = 1 << 14;
+
+    /**
+     * If set, the wavefront integrator starts a new sample in the place of every path that
+     * terminates, so the batches stay full until the tile runs out of samples. Otherwise each
+     * wave runs until all of its paths have terminated.
+     */
+    bool pathRegeneration = true;
+
+    /**
+     * If set, the wavefront integrator sorts the paths between bounces by the direction octant
+     * and position of their rays, so rays that are likely to visit the same parts of the scene are
+     * traced after each other.
+     */
+    bool sortRays = false;
+
+    /**
+     * If set, the hits of each bounce are bucketed by material and shaded one material at a time,
+     * instead of in the order the rays are stored. Standard materials are then shaded with SIMD
+     * kernels, which round slightly differently from the scalar code, so the image is not bit for
+     * bit the same as without this. It is the same for any tile and wavefront size either way.
+     */
+    bool shadeByMaterial = true;
+
+    /**
+     * Whether shading may use approximations of the transcendental functions.
+     */
+    MathAccuracy mathAccuracy = MathAccuracy::Exact;
+
+    /**
+     * How to build the acceleration structure for the scene.
+     */
+    BVHBuilder bvhBuilder = BVHBuilder::BinnedSAH;
+
+    /**
+     * How to trace camera rays.
+     */
+    PrimaryRayTraversal primaryRayTraversal = PrimaryRayTraversal::Packet;
+
+    /**
+     * How to trace rays after the first bounce.
+     */
+    SecondaryRayTraversal secondaryRayTraversal = SecondaryRayTraversal::Wide;
 };
 } // namespace cornelis
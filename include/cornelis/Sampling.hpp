@@ -1,8 +1,134 @@
 #pragma once
 
+#include <array>
 #include <stdint.h>
-#include <vector>
+
+#include <cornelis/BlueNoise.hpp>
+#include <cornelis/PRNG.hpp>
+#include <cornelis/RenderOptions.hpp>
+#include <cornelis/Span.hpp>
 
 namespace cornelis {
-    
+/**
+ * What each dimension of a pixel sample is used for. The dimensions come in sets of four, one set
+ * per use, and a sampler may stratify the dimensions of a set against each other; the first two of
+ * a set are the best stratified pair. See SamplePattern::Sobol.
+ */
+namespace dimension {
+constexpr uint32_t PerSet = 4;
+
+/**
+ * The point within the pixel that the camera ray goes through. These make up the first set.
+ */
+constexpr uint32_t PixelX = 0;
+constexpr uint32_t PixelY = 1;
+
+/**
+ * The sets each hit of a path uses: one for the bounce, and one for sampling a light.
+ */
+constexpr uint32_t SetsPerHit = 2;
+
+/**
+ * The first dimension of the set used for the bounce off the hit of a path at the given depth.
+ * Zero is the depth of camera rays.
+ */
+constexpr auto bounce(int32_t depth) -> uint32_t {
+    return PerSet * (1 + SetsPerHit * static_cast<uint32_t>(depth));
+}
+
+/**
+ * The first dimension of the set used for sampling a light from the hit of a path at the given
+ * depth.
+ */
+constexpr auto light(int32_t depth) -> uint32_t { return bounce(depth) + PerSet; }
+
+/**
+ * Where in the set of a bounce the three numbers for BRDF::sample start, in the order sample takes
+ * them.
+ */
+constexpr uint32_t BRDF = 0;
+/**
+ * Where in the set of a bounce the number for russian roulette is.
+ */
+constexpr uint32_t Roulette = 3;
+
+/**
+ * Where in the set of a light the two numbers for the point on the light are, and the number that
+ * picks the light.
+ */
+constexpr uint32_t LightPoint = 0;
+constexpr uint32_t LightChoice = 2;
+} // namespace dimension
+
+/**
+ * Hands out the numbers of the samples of the pixels, uniform in [0, 1), in one of the patterns of
+ * SamplePattern. Every number is a function of its pixel, the index of its sample within the
+ * pixel, and its dimension alone, so samples can be computed in any order and on any thread.
+ */
+class Sampler {
+  public:
+    /**
+     * Pixels are numbered row by row in a frame frameWidth pixels wide. SamplePattern::BlueNoise
+     * needs to know where they are, and how many samples each pixel is expected to take; the other
+     * patterns ignore both. The blue noise pattern uses defaultBlueNoiseOrdering.
+     */
+    Sampler(SamplePattern pattern,
+            uint32_t frameWidth,
+            uint32_t samplesPerPixel,
+            uint32_t seed = static_cast<uint32_t>(PRNG::DefaultSeed));
+
+    /**
+     * The given dimension of the given sample of a pixel. The pixel is its index in the frame.
+     */
+    auto operator()(uint32_t pixel, uint32_t sample, uint32_t dimension) const -> float;
+
+    /**
+     * out[k] = (*this)(pixels[k], samples[k], dimensions[k]) for every k in ids, with several k at
+     * a time in SIMD lanes.
+     */
+    auto sampleWide(span<const uint32_t> pixels,
+                    span<const uint32_t> samples,
+                    span<const uint32_t> dimensions,
+                    span<const std::size_t> ids,
+                    span<float> out) const -> void;
+
+    auto pattern() const noexcept -> SamplePattern { return pattern_; }
+
+  private:
+    // The index into the Sobol sequence and the seed for sobolSample, with SamplePattern::Sobol or
+    // SamplePattern::BlueNoise.
+    auto sobolKey(uint32_t pixel, uint32_t sample, uint32_t dimension) const
+        -> std::array<uint32_t, 2>;
+
+    SamplePattern pattern_;
+    uint32_t seed_;
+    uint32_t frameWidth_;
+    // The samples per pixel rounded up to a power of two.
+    uint32_t blockSize_;
+    BlueNoiseOrdering const *ordering_ = nullptr;
+};
+
+/**
+ * Component (0 to 3) of point index of the four dimensional Sobol sequence, with nested uniform
+ * scrambling seeded by seed. Every component is scrambled differently. Point index is shuffled
+ * first, with another nested uniform scrambling, which keeps the stratification of every power of
+ * two long prefix of the points. This is the construction of Burley, "Practical Hash-based Owen
+ * Scrambling" (2020).
+ */
+auto sobolSample(uint32_t index, uint32_t component, uint32_t seed) -> float;
+
+/**
+ * The number of points in each table of PMJ02 points, and the number of tables.
+ */
+constexpr uint32_t PMJ02TableSize = 1024;
+constexpr uint32_t PMJ02TableCount = 64;
+
+/**
+ * Point index of a table of progressive multi-jittered (0, 2) sequences (Christensen et al.,
+ * "Progressive Multi-Jittered Sample Sequences", 2018), as fixed point numbers with 32 bits after
+ * the binary point. Every aligned run of 2^m points of a table, the first 2^m included, puts
+ * exactly one point in each rectangle of area 2^-m with power of two sides. The tables are made on
+ * first use.
+ */
+auto pmj02Point(uint32_t table, uint32_t index) -> std::array<uint32_t, 2>;
 } // namespace cornelis
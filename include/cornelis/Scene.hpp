@@ -2,7 +2,10 @@
 
 #include <memory>
 
+#include <cornelis/BVH.hpp>
 #include <cornelis/Camera.hpp>
+#include <cornelis/Geometry.hpp>
+#include <cornelis/LightBVH.hpp>
 #include <cornelis/Materials.hpp>
 #include <cornelis/SceneDescription.hpp>
 #include <cornelis/SoA.hpp>
@@ -12,6 +15,38 @@ namespace tags {
 struct Radius {
     using element_type = float;
 };
+
+struct TangentX {
+    using element_type = float;
+};
+
+struct TangentY {
+    using element_type = float;
+};
+
+struct TangentZ {
+    using element_type = float;
+};
+
+struct BitangentX {
+    using element_type = float;
+};
+
+struct BitangentY {
+    using element_type = float;
+};
+
+struct BitangentZ {
+    using element_type = float;
+};
+
+struct InvHalfWidthF {
+    using element_type = float;
+};
+
+struct InvHalfHeightF {
+    using element_type = float;
+};
 } // namespace tags
 
 /**
@@ -27,6 +62,9 @@ struct SphereData : public SoAObject<tags::PositionX,
 
 /**
  * Planes in a Point - Normal form.
+ *
+ * The tangent frame from constructBasis and the reciprocals of the half extents are computed once
+ * here, so intersectPlaneWide doesn't have to do it for every ray.
  */
 struct PlaneData : public SoAObject<tags::PositionX,
                                     tags::PositionY,
@@ -34,19 +72,133 @@ struct PlaneData : public SoAObject<tags::PositionX,
                                     tags::NormalX,
                                     tags::NormalY,
                                     tags::NormalZ,
+                                    tags::TangentX,
+                                    tags::TangentY,
+                                    tags::TangentZ,
+                                    tags::BitangentX,
+                                    tags::BitangentY,
+                                    tags::BitangentZ,
                                     tags::WidthF,
                                     tags::HeightF,
+                                    tags::InvHalfWidthF,
+                                    tags::InvHalfHeightF,
                                     tags::MaterialId> {
     PlaneData(span<const PlaneDescription> descriptions);
 };
 
 struct SceneData {
-    SceneData(SceneDescription const &descr);
+    /**
+     * @param mathAccuracy Passed on to the materials.
+     */
+    SceneData(SceneDescription const &descr,
+              BVHBuilder bvhBuilder = BVHBuilder::BinnedSAH,
+              MathAccuracy mathAccuracy = MathAccuracy::Exact);
+
+    /**
+     * The BVH numbers the primitives with the spheres first, then the planes.
+     */
+    auto isSphere(uint32_t primitive) -> bool {
+        return primitive < spheres.get<tags::Radius>().size();
+    }
+
+    /**
+     * The material of a primitive, numbered as for isSphere.
+     */
+    auto materialId(uint32_t primitive) -> std::size_t {
+        if (isSphere(primitive))
+            return spheres.get<tags::MaterialId>()[primitive];
+        return planes.get<tags::MaterialId>()[primitive - spheres.get<tags::Radius>().size()];
+    }
 
     PerspectiveCamera camera;
 
-    std::vector<StandardMaterial> materials;
+    /**
+     * One per material in the description, of the simplest kind that renders it the same way.
+     */
+    std::vector<Material> materials;
     SphereData spheres;
     PlaneData planes;
+    /**
+     * The primitives whose material emits light, numbered as for isSphere and in that order. Next
+     * event estimation samples these directly, see sampleLight.
+     */
+    std::vector<uint32_t> lights;
+    /**
+     * A tree over lights, for picking the lights that matter the most to a point. Light k of the
+     * tree is lights[k]. Built at the same time as bvh.
+     */
+    LightBVH lightBvh;
+    BVH bvh;
+    /**
+     * bvh collapsed into a wide BVH, for tracing incoherent rays. See intersectSceneWide.
+     */
+    WideBVH wideBvh;
+    /**
+     * How long it took to build bvh, in seconds. For diagnostics.
+     */
+    double bvhBuildTime = 0.0;
 };
+
+/**
+ * Samples a direction from P towards a point on a light, one of SceneData::lights: within the cone
+ * it covers if it's a sphere, and over its area if it's a plane. See sampleSphere and
+ * sampleRectangle.
+ *
+ * @param x Two sample floats.
+ */
+auto sampleLight(SceneData &scene, uint32_t light, float3 const &P, float2 const &x)
+    -> ShapeSample;
+
+/**
+ * The pdf of sampleLight for the direction wi from P, given that a ray along it hits the light
+ * distance away. For weighing light found by other means against sampling it directly.
+ */
+auto lightPdf(SceneData &scene, uint32_t light, float3 const &P, float3 const &wi, float distance)
+    -> float;
+
+/**
+ * Finds the closest intersection among all the primitives in the scene for each active ray.
+ *
+ * This gives the same result as calling intersectSphere and intersectPlane for every primitive,
+ * but only tests the rays against the primitives whose BVH nodes they actually pass through. The
+ * active rays are traversed together as a stream, so coherent rays share most of the work, and the
+ * primitives in the leaves are tested against several rays at a time. See intersectSphereWide and
+ * intersectPlaneWide.
+ */
+auto intersectScene(SceneData &scene,
+                    SoATuple3f rayOrigins,
+                    SoATuple3f rayDirs,
+                    IntersectionData &data,
+                    span<const std::size_t> activeRayIds,
+                    RayDirections directions = RayDirections::Arbitrary) -> void;
+
+/**
+ * Does the same as intersectScene, but takes advantage of rays that start at the same point and
+ * point in similar directions, such as the camera rays of a pixel.
+ *
+ * Nodes are first tested against conservative bounds of all the rays, which culls nodes that
+ * none of them can hit without looking at each ray. When few rays remain in a subtree, they finish
+ * it one at a time. Rays that don't share an origin are traced exactly as by intersectScene.
+ */
+auto intersectScenePacket(SceneData &scene,
+                          SoATuple3f rayOrigins,
+                          SoATuple3f rayDirs,
+                          IntersectionData &data,
+                          span<const std::size_t> activeRayIds,
+                          RayDirections directions = RayDirections::Arbitrary) -> void;
+
+/**
+ * Does the same as intersectScene, but traces the rays one at a time through the wide BVH,
+ * visiting the children of each node nearest first.
+ *
+ * Rays that have bounced off diffuse surfaces go every which way, so a stream of them quickly
+ * thins out to single rays anyway. For those, the shallower tree and the SIMD node tests of the
+ * wide BVH are faster.
+ */
+auto intersectSceneWide(SceneData &scene,
+                        SoATuple3f rayOrigins,
+                        SoATuple3f rayDirs,
+                        IntersectionData &data,
+                        span<const std::size_t> activeRayIds,
+                        RayDirections directions = RayDirections::Arbitrary) -> void;
 } // namespace cornelis
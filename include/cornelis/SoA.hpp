@@ -96,6 +96,10 @@ struct MaterialId {
     using element_type = std::size_t; 
 };
 
+struct PrimitiveId {
+    using element_type = uint32_t;
+};
+
 } // namespace tags
 
 /**
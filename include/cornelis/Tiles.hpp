@@ -3,14 +3,13 @@
 #include <vector>
 
 #include <cornelis/Math.hpp>
-#include <cornelis/PRNG.hpp>
 
 namespace cornelis {
 using TileCoord = PixelCoord;
 
 struct TileInfo {
     explicit TileInfo(std::size_t number, PixelRect pBounds)
-        : tileNumber(number), bounds(pBounds), randomGen() {}
+        : tileNumber(number), bounds(pBounds) {}
     /**
      * A unique identifier for this tile.
      */
@@ -19,16 +18,6 @@ struct TileInfo {
      * The bounds, in pixel space, of this tile. Equivalently, the pixels that belong to this tile.
      */
     PixelRect bounds;
-    /**
-     * A random generator specific to this tile. Is only supposed to be used by one thread at a
-     * time.
-     *
-     * As long as this is only used for samples for pixels belonging to this tile, we can ensure
-     * that the same seed yields the same image; at least on the same machine.
-     *
-     * At construction, this is just a default seed generator.
-     */
-    PRNG randomGen;
 };
 
 /**
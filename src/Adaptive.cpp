@@ -0,0 +1,95 @@
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <numeric>
+#include <vector>
+
+#include <cornelis/Adaptive.hpp>
+
+namespace cornelis {
+auto RunningVariance::relativeError() const noexcept -> double {
+    if (count_ < 2)
+        return std::numeric_limits<double>::infinity();
+    return std::sqrt(variance() / count_) / std::max(mean_, 1.0 / 256.0);
+}
+
+auto planAdaptivePass(span<RunningVariance const> pixels,
+                      std::size_t width,
+                      RenderOptions const &options,
+                      std::size_t budget,
+                      span<uint32_t> samples) -> std::size_t {
+    double const target = options.adaptiveErrorTarget;
+    auto const maxSamples = static_cast<uint32_t>(std::max(options.adaptiveMaxSamples, 1));
+    std::size_t const height = pixels.size() / width;
+    std::size_t wanted = 0;
+    std::vector<double> errors(pixels.size(), 0.0);
+    for (std::size_t p = 0; p != pixels.size(); p++) {
+        uint32_t const count = pixels[p].count();
+        // The worst error around the pixel: a few samples that all missed the light look like a
+        // converged pixel, but rarely all over a neighbourhood.
+        std::size_t const x = p % width, y = p / width;
+        double error = 0.0;
+        for (std::size_t j = y > 0 ? y - 1 : 0; j != std::min(y + 2, height); j++) {
+            for (std::size_t i = x > 0 ? x - 1 : 0; i != std::min(x + 2, width); i++)
+                error = std::max(error, pixels[j * width + i].relativeError());
+        }
+        samples[p] = 0;
+        errors[p] = error;
+        if (count >= maxSamples || !(error > target))
+            continue;
+        uint32_t const limit = std::min(count, maxSamples - count);
+        double const needed = std::ceil(count * ((error / target) * (error / target) - 1.0));
+        samples[p] = needed < limit ? static_cast<uint32_t>(needed) : limit;
+        wanted += samples[p];
+    }
+    if (wanted <= budget)
+        return wanted;
+
+    // Each pixel gets its share rounded down, and what the rounding left over goes one sample at a
+    // time to the pixels that lost the most to it, the noisiest first among equals. Otherwise a
+    // budget smaller than the number of noisy pixels would round to no samples at all.
+    std::size_t planned = 0;
+    double const share = static_cast<double>(budget) / static_cast<double>(wanted);
+    std::vector<double> remainders(samples.size(), 0.0);
+    for (std::size_t p = 0; p != samples.size(); p++) {
+        double const exact = samples[p] * share;
+        auto const rounded = static_cast<uint32_t>(exact);
+        remainders[p] = samples[p] > rounded ? exact - rounded : -1.0;
+        samples[p] = rounded;
+        planned += rounded;
+    }
+    std::vector<std::size_t> order(samples.size());
+    std::iota(std::begin(order), std::end(order), std::size_t{0});
+    std::stable_sort(std::begin(order), std::end(order), [&](std::size_t a, std::size_t b) {
+        if (remainders[a] != remainders[b])
+            return remainders[a] > remainders[b];
+        return errors[a] > errors[b];
+    });
+    for (auto const p : order) {
+        if (planned == budget || remainders[p] < 0.0)
+            break;
+        samples[p]++;
+        planned++;
+    }
+    return planned;
+}
+
+auto halfBufferRelativeMSE(span<float const> even,
+                           span<float const> odd,
+                           span<uint32_t const> samples) -> double {
+    double error = 0.0, energy = 0.0;
+    for (std::size_t p = 0; p != samples.size(); p++) {
+        if (samples[p] < 2)
+            return std::numeric_limits<double>::infinity();
+        // The variance of the difference of the halves is sigma^2 (1 / nEven + 1 / nOdd), that of
+        // the mean of all the samples sigma^2 / n.
+        double const n = samples[p], nEven = (samples[p] + 1) / 2, nOdd = samples[p] / 2;
+        double const difference = even[p] - odd[p];
+        error += difference * difference * nEven * nOdd / (n * n);
+        energy += static_cast<double>(even[p]) * odd[p];
+    }
+    if (energy <= 0.0)
+        return error > 0.0 ? std::numeric_limits<double>::infinity() : 0.0;
+    return error / energy;
+}
+} // namespace cornelis
@@ -0,0 +1,464 @@
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+
+#include <tbb/blocked_range.h>
+#include <tbb/parallel_for.h>
+#include <tbb/parallel_invoke.h>
+#include <tbb/parallel_reduce.h>
+#include <tbb/parallel_sort.h>
+
+#include <cornelis/BVH.hpp>
+#include <cornelis/Expects.hpp>
+
+namespace cornelis {
+namespace {
+// Spreads the lower 10 bits of v out so there are two zero bits between each of them.
+auto expandBits(uint32_t v) -> uint32_t {
+    v = (v * 0x00010001u) & 0xFF0000FFu;
+    v = (v * 0x00000101u) & 0x0F00F00Fu;
+    v = (v * 0x00000011u) & 0xC30C30C3u;
+    v = (v * 0x00000005u) & 0x49249249u;
+    return v;
+}
+
+// The cost of visiting an interior node relative to testing a primitive.
+constexpr float TraversalCost = 0.5f;
+constexpr std::size_t MaxPrimitivesInLeaf = 4;
+constexpr std::size_t NumBins = 16;
+// Ranges smaller than this are built on the current thread, it's not worth spawning tasks for.
+constexpr std::size_t ParallelBuildThreshold = 4096;
+
+struct BuildPrimitive {
+    AABB bounds;
+    float3 centroid;
+    uint32_t index;
+};
+
+/**
+ * Nodes as the builders produce them. The builders work on disjoint subtrees in parallel, so the
+ * nodes end up in whatever order they were allocated in, and are flattened into depth first order
+ * once the build is done.
+ */
+struct BuildNode {
+    AABB bounds;
+    uint32_t children[2];
+    // The range of primitives for leaves, count is zero for interior nodes.
+    uint32_t begin;
+    uint32_t count;
+    uint8_t axis;
+};
+
+struct BuildState {
+    BuildState(span<const AABB> primitiveBounds)
+        : prims(primitiveBounds.size()), nodes(2 * primitiveBounds.size() - 1), nextNode(0) {
+        tbb::parallel_for(tbb::blocked_range<std::size_t>(0, prims.size()), [&](auto const &r) {
+            for (auto i = r.begin(); i != r.end(); i++) {
+                auto const &b = primitiveBounds[i];
+                prims[i] = {b, centroid(b), static_cast<uint32_t>(i)};
+            }
+        });
+    }
+
+    // A binary tree with n leaves has 2n - 1 nodes, and we never make empty leaves, so this can't
+    // overflow.
+    auto allocate() -> uint32_t { return nextNode++; }
+
+    auto makeLeaf(uint32_t node, AABB const &bounds, std::size_t begin, std::size_t end) -> void {
+        nodes[node] = {.bounds = bounds,
+                       .children = {0, 0},
+                       .begin = static_cast<uint32_t>(begin),
+                       .count = static_cast<uint32_t>(end - begin),
+                       .axis = 0};
+    }
+
+    auto makeInterior(uint32_t node, AABB const &bounds, uint32_t a, uint32_t b, uint8_t axis)
+        -> void {
+        nodes[node] = {.bounds = bounds, .children = {a, b}, .begin = 0, .count = 0, .axis = axis};
+    }
+
+    std::vector<BuildPrimitive> prims;
+    std::vector<BuildNode> nodes;
+    std::atomic<uint32_t> nextNode;
+};
+
+struct RangeBounds {
+    AABB bounds;
+    AABB centroidBounds;
+};
+
+auto rangeBounds(BuildState const &state, std::size_t begin, std::size_t end) -> RangeBounds {
+    auto accumulate = [&](tbb::blocked_range<std::size_t> const &r, RangeBounds acc) {
+        for (auto i = r.begin(); i != r.end(); i++) {
+            acc.bounds = merge(acc.bounds, state.prims[i].bounds);
+            acc.centroidBounds = merge(acc.centroidBounds, state.prims[i].centroid);
+        }
+        return acc;
+    };
+    tbb::blocked_range<std::size_t> range(begin, end);
+    if (end - begin < ParallelBuildThreshold)
+        return accumulate(range, {});
+    return tbb::parallel_reduce(
+        range, RangeBounds{}, accumulate, [](RangeBounds const &a, RangeBounds const &b) {
+            return RangeBounds{merge(a.bounds, b.bounds),
+                               merge(a.centroidBounds, b.centroidBounds)};
+        });
+}
+
+auto largestAxis(AABB const &box) -> uint8_t {
+    float3 extent = box.max - box.min;
+    uint8_t axis = 0;
+    if (extent(1) > extent(axis))
+        axis = 1;
+    if (extent(2) > extent(axis))
+        axis = 2;
+    return axis;
+}
+
+struct Bin {
+    AABB bounds;
+    std::size_t count = 0;
+};
+
+using Bins = std::array<Bin, NumBins>;
+
+/**
+ * Top-down builder that chooses each split by evaluating the surface area heuristic at the borders
+ * of a fixed number of bins along the longest axis of the centroids.
+ *
+ * Large ranges are binned with a parallel reduction, and the two children of a node are built as
+ * separate tasks.
+ */
+struct BinnedSAHBuilder {
+    BuildState &state;
+
+    auto build(std::size_t begin, std::size_t end) -> uint32_t {
+        auto const node = state.allocate();
+        auto [bounds, centroidBounds] = rangeBounds(state, begin, end);
+        auto &prims = state.prims;
+
+        auto const n = end - begin;
+        if (n == 1) {
+            state.makeLeaf(node, bounds, begin, end);
+            return node;
+        }
+
+        uint8_t const axis = largestAxis(centroidBounds);
+        float const extent = centroidBounds.max(axis) - centroidBounds.min(axis);
+
+        std::size_t mid = begin;
+        if (extent <= 0.0f) {
+            // All centroids coincide, there's no meaningful split.
+            if (n <= MaxPrimitivesInLeaf) {
+                state.makeLeaf(node, bounds, begin, end);
+                return node;
+            }
+            mid = begin + n / 2;
+        } else {
+            float const binScale = NumBins / extent;
+            float const axisMin = centroidBounds.min(axis);
+            auto binOf = [=](BuildPrimitive const &p) -> std::size_t {
+                auto b = static_cast<std::size_t>((p.centroid(axis) - axisMin) * binScale);
+                return std::min(b, NumBins - 1);
+            };
+
+            auto const bins = binPrimitives(begin, end, binOf);
+
+            // Sweep from the right to get the cost of everything to the right of a split, then from
+            // the left to find the cheapest split.
+            std::array<float, NumBins - 1> rightCost{};
+            AABB rightBounds;
+            std::size_t rightCount = 0;
+            for (auto i = NumBins - 1; i > 0; i--) {
+                rightBounds = merge(rightBounds, bins[i].bounds);
+                rightCount += bins[i].count;
+                rightCost[i - 1] = rightCount * surfaceArea(rightBounds);
+            }
+
+            AABB leftBounds;
+            std::size_t leftCount = 0;
+            float bestCost = INFINITY;
+            std::size_t bestSplit = 0;
+            for (std::size_t i = 0; i < NumBins - 1; i++) {
+                leftBounds = merge(leftBounds, bins[i].bounds);
+                leftCount += bins[i].count;
+                float cost = leftCount * surfaceArea(leftBounds) + rightCost[i];
+                if (cost < bestCost) {
+                    bestCost = cost;
+                    bestSplit = i;
+                }
+            }
+
+            float const area = surfaceArea(bounds);
+            float const splitCost = TraversalCost + (area > 0.0f ? bestCost / area : 0.0f);
+            if (n <= MaxPrimitivesInLeaf && static_cast<float>(n) <= splitCost) {
+                state.makeLeaf(node, bounds, begin, end);
+                return node;
+            }
+
+            auto it = std::partition(prims.begin() + begin,
+                                     prims.begin() + end,
+                                     [&](auto const &p) { return binOf(p) <= bestSplit; });
+            mid = static_cast<std::size_t>(it - prims.begin());
+            if (mid == begin || mid == end) {
+                // Binning failed to separate anything (can happen with very uneven centroids).
+                mid = begin + n / 2;
+                std::nth_element(prims.begin() + begin,
+                                 prims.begin() + mid,
+                                 prims.begin() + end,
+                                 [axis](auto const &a, auto const &b) {
+                                     return a.centroid(axis) < b.centroid(axis);
+                                 });
+            }
+        }
+
+        uint32_t children[2];
+        if (n < ParallelBuildThreshold) {
+            children[0] = build(begin, mid);
+            children[1] = build(mid, end);
+        } else {
+            tbb::parallel_invoke([&] { children[0] = build(begin, mid); },
+                                 [&] { children[1] = build(mid, end); });
+        }
+        state.makeInterior(node, bounds, children[0], children[1], axis);
+        return node;
+    }
+
+    template <typename BinOf>
+    auto binPrimitives(std::size_t begin, std::size_t end, BinOf const &binOf) -> Bins {
+        auto accumulate = [&](tbb::blocked_range<std::size_t> const &r, Bins bins) {
+            for (auto i = r.begin(); i != r.end(); i++) {
+                auto &bin = bins[binOf(state.prims[i])];
+                bin.count++;
+                bin.bounds = merge(bin.bounds, state.prims[i].bounds);
+            }
+            return bins;
+        };
+        tbb::blocked_range<std::size_t> range(begin, end);
+        if (end - begin < ParallelBuildThreshold)
+            return accumulate(range, {});
+        return tbb::parallel_reduce(range, Bins{}, accumulate, [](Bins a, Bins const &b) {
+            for (std::size_t i = 0; i < NumBins; i++) {
+                a[i].count += b[i].count;
+                a[i].bounds = merge(a[i].bounds, b[i].bounds);
+            }
+            return a;
+        });
+    }
+};
+
+constexpr int MortonBits = 30;
+
+/**
+ * Builds a "linear BVH": primitives are sorted along a Morton curve through their centroids, and
+ * the tree falls out of the sorted codes by splitting each range where the highest differing bit
+ * changes. This is much faster than the SAH builder, but the trees are worse to trace.
+ */
+struct MortonBuilder {
+    BuildState &state;
+    std::vector<uint32_t> codes;
+
+    auto sortPrimitives() -> void {
+        auto const n = state.prims.size();
+        auto centroidBounds = rangeBounds(state, 0, n).centroidBounds;
+
+        std::vector<std::pair<uint32_t, uint32_t>> keyed(n);
+        tbb::parallel_for(tbb::blocked_range<std::size_t>(0, n), [&](auto const &r) {
+            for (auto i = r.begin(); i != r.end(); i++)
+                keyed[i] = {mortonCode(state.prims[i].centroid, centroidBounds),
+                            static_cast<uint32_t>(i)};
+        });
+        tbb::parallel_sort(keyed.begin(), keyed.end());
+
+        std::vector<BuildPrimitive> sorted(n);
+        codes.resize(n);
+        tbb::parallel_for(tbb::blocked_range<std::size_t>(0, n), [&](auto const &r) {
+            for (auto i = r.begin(); i != r.end(); i++) {
+                codes[i] = keyed[i].first;
+                sorted[i] = state.prims[keyed[i].second];
+            }
+        });
+        state.prims = std::move(sorted);
+    }
+
+    auto build(std::size_t begin, std::size_t end) -> uint32_t {
+        auto const node = state.allocate();
+        auto const n = end - begin;
+
+        uint32_t const differing = codes[begin] ^ codes[end - 1];
+        if (n <= MaxPrimitivesInLeaf && (differing == 0 || n == 1)) {
+            state.makeLeaf(node, rangeBounds(state, begin, end).bounds, begin, end);
+            return node;
+        }
+
+        std::size_t mid;
+        uint8_t axis = 0;
+        if (differing == 0) {
+            // Identical codes, so anything goes.
+            mid = begin + n / 2;
+        } else {
+            // The codes are sorted, so find the first one with the highest differing bit set.
+            int const bit = 31 - std::countl_zero(differing);
+            uint32_t const mask = 1u << bit;
+            mid = static_cast<std::size_t>(
+                std::partition_point(codes.begin() + begin,
+                                     codes.begin() + end,
+                                     [mask](uint32_t code) { return (code & mask) == 0; }) -
+                codes.begin());
+            // x is in the highest bit of each triplet.
+            axis = static_cast<uint8_t>(2 - bit % 3);
+        }
+
+        uint32_t children[2];
+        if (n < ParallelBuildThreshold) {
+            children[0] = build(begin, mid);
+            children[1] = build(mid, end);
+        } else {
+            tbb::parallel_invoke([&] { children[0] = build(begin, mid); },
+                                 [&] { children[1] = build(mid, end); });
+        }
+        state.makeInterior(node,
+                           merge(state.nodes[children[0]].bounds, state.nodes[children[1]].bounds),
+                           children[0],
+                           children[1],
+                           axis);
+        return node;
+    }
+};
+
+// Writes the subtree at node into bvh.nodes in depth first order.
+auto flatten(BuildState const &state, uint32_t node, BVH &bvh) -> uint32_t {
+    auto const index = static_cast<uint32_t>(bvh.nodes.size());
+    bvh.nodes.push_back(BVHNode{});
+    auto const &b = state.nodes[node];
+    if (b.count > 0) {
+        bvh.nodes[index] = {.bounds = b.bounds,
+                            .offset = b.begin,
+                            .count = static_cast<uint16_t>(b.count),
+                            .axis = 0};
+    } else {
+        flatten(state, b.children[0], bvh);
+        auto second = flatten(state, b.children[1], bvh);
+        bvh.nodes[index] = {.bounds = b.bounds, .offset = second, .count = 0, .axis = b.axis};
+    }
+    return index;
+}
+
+// Writes a wide node for the binary subtree at node into wide.nodes, depth first, by repeatedly
+// opening the interior child with the largest surface area until the node is full.
+auto collapse(BVH const &bvh, uint32_t node, WideBVH &wide) -> uint32_t {
+    std::array<uint32_t, WideBVHNode::Width> children;
+    std::size_t numChildren = 0;
+    if (bvh.nodes[node].isLeaf()) {
+        // Only happens for the root.
+        children[numChildren++] = node;
+    } else {
+        children[numChildren++] = node + 1;
+        children[numChildren++] = bvh.nodes[node].offset;
+    }
+    while (numChildren < WideBVHNode::Width) {
+        std::size_t largest = numChildren;
+        float largestArea = -1.0f;
+        for (std::size_t c = 0; c < numChildren; c++) {
+            auto const &child = bvh.nodes[children[c]];
+            if (!child.isLeaf() && surfaceArea(child.bounds) > largestArea) {
+                largest = c;
+                largestArea = surfaceArea(child.bounds);
+            }
+        }
+        if (largest == numChildren)
+            break;
+        auto const opened = children[largest];
+        children[largest] = opened + 1;
+        children[numChildren++] = bvh.nodes[opened].offset;
+    }
+
+    auto const index = static_cast<uint32_t>(wide.nodes.size());
+    WideBVHNode result{};
+    result.numChildren = static_cast<uint8_t>(numChildren);
+    for (std::size_t c = 0; c < WideBVHNode::Width; c++) {
+        AABB bounds = c < numChildren ? bvh.nodes[children[c]].bounds : AABB{};
+        result.minX[c] = bounds.min(0);
+        result.minY[c] = bounds.min(1);
+        result.minZ[c] = bounds.min(2);
+        result.maxX[c] = bounds.max(0);
+        result.maxY[c] = bounds.max(1);
+        result.maxZ[c] = bounds.max(2);
+    }
+    wide.nodes.push_back(result);
+
+    for (std::size_t c = 0; c < numChildren; c++) {
+        auto const &child = bvh.nodes[children[c]];
+        if (child.isLeaf()) {
+            wide.nodes[index].offset[c] = child.offset;
+            wide.nodes[index].count[c] = child.count;
+        } else {
+            auto const childIndex = collapse(bvh, children[c], wide);
+            wide.nodes[index].offset[c] = childIndex;
+            wide.nodes[index].count[c] = 0;
+        }
+    }
+    return index;
+}
+} // namespace
+
+BVH::BVH(span<const AABB> primitiveBounds, BVHBuilder builder) {
+    CORNELIS_EXPECTS(primitiveBounds.size() < UINT32_MAX / 2, "Too many primitives for a BVH.");
+    if (primitiveBounds.empty())
+        return;
+
+    BuildState state(primitiveBounds);
+    uint32_t root = 0;
+    switch (builder) {
+    case BVHBuilder::BinnedSAH:
+        root = BinnedSAHBuilder{state}.build(0, state.prims.size());
+        break;
+    case BVHBuilder::Morton: {
+        MortonBuilder morton{state, {}};
+        morton.sortPrimitives();
+        root = morton.build(0, state.prims.size());
+        break;
+    }
+    }
+
+    nodes.reserve(state.nextNode);
+    flatten(state, root, *this);
+
+    primitives.resize(state.prims.size());
+    for (std::size_t i = 0; i != state.prims.size(); i++)
+        primitives[i] = state.prims[i].index;
+}
+
+auto mortonCode(float3 const &p, AABB const &bounds) -> uint32_t {
+    float3 extent = bounds.max - bounds.min;
+    uint32_t code = 0;
+    for (std::size_t c = 0; c < 3; c++) {
+        float x = extent(c) > 0.0f ? (p(c) - bounds.min(c)) / extent(c) : 0.0f;
+        auto q = static_cast<uint32_t>(std::clamp(x * 1024.0f, 0.0f, 1023.0f));
+        code |= expandBits(q) << (2 - c);
+    }
+    return code;
+}
+
+WideBVH::WideBVH(BVH const &bvh) {
+    if (bvh.empty())
+        return;
+    collapse(bvh, 0, *this);
+}
+
+auto sahCost(BVH const &bvh) -> float {
+    if (bvh.empty())
+        return 0.0f;
+    float const rootArea = surfaceArea(bvh.nodes[0].bounds);
+    if (rootArea <= 0.0f)
+        return 0.0f;
+
+    float cost = 0.0f;
+    for (auto const &node : bvh.nodes) {
+        float const p = surfaceArea(node.bounds) / rootArea;
+        cost += node.isLeaf() ? p * node.count : p * TraversalCost;
+    }
+    return cost;
+}
+} // namespace cornelis
@@ -0,0 +1,354 @@
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cmath>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+#include <tbb/parallel_for.h>
+
+#include <cornelis/BlueNoise.hpp>
+#include <cornelis/PRNG.hpp>
+#include <cornelis/Sampling.hpp>
+#include <cornelis/Span.hpp>
+
+namespace cornelis {
+// The bytes of data/bluenoise.bin, compiled in from BlueNoiseData.cpp.in by src/CMakeLists.txt, so
+// that the ordering doesn't depend on where the data directory is.
+extern unsigned char const BlueNoiseData[];
+extern std::size_t const BlueNoiseDataSize;
+
+namespace {
+constexpr std::array<char, 4> Magic = {'C', 'B', 'N', 'O'};
+constexpr uint32_t Version = 1;
+
+// The orders a square can visit its four quarters in, as the place of each quarter in the order.
+// Quarter q is the one at (q & 1, q >> 1).
+constexpr auto quarterOrders() -> std::array<std::array<uint8_t, 4>, 24> {
+    std::array<std::array<uint8_t, 4>, 24> orders{};
+    std::array<uint8_t, 4> order = {0, 1, 2, 3};
+    for (auto &o : orders) {
+        o = order;
+        std::next_permutation(std::begin(order), std::end(order));
+    }
+    return orders;
+}
+
+constexpr auto QuarterOrders = quarterOrders();
+
+// A hierarchical ordering of a square of 2^levels pixels on a side: the order of the quarters of
+// every square of every level, level 0 being the whole square. The squares of a level are
+// numbered by the quarters on the way down to them, two bits per level.
+class Hierarchy {
+  public:
+    Hierarchy(uint32_t levels, PRNG &prng) : levels_(levels), orders_(levels) {
+        for (uint32_t l = 0; l != levels; l++) {
+            orders_[l].resize(std::size_t(1) << (2 * l));
+            for (auto &o : orders_[l])
+                o = static_cast<uint8_t>(prng.xoroshiro() % QuarterOrders.size());
+        }
+    }
+
+    auto rank(uint32_t x, uint32_t y) const -> uint32_t {
+        uint32_t rank = 0, square = 0;
+        for (uint32_t l = 0; l != levels_; l++) {
+            uint32_t const shift = levels_ - 1 - l;
+            uint32_t const quarter = ((x >> shift) & 1) | ((y >> shift) & 1) << 1;
+            rank = rank * 4 + QuarterOrders[orders_[l][square]][quarter];
+            square = square * 4 + quarter;
+        }
+        return rank;
+    }
+
+    auto order(uint32_t level, uint32_t square) -> uint8_t & { return orders_[level][square]; }
+
+  private:
+    uint32_t levels_;
+    std::vector<std::vector<uint8_t>> orders_;
+};
+
+// How well an ordering spreads error as blue noise: the error each rank gets, for a few step
+// functions at a few sample counts and scramblings, and the energy of those errors after a blur
+// over the pixels. The energy is low when the errors of close pixels cancel out. The step
+// functions are the test integrands of Heitz et al.
+class BlurredError {
+  public:
+    static constexpr uint32_t Steps = 8;
+    static constexpr uint32_t Scramblings = 4;
+    static constexpr std::array<uint32_t, 5> SampleCounts = {1, 2, 4, 8, 16};
+    static constexpr uint32_t Values = Steps * Scramblings * SampleCounts.size();
+    static constexpr int32_t Radius = 3;
+
+    BlurredError(uint32_t size, PRNG &prng)
+        : size_(size), errors(std::size_t(size) * size * Values), blurred(errors.size(), 0.0f),
+          delta(errors.size(), 0.0f), touched(size * size, 0) {
+        for (int32_t y = -Radius; y <= Radius; y++) {
+            for (int32_t x = -Radius; x <= Radius; x++)
+                kernel[(y + Radius) * (2 * Radius + 1) + x + Radius] =
+                    std::exp(-static_cast<float>(x * x + y * y) / (2.0f * 1.5f * 1.5f));
+        }
+
+        // A step is 1 on one side of a line through the unit square, 0 on the other.
+        std::array<std::array<float, 3>, Steps> steps;
+        for (auto &step : steps) {
+            float const angle = prng.next() * 6.2831853f;
+            float const x = prng.next(), y = prng.next();
+            step = {std::cos(angle), std::sin(angle), std::cos(angle) * x + std::sin(angle) * y};
+        }
+        std::array<uint32_t, Scramblings> seeds;
+        for (auto &seed : seeds)
+            seed = static_cast<uint32_t>(prng.xoroshiro());
+
+        uint32_t const n = size * size;
+        tbb::parallel_for(uint32_t(0), n, [&](uint32_t rank) {
+            float *e = &errors[std::size_t(rank) * Values];
+            for (uint32_t s = 0; s != Scramblings; s++) {
+                for (uint32_t c = 0; c != SampleCounts.size(); c++) {
+                    uint32_t const count = SampleCounts[c];
+                    std::array<uint32_t, Steps> hits{};
+                    for (uint32_t k = 0; k != count; k++) {
+                        float const x = sobolSample(rank * count + k, 0, seeds[s]);
+                        float const y = sobolSample(rank * count + k, 1, seeds[s]);
+                        for (uint32_t t = 0; t != Steps; t++)
+                            hits[t] += steps[t][0] * x + steps[t][1] * y > steps[t][2];
+                    }
+                    for (uint32_t t = 0; t != Steps; t++)
+                        *e++ = static_cast<float>(hits[t]) / static_cast<float>(count);
+                }
+            }
+        });
+        // Only the error matters, and every value should count the same.
+        for (uint32_t v = 0; v != Values; v++) {
+            double mean = 0.0, square = 0.0;
+            for (uint32_t r = 0; r != n; r++)
+                mean += errors[std::size_t(r) * Values + v];
+            mean /= n;
+            for (uint32_t r = 0; r != n; r++) {
+                float &e = errors[std::size_t(r) * Values + v];
+                e -= static_cast<float>(mean);
+                square += double(e) * e;
+            }
+            float const scale = square > 0.0 ? static_cast<float>(std::sqrt(n / square)) : 0.0f;
+            for (uint32_t r = 0; r != n; r++)
+                errors[std::size_t(r) * Values + v] *= scale;
+        }
+    }
+
+    // Starts over with the given rank for every pixel.
+    auto reset(std::vector<uint32_t> const &ranks) -> void {
+        ranks_ = ranks;
+        std::fill(std::begin(blurred), std::end(blurred), 0.0f);
+        for (uint32_t p = 0; p != ranks_.size(); p++)
+            splat(p, &errors[std::size_t(ranks_[p]) * Values], blurred);
+    }
+
+    // How much the energy changes if the given pixels change rank. Apply makes the change.
+    auto change(span<uint32_t const> pixels, span<uint32_t const> ranks) -> double {
+        for (auto p : touchedPixels) {
+            std::fill_n(&delta[std::size_t(p) * Values], Values, 0.0f);
+            touched[p] = 0;
+        }
+        touchedPixels.clear();
+        for (std::size_t i = 0; i != pixels.size(); i++) {
+            float const *from = &errors[std::size_t(ranks_[pixels[i]]) * Values];
+            float const *to = &errors[std::size_t(ranks[i]) * Values];
+            std::array<float, Values> difference;
+            for (uint32_t v = 0; v != Values; v++)
+                difference[v] = to[v] - from[v];
+            splat(pixels[i], difference.data(), delta);
+        }
+        double energy = 0.0;
+        for (auto p : touchedPixels) {
+            float const *b = &blurred[std::size_t(p) * Values];
+            float const *d = &delta[std::size_t(p) * Values];
+            for (uint32_t v = 0; v != Values; v++)
+                energy += d[v] * (2.0f * b[v] + d[v]);
+        }
+        return energy;
+    }
+
+    auto apply(span<uint32_t const> pixels, span<uint32_t const> ranks) -> void {
+        change(pixels, ranks);
+        for (auto p : touchedPixels) {
+            for (uint32_t v = 0; v != Values; v++)
+                blurred[std::size_t(p) * Values + v] += delta[std::size_t(p) * Values + v];
+        }
+        for (std::size_t i = 0; i != pixels.size(); i++)
+            ranks_[pixels[i]] = ranks[i];
+    }
+
+  private:
+    // Adds the blurred values of pixel p to out, and notes what it touched.
+    auto splat(uint32_t p, float const *values, std::vector<float> &out) -> void {
+        int32_t const size = static_cast<int32_t>(size_);
+        int32_t const px = static_cast<int32_t>(p % size_), py = static_cast<int32_t>(p / size_);
+        for (int32_t y = -Radius; y <= Radius; y++) {
+            for (int32_t x = -Radius; x <= Radius; x++) {
+                uint32_t const q = static_cast<uint32_t>(((py + y + size) % size) * size +
+                                                         (px + x + size) % size);
+                float const w = kernel[(y + Radius) * (2 * Radius + 1) + x + Radius];
+                float *o = &out[std::size_t(q) * Values];
+                for (uint32_t v = 0; v != Values; v++)
+                    o[v] += w * values[v];
+                if (!touched[q]) {
+                    touched[q] = 1;
+                    touchedPixels.push_back(q);
+                }
+            }
+        }
+    }
+
+    uint32_t size_;
+    std::array<float, (2 * Radius + 1) * (2 * Radius + 1)> kernel;
+    // Errors by rank, and the blurred errors and the change to them by pixel.
+    std::vector<float> errors;
+    std::vector<float> blurred;
+    std::vector<float> delta;
+    std::vector<unsigned char> touched;
+    std::vector<uint32_t> touchedPixels;
+    std::vector<uint32_t> ranks_;
+};
+
+auto fail(std::filesystem::path const &path, char const *what) -> std::runtime_error {
+    return std::runtime_error("Blue noise ordering " + path.string() + ": " + what);
+}
+} // namespace
+
+auto BlueNoiseOrdering::generate(uint32_t size, uint64_t seed) -> BlueNoiseOrdering {
+    if (size == 0 || size > 256 || !std::has_single_bit(size))
+        throw std::invalid_argument("The size of a blue noise ordering must be a power of two "
+                                    "up to 256.");
+    uint32_t const levels = static_cast<uint32_t>(std::countr_zero(size));
+    PRNG prng(seed);
+    Hierarchy hierarchy(levels, prng);
+    BlurredError error(size, prng);
+
+    std::vector<uint32_t> ranks(size * size);
+    for (uint32_t p = 0; p != ranks.size(); p++)
+        ranks[p] = hierarchy.rank(p % size, p / size);
+    error.reset(ranks);
+
+    // Tries every order of the quarters of every square, smallest squares first, and keeps the
+    // best one.
+    std::vector<uint32_t> pixels, candidate;
+    for (uint32_t l = levels; l-- != 0;) {
+        uint32_t const side = size >> l;
+        for (uint32_t square = 0; square != (1u << (2 * l)); square++) {
+            uint32_t x0 = 0, y0 = 0;
+            for (uint32_t k = 0; k != l; k++) {
+                uint32_t const quarter = (square >> (2 * (l - 1 - k))) & 3;
+                x0 = x0 * 2 + (quarter & 1);
+                y0 = y0 * 2 + (quarter >> 1);
+            }
+            x0 *= side;
+            y0 *= side;
+            pixels.clear();
+            for (uint32_t y = y0; y != y0 + side; y++) {
+                for (uint32_t x = x0; x != x0 + side; x++)
+                    pixels.push_back(y * size + x);
+            }
+
+            uint8_t &order = hierarchy.order(l, square);
+            uint8_t const current = order;
+            uint8_t best = current;
+            double bestChange = 0.0;
+            candidate.resize(pixels.size());
+            for (uint8_t o = 0; o != QuarterOrders.size(); o++) {
+                if (o == current)
+                    continue;
+                order = o;
+                for (std::size_t i = 0; i != pixels.size(); i++)
+                    candidate[i] = hierarchy.rank(pixels[i] % size, pixels[i] / size);
+                double const change = error.change(pixels, candidate);
+                if (change < bestChange) {
+                    bestChange = change;
+                    best = o;
+                }
+            }
+            order = best;
+            if (best != current) {
+                for (std::size_t i = 0; i != pixels.size(); i++) {
+                    candidate[i] = hierarchy.rank(pixels[i] % size, pixels[i] / size);
+                    ranks[pixels[i]] = candidate[i];
+                }
+                error.apply(pixels, candidate);
+            }
+        }
+    }
+
+    std::vector<uint16_t> ranks16(std::begin(ranks), std::end(ranks));
+    return BlueNoiseOrdering(size, std::move(ranks16));
+}
+
+auto BlueNoiseOrdering::load(std::filesystem::path const &path) -> BlueNoiseOrdering {
+    std::ifstream in(path, std::ios::binary);
+    if (!in)
+        throw fail(path, "can't be opened");
+    return read(in, path);
+}
+
+auto BlueNoiseOrdering::read(std::istream &in, std::filesystem::path const &path)
+    -> BlueNoiseOrdering {
+    auto readU32 = [&in]() {
+        unsigned char b[4] = {};
+        in.read(reinterpret_cast<char *>(b), 4);
+        return uint32_t(b[0]) | uint32_t(b[1]) << 8 | uint32_t(b[2]) << 16 | uint32_t(b[3]) << 24;
+    };
+
+    std::array<char, 4> magic{};
+    in.read(magic.data(), magic.size());
+    if (!in || magic != Magic)
+        throw fail(path, "is not a blue noise ordering");
+    if (readU32() != Version)
+        throw fail(path, "has an unknown version");
+    uint32_t const size = readU32();
+    if (!in || size == 0 || size > 256 || !std::has_single_bit(size))
+        throw fail(path, "has a bad size");
+
+    std::vector<uint16_t> ranks(size * size);
+    std::vector<unsigned char> bytes(2 * ranks.size());
+    in.read(reinterpret_cast<char *>(bytes.data()), static_cast<std::streamsize>(bytes.size()));
+    if (!in)
+        throw fail(path, "is truncated");
+    std::vector<unsigned char> seen(ranks.size(), 0);
+    for (std::size_t p = 0; p != ranks.size(); p++) {
+        ranks[p] = static_cast<uint16_t>(bytes[2 * p] | bytes[2 * p + 1] << 8);
+        if (ranks[p] >= ranks.size() || seen[ranks[p]]++)
+            throw fail(path, "has ranks that are not a permutation");
+    }
+    return BlueNoiseOrdering(size, std::move(ranks));
+}
+
+auto BlueNoiseOrdering::save(std::filesystem::path const &path) const -> void {
+    std::ofstream out(path, std::ios::binary);
+    auto writeU32 = [&out](uint32_t v) {
+        char const b[4] = {static_cast<char>(v),
+                           static_cast<char>(v >> 8),
+                           static_cast<char>(v >> 16),
+                           static_cast<char>(v >> 24)};
+        out.write(b, 4);
+    };
+    out.write(Magic.data(), Magic.size());
+    writeU32(Version);
+    writeU32(size_);
+    for (auto rank : ranks_) {
+        char const b[2] = {static_cast<char>(rank), static_cast<char>(rank >> 8)};
+        out.write(b, 2);
+    }
+    if (!out)
+        throw fail(path, "can't be written");
+}
+
+auto defaultBlueNoiseOrdering() -> BlueNoiseOrdering const & {
+    // Read on first use, which is thread safe for statics.
+    static auto const ordering = [] {
+        std::istringstream in(
+            std::string(reinterpret_cast<char const *>(BlueNoiseData), BlueNoiseDataSize),
+            std::ios::binary);
+        return BlueNoiseOrdering::read(in, "data/bluenoise.bin");
+    }();
+    return ordering;
+}
+} // namespace cornelis
@@ -1,4 +1,5 @@
 #include <cornelis/Color.hpp>
+#include <cornelis/FastMath.hpp>
 namespace cornelis {
 
 auto RGB::operator+=(RGB const &rgb) noexcept -> RGB & {
@@ -29,6 +30,10 @@ auto RGB::clamp(float minComponent, float maxComponent) const noexcept -> RGB {
                std::clamp(values[2], minComponent, maxComponent));
 }
 
+auto luminance(RGB const &rgb) noexcept -> float {
+    return 0.2126f * rgb(0) + 0.7152f * rgb(1) + 0.0722f * rgb(2);
+}
+
 // adapted from GLSL versions at
 // https://github.com/skurmedel/shaders/blob/master/glsl/gamma_correct.glsl
 /*
@@ -61,11 +66,14 @@ SRGB srgb_gamma_linearize(SRGB rgb) {
     standards.
     See the comments for srgb_gamma_linearize for more info.
 */
-SRGB srgb_gamma_correct(SRGB rgb) {
+SRGB srgb_gamma_correct(SRGB rgb, MathAccuracy accuracy = MathAccuracy::Exact) {
     const float a = 0.055f;
+    auto power = [accuracy](float x, float y) -> float {
+        return accuracy == MathAccuracy::Fast ? fastmath::pow(x, y) : pow(x, y);
+    };
 
 #define SRGB_TRANSFORM_CH(v, x)                                                                    \
-    { v = (x <= 0.0031308) ? (x * 12.95f) : ((1 + a) * pow(x, 1.0f / 2.4f) - a); }
+    { v = (x <= 0.0031308) ? (x * 12.95f) : ((1 + a) * power(x, 1.0f / 2.4f) - a); }
 
     SRGB ret = SRGB{0};
     SRGB_TRANSFORM_CH(ret(0), rgb(0));
@@ -78,4 +86,8 @@ SRGB srgb_gamma_correct(SRGB rgb) {
 }
 
 auto toSRGB(RGB const &rgb) -> SRGB { return srgb_gamma_correct({rgb(0), rgb(1), rgb(2)}); }
+
+auto toSRGB(RGB const &rgb, MathAccuracy accuracy) -> SRGB {
+    return srgb_gamma_correct({rgb(0), rgb(1), rgb(2)}, accuracy);
+}
 } // namespace cornelis
@@ -1,6 +1,11 @@
+#include <algorithm>
+#include <cmath>
+
 #include <cornelis/Expects.hpp>
 #include <cornelis/Geometry.hpp>
 
+#include "Simd.hpp"
+
 namespace cornelis {
 IntersectionData::IntersectionData(std::size_t n) : SoAObject(n) { reset(); }
 
@@ -31,18 +36,25 @@ inline auto rayT(SoATuple3f rayOrigins, SoATuple3f rayDirections, std::size_t k,
 }
 } // namespace
 
-auto intersectSphere(SoATuple3f rayOrigins,
-                     SoATuple3f rayDirs,
-                     float3 sphereCenter,
-                     float sphereRadius,
-                     std::size_t materialId,
-                     IntersectionData &data,
-                     std::vector<std::size_t> const &activeRayIds) -> void {
+namespace {
+// intersectSphere, but for Normalized directions it skips the divisions by the squared length of
+// the direction, exactly as intersectSphereWide does. Handles the rays left over by
+// intersectSphereWide, so a ray gets the same hit whichever part of a batch it is in.
+auto intersectSphereScalar(SoATuple3f rayOrigins,
+                           SoATuple3f rayDirs,
+                           float3 sphereCenter,
+                           float sphereRadius,
+                           std::size_t materialId,
+                           uint32_t primitiveId,
+                           IntersectionData &data,
+                           span<const std::size_t> activeRayIds,
+                           RayDirections directions) -> void {
     auto [rx, ry, rz] = rayOrigins;
     auto [rdx, rdy, rdz] = rayDirs;
     auto intersected = data.get<tags::Intersected>();
     auto params = data.get<tags::RayParam0>();
     auto materialIds = data.get<tags::MaterialId>();
+    auto primitiveIds = data.get<tags::PrimitiveId>();
     auto [IPx, IPy, IPz] = getPositions(data);
     auto [INx, INy, INz] = getNormalSpans(data);
     // TODO: precondition that ensure sizes are the same!
@@ -71,14 +83,18 @@ auto intersectSphere(SoATuple3f rayOrigins,
 
         float3 P = float3{rx[k], ry[k], rz[k]} - sphereCenter;
 
-        // If we assumed the direction was normalized we could remove this step.
-        // That is: A = 1
-        float A = dot(k, k, rayDirs);
         float B = dot(P, k, rayDirs);
         float C = mag2(P);
 
-        float u = 2.0f * B / A;
-        float v = (C - sphereRadius * sphereRadius) / A;
+        float u, v;
+        if (directions == RayDirections::Normalized) {
+            u = 2.0f * B;
+            v = C - sphereRadius * sphereRadius;
+        } else {
+            float A = dot(k, k, rayDirs);
+            u = 2.0f * B / A;
+            v = (C - sphereRadius * sphereRadius) / A;
+        }
 
         // Solve t^2 + u t + v = 0  <=> (t + u/2)^2 - u^2/4 + v = 0
         float discriminant = -v + (u * u) / 4.0f;
@@ -101,27 +117,153 @@ auto intersectSphere(SoATuple3f rayOrigins,
                 setPosition(data, k, sP);
                 setNormal(data, k, normalize(sP - sphereCenter));
                 materialIds[k] = materialId;
+                primitiveIds[k] = primitiveId;
             }
         }
     }
 }
+} // namespace
+
+auto intersectSphere(SoATuple3f rayOrigins,
+                     SoATuple3f rayDirs,
+                     float3 sphereCenter,
+                     float sphereRadius,
+                     std::size_t materialId,
+                     uint32_t primitiveId,
+                     IntersectionData &data,
+                     span<const std::size_t> activeRayIds) -> void {
+    intersectSphereScalar(rayOrigins,
+                          rayDirs,
+                          sphereCenter,
+                          sphereRadius,
+                          materialId,
+                          primitiveId,
+                          data,
+                          activeRayIds,
+                          RayDirections::Arbitrary);
+}
+
+auto intersectSphereWide(SoATuple3f rayOrigins,
+                         SoATuple3f rayDirs,
+                         float3 sphereCenter,
+                         float sphereRadius,
+                         std::size_t materialId,
+                         uint32_t primitiveId,
+                         IntersectionData &data,
+                         span<const std::size_t> activeRayIds,
+                         RayDirections directions) -> void {
+    std::size_t k = 0;
+#if CORNELIS_SIMD_WIDTH > 1
+    using simd::floatv;
+    using simd::Width;
 
-auto intersectPlane(SoATuple3f rayOrigins,
-                    SoATuple3f rayDirs,
-                    float3 planeNormal,
-                    float3 planePoint,
-                    float width,
-                    float height,
-                    std::size_t materialId,
-                    IntersectionData &data,
-                    std::vector<std::size_t> const &activeRayIds) -> void {
     auto [rx, ry, rz] = rayOrigins;
     auto [rdx, rdy, rdz] = rayDirs;
     auto intersected = data.get<tags::Intersected>();
     auto params = data.get<tags::RayParam0>();
     auto materialIds = data.get<tags::MaterialId>();
+    auto primitiveIds = data.get<tags::PrimitiveId>();
     auto [IPx, IPy, IPz] = getPositions(data);
     auto [INx, INy, INz] = getNormalSpans(data);
+
+    floatv const cx(sphereCenter(0)), cy(sphereCenter(1)), cz(sphereCenter(2));
+    floatv const r2(sphereRadius * sphereRadius);
+    floatv const zero(0.0f), inf(INFINITY), eps(RayEpsilon);
+
+    for (; k + Width <= activeRayIds.size(); k += Width) {
+        simd::RayBlock block(&activeRayIds[k]);
+        floatv const dx = block.load(rdx), dy = block.load(rdy), dz = block.load(rdz);
+        floatv const ox = block.load(rx), oy = block.load(ry), oz = block.load(rz);
+
+        // See intersectSphere for the derivation.
+        auto const wellBehaved =
+            (xsimd::abs(dx) >= eps) | (xsimd::abs(dy) >= eps) | (xsimd::abs(dz) >= eps);
+
+        floatv const Px = ox - cx, Py = oy - cy, Pz = oz - cz;
+        floatv const B = Px * dx + Py * dy + Pz * dz;
+        floatv const C = Px * Px + Py * Py + Pz * Pz;
+        floatv u, v;
+        if (directions == RayDirections::Normalized) {
+            u = 2.0f * B;
+            v = C - r2;
+        } else {
+            floatv const A = dx * dx + dy * dy + dz * dz;
+            u = 2.0f * B / A;
+            v = (C - r2) / A;
+        }
+
+        floatv const discriminant = -v + (u * u) / 4.0f;
+        auto const hit = wellBehaved & (discriminant >= zero);
+        floatv const shift = xsimd::sqrt(xsimd::max(discriminant, zero));
+        floatv t0 = -u / 2.0f - shift;
+        floatv t1 = -u / 2.0f + shift;
+        t0 = xsimd::select(t0 < zero, inf, t0);
+        t1 = xsimd::select(t1 < zero, inf, t1);
+        floatv const t = xsimd::select(t0 < t1, t0, t1);
+
+        auto const closer = hit & (block.load(params) > t);
+        if (xsimd::any(closer)) {
+            floatv const sPx = ox + dx * t, sPy = oy + dy * t, sPz = oz + dz * t;
+            floatv Nx = sPx - cx, Ny = sPy - cy, Nz = sPz - cz;
+            floatv const len = xsimd::sqrt(Nx * Nx + Ny * Ny + Nz * Nz);
+            floatv const s = xsimd::select(xsimd::abs(len) < eps, zero, 1.0f / len);
+
+            block.store(params, t, closer);
+            block.store(IPx, sPx, closer);
+            block.store(IPy, sPy, closer);
+            block.store(IPz, sPz, closer);
+            block.store(INx, Nx * s, closer);
+            block.store(INy, Ny * s, closer);
+            block.store(INz, Nz * s, closer);
+        }
+
+        // These are not floats, so they are done lane by lane.
+        auto const hitLanes = simd::lanes(hit);
+        auto const closerLanes = simd::lanes(closer);
+        for (std::size_t l = 0; l < Width; l++) {
+            auto const id = block.ids[l];
+            if (!hitLanes[l]) {
+                intersected[id] = false;
+            } else if (closerLanes[l]) {
+                intersected[id] = true;
+                materialIds[id] = materialId;
+                primitiveIds[id] = primitiveId;
+            }
+        }
+    }
+#endif
+    intersectSphereScalar(rayOrigins,
+                          rayDirs,
+                          sphereCenter,
+                          sphereRadius,
+                          materialId,
+                          primitiveId,
+                          data,
+                          activeRayIds.subspan(k),
+                          directions);
+}
+
+namespace {
+// intersectPlane for a plane whose tangent frame is already known. Also handles the rays left over
+// by intersectPlaneWide, so the two agree on every ray.
+auto intersectPlaneScalar(SoATuple3f rayOrigins,
+                          SoATuple3f rayDirs,
+                          float3 planeNormal,
+                          float3 planePoint,
+                          float3 planeTangent,
+                          float3 planeBitangent,
+                          float invHalfWidth,
+                          float invHalfHeight,
+                          std::size_t materialId,
+                          uint32_t primitiveId,
+                          IntersectionData &data,
+                          span<const std::size_t> activeRayIds) -> void {
+    auto [rx, ry, rz] = rayOrigins;
+    auto [rdx, rdy, rdz] = rayDirs;
+    auto intersected = data.get<tags::Intersected>();
+    auto params = data.get<tags::RayParam0>();
+    auto materialIds = data.get<tags::MaterialId>();
+    auto primitiveIds = data.get<tags::PrimitiveId>();
     // TODO: precondition that ensure sizes are the same!
 
     for (auto k : activeRayIds) {
@@ -162,9 +304,8 @@ auto intersectPlane(SoATuple3f rayOrigins,
                 continue;
             }
             float3 sP = rayT(rayOrigins, rayDirs, k, t);
-            Basis b = constructBasis(planeNormal);
-            if (abs(dot(sP - planePoint, b.T)) * 2.0f > width ||
-                abs(dot(sP - planePoint, b.B)) * 2.0f > height)
+            if (abs(dot(sP - planePoint, planeTangent)) * invHalfWidth > 1.0f ||
+                abs(dot(sP - planePoint, planeBitangent)) * invHalfHeight > 1.0f)
                 continue; // TODO: test this.*/
             if (params[k] > t) {
                 params[k] = t;
@@ -172,9 +313,204 @@ auto intersectPlane(SoATuple3f rayOrigins,
                 setPosition(data, k, sP);
                 setNormal(data, k, planeNormal);
                 materialIds[k] = materialId;
+                primitiveIds[k] = primitiveId;
+            }
+        }
+    }
+}
+} // namespace
+
+auto intersectPlane(SoATuple3f rayOrigins,
+                    SoATuple3f rayDirs,
+                    float3 planeNormal,
+                    float3 planePoint,
+                    float width,
+                    float height,
+                    std::size_t materialId,
+                    uint32_t primitiveId,
+                    IntersectionData &data,
+                    span<const std::size_t> activeRayIds) -> void {
+    Basis b = constructBasis(planeNormal);
+    intersectPlaneScalar(rayOrigins,
+                         rayDirs,
+                         planeNormal,
+                         planePoint,
+                         b.T,
+                         b.B,
+                         2.0f / width,
+                         2.0f / height,
+                         materialId,
+                         primitiveId,
+                         data,
+                         activeRayIds);
+}
+
+auto intersectPlaneWide(SoATuple3f rayOrigins,
+                        SoATuple3f rayDirs,
+                        float3 planeNormal,
+                        float3 planePoint,
+                        float3 planeTangent,
+                        float3 planeBitangent,
+                        float invHalfWidth,
+                        float invHalfHeight,
+                        std::size_t materialId,
+                        uint32_t primitiveId,
+                        IntersectionData &data,
+                        span<const std::size_t> activeRayIds) -> void {
+    std::size_t k = 0;
+#if CORNELIS_SIMD_WIDTH > 1
+    using simd::floatv;
+    using simd::Width;
+
+    auto [rx, ry, rz] = rayOrigins;
+    auto [rdx, rdy, rdz] = rayDirs;
+    auto intersected = data.get<tags::Intersected>();
+    auto params = data.get<tags::RayParam0>();
+    auto materialIds = data.get<tags::MaterialId>();
+    auto primitiveIds = data.get<tags::PrimitiveId>();
+    auto [IPx, IPy, IPz] = getPositions(data);
+    auto [INx, INy, INz] = getNormalSpans(data);
+
+    floatv const Nx(planeNormal(0)), Ny(planeNormal(1)), Nz(planeNormal(2));
+    floatv const Px(planePoint(0)), Py(planePoint(1)), Pz(planePoint(2));
+    floatv const Tx(planeTangent(0)), Ty(planeTangent(1)), Tz(planeTangent(2));
+    floatv const Bx(planeBitangent(0)), By(planeBitangent(1)), Bz(planeBitangent(2));
+    floatv const zero(0.0f), one(1.0f), eps(RayEpsilon);
+
+    for (; k + Width <= activeRayIds.size(); k += Width) {
+        simd::RayBlock block(&activeRayIds[k]);
+        floatv const dx = block.load(rdx), dy = block.load(rdy), dz = block.load(rdz);
+        floatv const ox = block.load(rx), oy = block.load(ry), oz = block.load(rz);
+
+        // See intersectPlaneScalar for the derivation.
+        auto const wellBehaved =
+            (xsimd::abs(dx) >= eps) | (xsimd::abs(dy) >= eps) | (xsimd::abs(dz) >= eps);
+
+        floatv const diffx = ox - Px, diffy = oy - Py, diffz = oz - Pz;
+        floatv const A = -(diffx * Nx + diffy * Ny + diffz * Nz);
+        floatv const B = dx * Nx + dy * Ny + dz * Nz;
+        auto const parallel = xsimd::abs(B) < eps;
+        auto const inPlane = (diffx == zero) & (diffy == zero) & (diffz == zero);
+        floatv const t = xsimd::select(parallel, zero, A / B);
+        auto const miss = ~wellBehaved | (parallel & ~inPlane) | (t < zero);
+
+        floatv const sPx = ox + dx * t, sPy = oy + dy * t, sPz = oz + dz * t;
+        floatv const Qx = sPx - Px, Qy = sPy - Py, Qz = sPz - Pz;
+        auto const inside =
+            (xsimd::abs(Qx * Tx + Qy * Ty + Qz * Tz) * invHalfWidth <= one) &
+            (xsimd::abs(Qx * Bx + Qy * By + Qz * Bz) * invHalfHeight <= one);
+
+        auto const closer = ~miss & inside & (block.load(params) > t);
+        if (xsimd::any(closer)) {
+            block.store(params, t, closer);
+            block.store(IPx, sPx, closer);
+            block.store(IPy, sPy, closer);
+            block.store(IPz, sPz, closer);
+            block.store(INx, Nx, closer);
+            block.store(INy, Ny, closer);
+            block.store(INz, Nz, closer);
+        }
+
+        auto const missLanes = simd::lanes(miss);
+        auto const closerLanes = simd::lanes(closer);
+        for (std::size_t l = 0; l < Width; l++) {
+            auto const id = block.ids[l];
+            if (missLanes[l]) {
+                intersected[id] = false;
+            } else if (closerLanes[l]) {
+                intersected[id] = true;
+                materialIds[id] = materialId;
+                primitiveIds[id] = primitiveId;
             }
         }
     }
+#endif
+    intersectPlaneScalar(rayOrigins,
+                         rayDirs,
+                         planeNormal,
+                         planePoint,
+                         planeTangent,
+                         planeBitangent,
+                         invHalfWidth,
+                         invHalfHeight,
+                         materialId,
+                         primitiveId,
+                         data,
+                         activeRayIds.subspan(k));
+}
+
+auto sampleSphere(float3 const &P, float3 const &center, float radius, float2 const &x)
+    -> ShapeSample {
+    float3 const toCenter = center - P;
+    float const distance2 = mag2(toCenter);
+    float const radius2 = radius * radius;
+    if (distance2 <= radius2)
+        return {};
+    float const distance = sqrtf(distance2);
+
+    // The cone of directions that hit the sphere, around the direction to its centre. One minus
+    // its cosine is written without the cancellation in 1 - cos for small and distant spheres.
+    float const sin2ThetaMax = radius2 / distance2;
+    float const cosThetaMax = sqrtf(std::max(0.0f, 1.0f - sin2ThetaMax));
+    float const oneMinusCosThetaMax = sin2ThetaMax / (1.0f + cosThetaMax);
+
+    float const oneMinusCosTheta = x(0) * oneMinusCosThetaMax;
+    float const cosTheta = 1.0f - oneMinusCosTheta;
+    float const sinTheta = sqrtf(std::max(0.0f, oneMinusCosTheta * (2.0f - oneMinusCosTheta)));
+    float const phi = 2.0f * Pi * x(1);
+
+    Basis const b = constructBasis(toCenter * (1.0f / distance));
+    ShapeSample s;
+    s.wi = normalize(sinTheta * std::cos(phi) * b.T + sinTheta * std::sin(phi) * b.B +
+                     cosTheta * b.N);
+    // The near intersection of the ray along wi, which the cone guarantees.
+    float const projected = distance * cosTheta;
+    s.distance = projected - sqrtf(std::max(0.0f, radius2 - distance2 * sinTheta * sinTheta));
+    s.pdf = 1.0f / (2.0f * Pi * oneMinusCosThetaMax);
+    return s;
 }
 
+auto sphereSamplePdf(float3 const &P, float3 const &center, float radius) -> float {
+    float const distance2 = mag2(center - P);
+    float const radius2 = radius * radius;
+    if (distance2 <= radius2)
+        return 0.0f;
+    // See sampleSphere.
+    float const sin2ThetaMax = radius2 / distance2;
+    float const cosThetaMax = sqrtf(std::max(0.0f, 1.0f - sin2ThetaMax));
+    return (1.0f + cosThetaMax) / (2.0f * Pi * sin2ThetaMax);
+}
+
+auto sampleRectangle(float3 const &P,
+                     float3 const &center,
+                     float3 const &normal,
+                     float3 const &tangent,
+                     float3 const &bitangent,
+                     float width,
+                     float height,
+                     float2 const &x) -> ShapeSample {
+    float3 const Q = center + ((x(0) - 0.5f) * width) * tangent +
+                     ((x(1) - 0.5f) * height) * bitangent;
+    float3 const toQ = Q - P;
+    float const distance2 = mag2(toQ);
+    float const distance = sqrtf(distance2);
+    if (isAlmostZero(distance))
+        return {};
+    ShapeSample s;
+    s.wi = toQ * (1.0f / distance);
+    s.pdf = rectangleSamplePdf(s.wi, distance, normal, width, height);
+    if (s.pdf == 0.0f)
+        return {};
+    s.distance = distance;
+    return s;
+}
+
+auto rectangleSamplePdf(
+    float3 const &wi, float distance, float3 const &normal, float width, float height) -> float {
+    // The density over the area, 1 / (width height), converted to solid angle.
+    float const cosLight = abs(dot(wi, normal));
+    if (isAlmostZero(cosLight))
+        return 0.0f;
+    return distance * distance / (cosLight * width * height);
+}
 } // namespace cornelis
@@ -0,0 +1,293 @@
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <utility>
+
+#include <cornelis/LightBVH.hpp>
+
+namespace cornelis {
+namespace {
+constexpr std::size_t NumBuckets = 12;
+// The largest float below one, which the rescaled sample floats are kept under.
+constexpr float OneMinusEpsilon = 0x1.fffffep-1f;
+
+auto safeSqrt(float x) -> float { return std::sqrt(std::max(0.0f, x)); }
+
+auto safeAcos(float x) -> float { return std::acos(std::clamp(x, -1.0f, 1.0f)); }
+
+// The cosine and sine of max(0, a - b), for angles a and b in [0, pi] given by their sines and
+// cosines.
+auto cosSubClamped(float sinA, float cosA, float sinB, float cosB) -> float {
+    if (cosA > cosB)
+        return 1.0f;
+    return cosA * cosB + sinA * sinB;
+}
+
+auto sinSubClamped(float sinA, float cosA, float sinB, float cosB) -> float {
+    if (cosA > cosB)
+        return 0.0f;
+    return sinA * cosB - cosA * sinB;
+}
+
+// v rotated by angle about the unit vector k, by Rodrigues' formula.
+auto rotate(float3 const &v, float3 const &k, float angle) -> float3 {
+    float const c = std::cos(angle), s = std::sin(angle);
+    return v * c + cross(k, v) * s + k * (dot(k, v) * (1.0f - c));
+}
+
+// The smallest cone around both the cone of half angle acos(cosA) around axisA, and that of
+// acos(cosB) around axisB. The axes are unit length.
+auto mergeCones(float3 const &axisA, float cosA, float3 const &axisB, float cosB)
+    -> std::pair<float3, float> {
+    float const thetaA = safeAcos(cosA), thetaB = safeAcos(cosB);
+    float const thetaD = safeAcos(dot(axisA, axisB));
+    if (std::min(thetaD + thetaB, Pi) <= thetaA)
+        return {axisA, cosA};
+    if (std::min(thetaD + thetaA, Pi) <= thetaB)
+        return {axisB, cosB};
+
+    // The merged cone spans from the far side of one to the far side of the other.
+    float const thetaO = (thetaA + thetaD + thetaB) / 2.0f;
+    float3 const k = cross(axisA, axisB);
+    if (thetaO >= Pi || mag2(k) == 0.0f)
+        return {axisA, -1.0f};
+    return {normalize(rotate(axisA, normalize(k), thetaO - thetaA)), std::cos(thetaO)};
+}
+
+// The cost of a cluster of lights in the surface area orientation heuristic: its power, times the
+// measure of the directions it emits in, times the area of its box.
+auto orientationCost(LightBounds const &b) -> float {
+    float const thetaO = safeAcos(b.cosThetaO), thetaE = safeAcos(b.cosThetaE);
+    float const thetaW = std::min(thetaO + thetaE, Pi);
+    float const sinThetaO = safeSqrt(1.0f - b.cosThetaO * b.cosThetaO);
+    float const measure =
+        2.0f * Pi * (1.0f - b.cosThetaO) +
+        Pi / 2.0f *
+            (2.0f * thetaW * sinThetaO - std::cos(thetaO - 2.0f * thetaW) -
+             2.0f * thetaO * sinThetaO + b.cosThetaO);
+    return b.power * measure * surfaceArea(b.bounds);
+}
+
+struct BuildLight {
+    LightBounds bounds;
+    float3 centroid;
+    uint32_t index;
+};
+
+struct Bucket {
+    LightBounds bounds;
+    std::size_t count = 0;
+};
+
+/**
+ * Top-down builder that splits each cluster where the surface area orientation heuristic is the
+ * lowest, evaluated at the borders of a fixed number of buckets along each axis of the centroids.
+ * The nodes are made in depth first order.
+ */
+struct Builder {
+    std::vector<LightBVHNode> &nodes;
+    std::vector<uint32_t> &leaves;
+
+    auto build(span<BuildLight> lights, uint32_t parent) -> uint32_t {
+        auto const node = static_cast<uint32_t>(nodes.size());
+        LightBounds bounds;
+        AABB centroidBounds;
+        for (auto const &light : lights) {
+            bounds = merge(bounds, light.bounds);
+            centroidBounds = merge(centroidBounds, light.centroid);
+        }
+        nodes.push_back({.bounds = bounds, .offset = 0, .parent = parent, .leaf = false});
+
+        if (lights.size() == 1) {
+            nodes[node].offset = lights[0].index;
+            nodes[node].leaf = true;
+            leaves[lights[0].index] = node;
+            return node;
+        }
+
+        auto const mid = split(lights, bounds, centroidBounds);
+        build(lights.subspan(0, mid), node);
+        auto const second = build(lights.subspan(mid), node);
+        nodes[node].offset = second;
+        return node;
+    }
+
+    // Partitions lights into the two children, and returns the number of lights in the first.
+    auto split(span<BuildLight> lights, LightBounds const &bounds, AABB const &centroidBounds)
+        -> std::size_t {
+        auto bucketOf = [&](BuildLight const &light, std::size_t axis) -> std::size_t {
+            float const min = centroidBounds.min(axis), max = centroidBounds.max(axis);
+            auto const b = static_cast<std::size_t>((light.centroid(axis) - min) / (max - min) *
+                                                    static_cast<float>(NumBuckets));
+            return std::min(b, NumBuckets - 1);
+        };
+
+        float3 const extent = bounds.bounds.max - bounds.bounds.min;
+        float const maxExtent = std::max({extent(0), extent(1), extent(2)});
+        float bestCost = INFINITY;
+        std::size_t bestAxis = 3, bestSplit = 0;
+        for (std::size_t axis = 0; axis < 3; axis++) {
+            if (!(centroidBounds.max(axis) > centroidBounds.min(axis)))
+                continue;
+            std::array<Bucket, NumBuckets> buckets;
+            for (auto const &light : lights) {
+                auto &bucket = buckets[bucketOf(light, axis)];
+                bucket.bounds = merge(bucket.bounds, light.bounds);
+                bucket.count++;
+            }
+
+            // Splits across the short sides of a long box cost more, so clusters stay compact.
+            float const stretch = extent(axis) > 0.0f ? maxExtent / extent(axis) : 1.0f;
+            // Sweep from the right to get the cost of everything to the right of a split, then
+            // from the left to find the cheapest split, as BinnedSAHBuilder does.
+            std::array<float, NumBuckets - 1> rightCost{};
+            Bucket right;
+            for (auto i = NumBuckets - 1; i > 0; i--) {
+                right.bounds = merge(right.bounds, buckets[i].bounds);
+                right.count += buckets[i].count;
+                rightCost[i - 1] = right.count > 0 ? orientationCost(right.bounds) : INFINITY;
+            }
+            Bucket left;
+            for (std::size_t i = 0; i < NumBuckets - 1; i++) {
+                left.bounds = merge(left.bounds, buckets[i].bounds);
+                left.count += buckets[i].count;
+                if (left.count == 0)
+                    continue;
+                float const cost = stretch * (orientationCost(left.bounds) + rightCost[i]);
+                if (cost < bestCost) {
+                    bestCost = cost;
+                    bestAxis = axis;
+                    bestSplit = i;
+                }
+            }
+        }
+
+        if (bestAxis == 3) {
+            // All centroids coincide, there's no meaningful split.
+            return lights.size() / 2;
+        }
+        auto it = std::partition(lights.begin(), lights.end(), [&](BuildLight const &light) {
+            return bucketOf(light, bestAxis) <= bestSplit;
+        });
+        return static_cast<std::size_t>(it - lights.begin());
+    }
+};
+} // namespace
+
+auto merge(LightBounds const &a, LightBounds const &b) -> LightBounds {
+    if (a.power <= 0.0f)
+        return b;
+    if (b.power <= 0.0f)
+        return a;
+    auto const [axis, cosThetaO] = mergeCones(a.axis, a.cosThetaO, b.axis, b.cosThetaO);
+    return {.bounds = merge(a.bounds, b.bounds),
+            .power = a.power + b.power,
+            .axis = axis,
+            .cosThetaO = cosThetaO,
+            .cosThetaE = std::min(a.cosThetaE, b.cosThetaE),
+            .twoSided = a.twoSided || b.twoSided};
+}
+
+auto importance(LightBounds const &light, float3 const &P, float3 const &N) -> float {
+    if (light.power <= 0.0f)
+        return 0.0f;
+    float3 const center = centroid(light.bounds);
+    float3 const toP = P - center;
+    float const distance2 = mag2(toP);
+    // Close to the lights the distance to the centre says little, so it's taken to be at least
+    // the radius of the sphere around the box.
+    float const radius2 = mag2(light.bounds.max - light.bounds.min) * 0.25f;
+    float3 const wi = distance2 > 0.0f ? toP * (1.0f / std::sqrt(distance2)) : light.axis;
+
+    // The angle between the axis and the direction towards P.
+    float cosThetaW = dot(light.axis, wi);
+    if (light.twoSided)
+        cosThetaW = std::abs(cosThetaW);
+    float const sinThetaW = safeSqrt(1.0f - cosThetaW * cosThetaW);
+    // The cone of directions from P that hit the sphere around the box, all of them from within.
+    float const cosThetaB = distance2 > radius2 ? safeSqrt(1.0f - radius2 / distance2) : -1.0f;
+    float const sinThetaB = safeSqrt(1.0f - cosThetaB * cosThetaB);
+    float const sinThetaO = safeSqrt(1.0f - light.cosThetaO * light.cosThetaO);
+
+    // The smallest angle there can be between a normal of the lights and a direction from them to
+    // P: the lights can't reach P if it's beyond the emission angle.
+    float const cosThetaX = cosSubClamped(sinThetaW, cosThetaW, sinThetaO, light.cosThetaO);
+    float const sinThetaX = sinSubClamped(sinThetaW, cosThetaW, sinThetaO, light.cosThetaO);
+    float const cosThetaP = cosSubClamped(sinThetaX, cosThetaX, sinThetaB, cosThetaB);
+    if (cosThetaP <= light.cosThetaE)
+        return 0.0f;
+
+    float result = light.power * cosThetaP / std::max(distance2, radius2);
+    if (N != float3{0.0f}) {
+        // Likewise the smallest angle between N, or -N, and a direction towards the lights.
+        float const cosThetaI = std::abs(dot(wi, N));
+        float const sinThetaI = safeSqrt(1.0f - cosThetaI * cosThetaI);
+        result *= cosSubClamped(sinThetaI, cosThetaI, sinThetaB, cosThetaB);
+    }
+    return std::max(result, 0.0f);
+}
+
+LightBVH::LightBVH(span<const LightBounds> lights) {
+    if (lights.empty())
+        return;
+    std::vector<BuildLight> build;
+    build.reserve(lights.size());
+    for (std::size_t i = 0; i != lights.size(); i++)
+        build.push_back({lights[i], centroid(lights[i].bounds), static_cast<uint32_t>(i)});
+
+    nodes.reserve(2 * lights.size() - 1);
+    leaves.resize(lights.size());
+    Builder{nodes, leaves}.build(build, 0);
+}
+
+auto LightBVH::sample(float3 const &P, float3 const &N, float u) const -> LightChoice {
+    if (nodes.empty())
+        return {};
+    if (nodes[0].leaf) {
+        if (!(importance(nodes[0].bounds, P, N) > 0.0f))
+            return {};
+        return {nodes[0].offset, 1.0f};
+    }
+
+    uint32_t node = 0;
+    float probability = 1.0f;
+    while (!nodes[node].leaf) {
+        float const a = importance(nodes[node + 1].bounds, P, N);
+        float const b = importance(nodes[nodes[node].offset].bounds, P, N);
+        if (!(a + b > 0.0f))
+            return {};
+        // u is rescaled to [0, 1) within the part of it that picked the child, and used again.
+        float const p = a / (a + b);
+        if (u < p) {
+            node = node + 1;
+            probability *= p;
+            u = std::min(u / p, OneMinusEpsilon);
+        } else {
+            node = nodes[node].offset;
+            probability *= 1.0f - p;
+            u = std::min((u - p) / (1.0f - p), OneMinusEpsilon);
+        }
+    }
+    return {nodes[node].offset, probability};
+}
+
+auto LightBVH::probability(float3 const &P, float3 const &N, uint32_t light) const -> float {
+    uint32_t node = leaves[light];
+    if (node == 0)
+        return importance(nodes[0].bounds, P, N) > 0.0f ? 1.0f : 0.0f;
+
+    // The choices sample makes on the way down, from the bottom up.
+    float probability = 1.0f;
+    while (node != 0) {
+        uint32_t const parent = nodes[node].parent;
+        float const a = importance(nodes[parent + 1].bounds, P, N);
+        float const b = importance(nodes[nodes[parent].offset].bounds, P, N);
+        if (!(a + b > 0.0f))
+            return 0.0f;
+        float const p = a / (a + b);
+        probability *= node == parent + 1 ? p : 1.0f - p;
+        node = parent;
+    }
+    return probability;
+}
+} // namespace cornelis
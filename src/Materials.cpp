@@ -1,4 +1,7 @@
 #include <cornelis/Materials.hpp>
+
+#include "Simd.hpp"
+
 namespace cornelis {
 namespace models {
 auto distributionGTR3p2(float cos_theta_H, float alpha) -> float {
@@ -20,8 +23,9 @@ auto distributionGTR2(float cos_theta_H, float alpha) -> float {
         return 1.0f;
     // These are arbitrarly named terms. They serve just to partition the expression.
     float A = alpha2 / (2.0f * Pi);
-    float B = 1.0f / std::pow(1.0f + (alpha2 - 1.0f) * cos_theta_H2, 2.0f);
-    
+    float t = 1.0f + (alpha2 - 1.0f) * cos_theta_H2;
+    float B = 1.0f / (t * t);
+
     return A * B;
 }
 
@@ -38,7 +42,235 @@ auto shadowMaskingTR(float tan_theta_i, float tan_theta_o, float alpha) -> float
 auto schlick(float cos_theta, float refidx1, float refidx2) -> float {
     float R0 = (refidx1 - refidx2) / (refidx1 + refidx2);
     R0 *= R0;
-    return R0 + (1.0f - R0) * std::pow(1.0f - cos_theta, 5.0f);
+    float m = 1.0f - cos_theta;
+    float m2 = m * m;
+    return R0 + (1.0f - R0) * (m2 * m2 * m);
 }
 } // namespace models
-} // namespace cornelis
\ No newline at end of file
+
+#if CORNELIS_SIMD_WIDTH > 1
+namespace {
+using simd::boolv;
+using simd::floatv;
+
+// The float3 operations used by sampleWide, on Width vectors at a time.
+struct float3v {
+    floatv x, y, z;
+};
+
+auto operator+(float3v const &a, float3v const &b) -> float3v {
+    return {a.x + b.x, a.y + b.y, a.z + b.z};
+}
+
+auto operator-(float3v const &a, float3v const &b) -> float3v {
+    return {a.x - b.x, a.y - b.y, a.z - b.z};
+}
+
+auto operator*(float3v const &a, floatv const &s) -> float3v { return {a.x * s, a.y * s, a.z * s}; }
+
+auto dot(float3v const &a, float3v const &b) -> floatv { return a.x * b.x + a.y * b.y + a.z * b.z; }
+
+auto cross(float3v const &a, float3v const &b) -> float3v {
+    return {a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x};
+}
+
+// Like normalize, vectors of almost zero length become zero.
+auto normalize(float3v const &v) -> float3v {
+    floatv const len = xsimd::sqrt(dot(v, v));
+    return v * xsimd::select(xsimd::abs(len) < floatv(RayEpsilon), floatv(0.0f), 1.0f / len);
+}
+
+auto select(boolv const &mask, float3v const &a, float3v const &b) -> float3v {
+    return {xsimd::select(mask, a.x, b.x),
+            xsimd::select(mask, a.y, b.y),
+            xsimd::select(mask, a.z, b.z)};
+}
+
+auto isAlmostZero(floatv const &v) -> boolv { return xsimd::abs(v) < floatv(RayEpsilon); }
+
+// std::max(0.0f, v), which also turns NaNs into zero.
+auto clampPositive(floatv const &v) -> floatv {
+    floatv const zero(0.0f);
+    return xsimd::select(v > zero, v, zero);
+}
+
+struct Basisv {
+    float3v N, T, B;
+};
+
+// See constructBasis.
+auto constructBasis(float3v const &N) -> Basisv {
+    auto const nearY = xsimd::abs(N.y) > floatv(0.95f);
+    float3v const helper{floatv(0.0f),
+                         xsimd::select(nearY, floatv(0.0f), floatv(1.0f)),
+                         xsimd::select(nearY, floatv(1.0f), floatv(0.0f))};
+    auto const T = normalize(cross(helper, N));
+    return {N, T, cross(T, N)};
+}
+
+// See models::distributionGTR2.
+auto distributionGTR2(floatv const &cos_theta_H, float alpha) -> floatv {
+    float const alpha2 = alpha * alpha;
+    if (cornelis::isAlmostZero(alpha2))
+        return floatv(1.0f);
+    floatv const t = 1.0f + (alpha2 - 1.0f) * cos_theta_H * cos_theta_H;
+    return alpha2 / (2.0f * Pi) * (1.0f / (t * t));
+}
+
+// See models::lambdaTR. Infinite tangents are left out, the lanes where they can happen are black
+// anyway.
+auto lambdaTR(floatv const &tan_theta, float alpha) -> floatv {
+    floatv const a = xsimd::abs(tan_theta) * alpha;
+    return (-1.0f + xsimd::sqrt(1.0f + a * a)) * 0.5f;
+}
+
+// See models::schlick.
+auto schlick(floatv const &cos_theta, float refidx1, float refidx2) -> floatv {
+    float R0 = (refidx1 - refidx2) / (refidx1 + refidx2);
+    R0 *= R0;
+    floatv const m = 1.0f - cos_theta;
+    floatv const m2 = m * m;
+    return R0 + (1.0f - R0) * (m2 * m2 * m);
+}
+
+// See OrenNayarBRDF::operator(), without the albedo.
+auto orenNayar(OrenNayarBRDF const &brdf, float3v const &wi, float3v const &wo) -> floatv {
+    floatv const sinThetaI = xsimd::sqrt(1.0f - wi.z * wi.z);
+    floatv const sinThetaO = xsimd::sqrt(1.0f - wo.z * wo.z);
+    floatv const cosPhiI = wi.x / sinThetaI;
+    floatv const cosPhiO = wo.x / sinThetaO;
+    floatv const cosPhiDiff = cosPhiI * cosPhiO + xsimd::sqrt(1.0f - cosPhiI * cosPhiI) *
+                                                      xsimd::sqrt(1.0f - cosPhiO * cosPhiO);
+    return (brdf.termA() + brdf.termB() * clampPositive(cosPhiDiff) * sinThetaI * sinThetaO) / Pi;
+}
+
+// Sine and cosine of x, with the functions the BRDF's accuracy asks for.
+auto sinCos(floatv const &x, MathAccuracy accuracy) -> std::pair<floatv, floatv> {
+    if (accuracy == MathAccuracy::Fast)
+        return fastmath::sincos(x);
+    return {xsimd::sin(x), xsimd::cos(x)};
+}
+
+// Returns f * cosTheta / pdf for the direction LayeredBRDF::sample picks, and sets wi and pdf to
+// it and its pdf.
+auto sampleLayered(LayeredBRDF const &brdf,
+                   float3v const &wo,
+                   float3v const &x,
+                   Basisv const &b,
+                   float3v &wi,
+                   floatv &pdf) -> std::array<floatv, 3> {
+    auto const &glossy = brdf.glossy();
+    auto const &diffuse = brdf.diffuse();
+    floatv const zero(0.0f);
+
+    // The diffuse lobe samples the hemisphere uniformly, see randomHemisphere.
+    floatv const a = 2.0f * Pi * x.y;
+    floatv const r = xsimd::sqrt(1.0f - x.x * x.x);
+    auto const [sin_a, cos_a] = sinCos(a, brdf.accuracy());
+    float3v const wiDiffuse = b.B * (cos_a * r) + b.T * (sin_a * r) + b.N * x.x;
+
+    // See GlossyBRDF::sampleHalfVector.
+    float const alpha2 = glossy.alpha() * glossy.alpha();
+    floatv const cos_theta_H = xsimd::sqrt((1.0f - x.y) / (1.0f + (alpha2 - 1.0f) * x.y));
+    floatv const sin_theta_H = xsimd::sqrt(1.0f - cos_theta_H * cos_theta_H);
+    floatv const phih = 2.0f * Pi * x.x;
+    auto const [sin_phih, cos_phih] = sinCos(phih, brdf.accuracy());
+    float3v const h = normalize(b.B * (sin_theta_H * cos_phih) + b.T * (sin_theta_H * sin_phih) +
+                                b.N * cos_theta_H);
+    float3v const wiGlossy = normalize(h * (2.0f * dot(wo, h)) - wo);
+
+    auto const glossyLobe = x.z >= floatv(0.5f);
+    auto const degenerate = glossyLobe & (dot(h, b.N) < zero);
+    wi = select(degenerate, b.N, select(glossyLobe, wiGlossy, wiDiffuse));
+
+    // See GlossyBRDF::evaluate.
+    floatv const cos_wi = dot(wi, b.N);
+    floatv const cos_thetaI = clampPositive(cos_wi);
+    floatv const cos_thetaO = clampPositive(dot(wo, b.N));
+    float3v const hv = normalize(wi + wo);
+    floatv const cos_hv = clampPositive(dot(hv, b.N));
+    floatv const D = distributionGTR2(cos_hv, glossy.alpha());
+
+    floatv const pdfh = D * xsimd::abs(cos_hv);
+    floatv const wi_dot_h = dot(wi, hv);
+    floatv const glossyPdf = xsimd::select(
+        isAlmostZero(cos_hv),
+        floatv(1.0f),
+        xsimd::select(isAlmostZero(wi_dot_h), pdfh, pdfh / (4.0f * wi_dot_h)));
+
+    floatv const sin_thetaO = xsimd::sqrt(1.0f - cos_thetaO * cos_thetaO);
+    floatv const sin_thetaI = xsimd::sqrt(1.0f - cos_thetaI * cos_thetaI);
+    floatv const G = 1.0f / (1.0f + lambdaTR(sin_thetaI / cos_thetaI, glossy.alpha()) +
+                             lambdaTR(sin_thetaO / cos_thetaO, glossy.alpha()));
+    floatv const F = schlick(cos_hv, 1.0f, glossy.ior());
+    auto const black = isAlmostZero(cos_thetaO) | isAlmostZero(cos_thetaI) |
+                       (isAlmostZero(hv.x) & isAlmostZero(hv.y) & isAlmostZero(hv.z));
+    floatv const specular =
+        xsimd::select(black, zero, F * D * G / (4.0f * cos_thetaO * cos_thetaI));
+
+    // See LayeredBRDF::sample.
+    floatv const layer =
+        (1.0f - schlick(cos_thetaI, 1.0f, glossy.ior())) * orenNayar(diffuse, wi, wo);
+    pdf = 0.5f * (randomHemispherePDF() + glossyPdf);
+    floatv const scale = xsimd::abs(cos_wi) / pdf;
+
+    auto const albedo = diffuse.albedo();
+    auto const tint = glossy.tint();
+    std::array<floatv, 3> weight;
+    for (std::size_t c = 0; c < 3; c++)
+        weight[c] =
+            xsimd::select(degenerate, zero, (albedo(c) * layer + tint(c) * specular) * scale);
+    return weight;
+}
+} // namespace
+#endif
+
+auto sampleWide(LayeredBRDF const &brdf,
+                SoATuple3f rayDirs,
+                SoATuple3f normals,
+                SoATuple3f x,
+                span<const std::size_t> ids,
+                SoATuple3f wi,
+                SoATuple3f weight,
+                span<float> pdf) -> void {
+    auto [dx, dy, dz] = rayDirs;
+    auto [Nx, Ny, Nz] = normals;
+    auto [x0, x1, x2] = x;
+    auto [wix, wiy, wiz] = wi;
+    auto [wr, wg, wb] = weight;
+
+#if CORNELIS_SIMD_WIDTH > 1
+    simd::forEachBlock(ids, [&](simd::RayBlock const &block, boolv const &mask) {
+        float3v const wo{-block.load(dx), -block.load(dy), -block.load(dz)};
+        Basisv const basis =
+            constructBasis(float3v{block.load(Nx), block.load(Ny), block.load(Nz)});
+        float3v const samples{block.load(x0), block.load(x1), block.load(x2)};
+
+        float3v sampled;
+        floatv density;
+        auto const w = sampleLayered(brdf, wo, samples, basis, sampled, density);
+        block.store(wix, sampled.x, mask);
+        block.store(wiy, sampled.y, mask);
+        block.store(wiz, sampled.z, mask);
+        block.store(wr, w[0], mask);
+        block.store(wg, w[1], mask);
+        block.store(wb, w[2], mask);
+        block.store(pdf, density, mask);
+    });
+#else
+    for (auto id : ids) {
+        auto const s = brdf.sample(float3{-dx[id], -dy[id], -dz[id]},
+                                   float3{x0[id], x1[id], x2[id]},
+                                   constructBasis(float3{Nx[id], Ny[id], Nz[id]}));
+        wix[id] = s.wi(0);
+        wiy[id] = s.wi(1);
+        wiz[id] = s.wi(2);
+        RGB const w = s.f * (s.cosTheta / s.pdf);
+        wr[id] = w(0);
+        wg[id] = w(1);
+        wb[id] = w(2);
+        pdf[id] = s.pdf;
+    }
+#endif
+}
+} // namespace cornelis
@@ -0,0 +1,73 @@
+#include <array>
+#include <bit>
+#include <vector>
+
+#include <tbb/parallel_for.h>
+
+#include <cornelis/Sampling.hpp>
+
+namespace cornelis {
+namespace {
+constexpr uint32_t TableBits = std::countr_zero(PMJ02TableSize);
+static_assert(PMJ02TableSize == 1u << TableBits);
+
+// The first two dimensions of the Sobol sequence, without any scrambling: the van der Corput
+// sequence, and the sequence with the Pascal matrix for generator.
+auto sobol2D(uint32_t index) -> std::array<uint32_t, 2> {
+    uint32_t x = 0, y = 0;
+    for (uint32_t b = 0, v = 1u << 31; index != 0; b++, v ^= v >> 1, index >>= 1) {
+        if (index & 1) {
+            x ^= 1u << (31 - b);
+            y ^= v;
+        }
+    }
+    return {x, y};
+}
+
+// Fills table with a progressive multi-jittered (0, 2) sequence. Christensen et al. build theirs
+// by placing the points one by one, each in a stratum that is still free. Helmer et al., in
+// "Stochastic Generation of (t, s) Sample Sequences" (2021), get the same stratification from the
+// Sobol points, with each coordinate Owen scrambled by random flips, and then jittered within its
+// finest stratum. That is what this does. Unlike the points of the greedy construction, these can
+// be reordered by a nested uniform scrambling of the index and stay stratified, which is what
+// keeps the tables of different dimensions apart, see pmj02Sample.
+auto generateTable(span<std::array<uint32_t, 2>> table, PRNG prng) -> void {
+    // One flip per node of the binary tree of strata, for both coordinates. Node (1 << l) | prefix
+    // decides whether bit l from the top is flipped, for the points whose top l bits are prefix.
+    std::array<std::vector<unsigned char>, 2> flips;
+    for (auto &f : flips) {
+        f.resize(PMJ02TableSize);
+        for (auto &flip : f)
+            flip = prng.xoroshiro() & 1;
+    }
+
+    for (uint32_t i = 0; i != PMJ02TableSize; i++) {
+        auto const point = sobol2D(i);
+        for (int c = 0; c != 2; c++) {
+            uint32_t scrambled = 0;
+            for (uint32_t l = 0; l != TableBits; l++) {
+                uint32_t const prefix = l == 0 ? 0 : point[c] >> (32 - l);
+                uint32_t const bit = (point[c] >> (31 - l)) & 1;
+                scrambled |= (bit ^ flips[c][(1u << l) | prefix]) << (31 - l);
+            }
+            table[i][c] = scrambled | (prng.xoroshiro() >> TableBits);
+        }
+    }
+}
+
+auto generateTables() -> std::vector<std::array<uint32_t, 2>> {
+    std::vector<std::array<uint32_t, 2>> points(PMJ02TableCount * PMJ02TableSize);
+    tbb::parallel_for(uint32_t(0), PMJ02TableCount, [&](uint32_t t) {
+        generateTable(span<std::array<uint32_t, 2>>(&points[t * PMJ02TableSize], PMJ02TableSize),
+                      PRNG(PRNG::DefaultSeed + t));
+    });
+    return points;
+}
+} // namespace
+
+auto pmj02Point(uint32_t table, uint32_t index) -> std::array<uint32_t, 2> {
+    // Made on first use, which is thread safe for statics.
+    static auto const points = generateTables();
+    return points[table * PMJ02TableSize + index];
+}
+} // namespace cornelis
@@ -0,0 +1,29 @@
+#include <cornelis/PRNG.hpp>
+
+#include "Simd.hpp"
+
+namespace cornelis {
+auto sampleRandomWide(uint32_t seed,
+                      span<const uint32_t> pixels,
+                      span<const uint32_t> samples,
+                      span<const uint32_t> dimensions,
+                      span<const std::size_t> ids,
+                      span<float> out) -> void {
+    std::size_t i = 0;
+#if CORNELIS_SIMD_WIDTH > 1
+    using simd::intv;
+    using simd::Width;
+    simd::boolv const all(true);
+    for (; i + Width <= ids.size(); i += Width) {
+        simd::RayBlock block(&ids[i]);
+        // See sampleRandom.
+        intv h = simd::hash32(intv(static_cast<int32_t>(seed)) + block.load(pixels));
+        h = simd::hash32(h + block.load(samples));
+        h = simd::hash32(h + block.load(dimensions));
+        block.store(out, xsimd::to_float(simd::shiftRight(h, 8)) * 0x1.0p-24f, all);
+    }
+#endif
+    for (auto k : ids.subspan(i))
+        out[k] = sampleRandom(seed, pixels[k], samples[k], dimensions[k]);
+}
+} // namespace cornelis
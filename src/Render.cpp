@@ -1,6 +1,11 @@
 #include <algorithm>
+#include <array>
 #include <atomic>
+#include <chrono>
+#include <cmath>
+#include <filesystem>
 #include <fmt/core.h>
+#include <limits>
 #include <numeric>
 #include <vector>
 
@@ -13,11 +18,13 @@
 
 #include "extern/stb_image_write.h"
 
+#include <cornelis/Adaptive.hpp>
 #include <cornelis/Color.hpp>
 #include <cornelis/FrameBuffer.hpp>
 #include <cornelis/Materials.hpp>
 #include <cornelis/PRNG.hpp>
 #include <cornelis/Render.hpp>
+#include <cornelis/Sampling.hpp>
 #include <cornelis/Scene.hpp>
 #include <cornelis/Tiles.hpp>
 
@@ -25,6 +32,8 @@
 
 #include <cornelis/Geometry.hpp>
 
+#include "Simd.hpp"
+
 namespace cornelis {
 struct NormalizedFrameBufferCoord {
     NormalizedFrameBufferCoord(PixelCoord pixel, PixelCoord fbSize)
@@ -36,12 +45,221 @@ struct NormalizedFrameBufferCoord {
     float dx, dy, x, y;
 };
 
-struct PathThroughputTag {
-    using element_type = RGB;
+/**
+ * How much of the light arriving along a path reaches the camera, one field per channel.
+ */
+struct ThroughputRTag {
+    using element_type = float;
+};
+struct ThroughputGTag {
+    using element_type = float;
+};
+struct ThroughputBTag {
+    using element_type = float;
+};
+
+/**
+ * The light gathered along a path so far, one field per channel.
+ */
+struct LightInRTag {
+    using element_type = float;
+};
+struct LightInGTag {
+    using element_type = float;
+};
+struct LightInBTag {
+    using element_type = float;
 };
 
-struct LightInTag {
-    using element_type = RGB;
+/**
+ * Number of bounces a path has taken. Zero for camera rays.
+ */
+struct PathDepthTag {
+    using element_type = int32_t;
+};
+
+/**
+ * Index of the pixel a path belongs to, relative to its tile. Only used by the wavefront
+ * integrator, where a batch holds the paths of many pixels. Slots without a path, and paths whose
+ * light has been added to their pixel already, have NoPixel.
+ */
+struct PixelIndexTag {
+    using element_type = uint32_t;
+};
+constexpr uint32_t NoPixel = std::numeric_limits<uint32_t>::max();
+
+/**
+ * The key of the random numbers of a path, see Sampler: the index of its pixel in the frame and the
+ * index of its sample among the samples of the pixel.
+ */
+struct FramePixelTag {
+    using element_type = uint32_t;
+};
+struct SampleIndexTag {
+    using element_type = uint32_t;
+};
+
+/**
+ * The pdf with which the BRDF sampled the direction of a bounced ray, with respect to solid angle.
+ * Meaningless for camera rays, as are the normals of RayBatch, which are those of the hits the
+ * bounced rays left from.
+ */
+struct BouncePdfTag {
+    using element_type = float;
+};
+
+/**
+ * The probability that a path survived russian roulette at this bounce, and the BRDF weight of its
+ * next ray, one field per channel.
+ */
+struct RouletteTag {
+    using element_type = float;
+};
+struct BounceWeightRTag {
+    using element_type = float;
+};
+struct BounceWeightGTag {
+    using element_type = float;
+};
+struct BounceWeightBTag {
+    using element_type = float;
+};
+
+/**
+ * Whether a path goes on after this bounce.
+ */
+struct SurvivedTag {
+    using element_type = unsigned char;
+};
+
+/**
+ * The weight of the light emitted at the hit of a path, see emissionWeights.
+ */
+struct EmissionWeightTag {
+    using element_type = float;
+};
+
+/**
+ * Random numbers drawn for the paths by a step of the bounce, and the dimensions they were drawn
+ * from, see RayBatch::random.
+ */
+struct Random0Tag {
+    using element_type = float;
+};
+struct Random1Tag {
+    using element_type = float;
+};
+struct Random2Tag {
+    using element_type = float;
+};
+struct Random3Tag {
+    using element_type = float;
+};
+struct DimensionTag {
+    using element_type = uint32_t;
+};
+
+/**
+ * The light a shadow ray brings to its path if nothing is in the way, one field per channel, and
+ * how far the ray may go before it counts as blocked. See sampleDirectLight.
+ */
+struct DirectLightRTag {
+    using element_type = float;
+};
+struct DirectLightGTag {
+    using element_type = float;
+};
+struct DirectLightBTag {
+    using element_type = float;
+};
+struct ShadowReachTag {
+    using element_type = float;
+};
+
+/**
+ * Space for the steps of a bounce to keep what they work out for each path, so that they don't
+ * allocate and clear buffers the size of the batch on every bounce. A field only holds anything for
+ * the paths the step that uses it wrote it for, and only until the next bounce. It is not moved
+ * with the paths, see movePaths.
+ */
+struct BounceScratch : public SoAObject<RouletteTag,
+                                        BounceWeightRTag,
+                                        BounceWeightGTag,
+                                        BounceWeightBTag,
+                                        SurvivedTag,
+                                        EmissionWeightTag,
+                                        Random0Tag,
+                                        Random1Tag,
+                                        Random2Tag,
+                                        Random3Tag,
+                                        DimensionTag,
+                                        tags::PositionX,
+                                        tags::PositionY,
+                                        tags::PositionZ,
+                                        tags::DirectionX,
+                                        tags::DirectionY,
+                                        tags::DirectionZ,
+                                        DirectLightRTag,
+                                        DirectLightGTag,
+                                        DirectLightBTag,
+                                        ShadowReachTag> {
+    BounceScratch(std::size_t n) : SoAObject(n), shadows(n) {}
+
+    auto bounceWeightSpans() -> SoATuple3f {
+        return {get<BounceWeightRTag>(), get<BounceWeightGTag>(), get<BounceWeightBTag>()};
+    }
+
+    auto directLightSpans() -> SoATuple3f {
+        return {get<DirectLightRTag>(), get<DirectLightGTag>(), get<DirectLightBTag>()};
+    }
+
+    /**
+     * The hits of the shadow rays, whose rays are the positions and directions.
+     */
+    IntersectionData shadows;
+
+    /**
+     * The camera rays and the bounced rays among the active paths, see intersect.
+     */
+    std::vector<std::size_t> cameraRays, bouncedRays;
+
+    /**
+     * The paths still active after a step, which becomes the active list.
+     */
+    std::vector<std::size_t> stillActive;
+
+    /**
+     * The active paths bucketed by material, and where the bucket of each material starts, see
+     * accumulateAndBounce.
+     */
+    std::vector<std::size_t> queues, queueStart, queueNext;
+
+    /**
+     * The paths of a material queue that survive russian roulette, see shadeStandardQueue.
+     */
+    std::vector<std::size_t> survivors;
+
+    /**
+     * The hits on surfaces that scatter, and the ones of them that cast a shadow ray, see
+     * sampleDirectLight.
+     */
+    std::vector<std::size_t> scattering, shadowRays;
+
+    /**
+     * Which paths are active, the order to move them in, and the sort keys that order comes from,
+     * see movePaths and sortPaths.
+     */
+    std::vector<unsigned char> active;
+    std::vector<std::size_t> order;
+    std::vector<std::pair<uint64_t, std::size_t>> keyed;
+
+    /**
+     * Where movePaths puts the fields of the moved paths before copying them back, one for each
+     * element type.
+     */
+    std::vector<float> movedFloats;
+    std::vector<int32_t> movedInts;
+    std::vector<uint32_t> movedUints;
 };
 
 struct RayBatch : public SoAObject<tags::PositionX,
@@ -50,22 +268,109 @@ struct RayBatch : public SoAObject<tags::PositionX,
                                    tags::DirectionX,
                                    tags::DirectionY,
                                    tags::DirectionZ,
-                                   PathThroughputTag,
-                                   LightInTag> {
-    RayBatch(std::size_t n) : SoAObject(n), activeList(n) {
+                                   ThroughputRTag,
+                                   ThroughputGTag,
+                                   ThroughputBTag,
+                                   LightInRTag,
+                                   LightInGTag,
+                                   LightInBTag,
+                                   PathDepthTag,
+                                   PixelIndexTag,
+                                   FramePixelTag,
+                                   SampleIndexTag,
+                                   BouncePdfTag,
+                                   tags::NormalX,
+                                   tags::NormalY,
+                                   tags::NormalZ> {
+    RayBatch(std::size_t n, Sampler samplerIn)
+        : SoAObject(n), activeList(n), sampler(samplerIn), scratch(n) {
         std::iota(std::begin(activeList), std::end(activeList), 0);
-        auto throughput = get<PathThroughputTag>();
-        std::fill(std::begin(throughput), std::end(throughput), RGB(1.0f, 1.0f, 1.0f));
-        auto L_i = get<LightInTag>();
-        std::fill(std::begin(L_i), std::end(L_i), RGB::black());
+        auto [Tr, Tg, Tb] = throughputSpans();
+        for (auto channel : {Tr, Tg, Tb})
+            std::fill(std::begin(channel), std::end(channel), 1.0f);
+        auto [r, g, b] = lightInSpans();
+        for (auto channel : {r, g, b})
+            std::fill(std::begin(channel), std::end(channel), 0.0f);
+        auto depth = get<PathDepthTag>();
+        std::fill(std::begin(depth), std::end(depth), 0);
+    }
+
+    auto throughputSpans() -> SoATuple3f {
+        return {get<ThroughputRTag>(), get<ThroughputGTag>(), get<ThroughputBTag>()};
     }
 
-    auto throughput(std::size_t k) -> RGB { return get<PathThroughputTag>()[k]; }
+    auto lightInSpans() -> SoATuple3f {
+        return {get<LightInRTag>(), get<LightInGTag>(), get<LightInBTag>()};
+    }
 
-    auto scaleThroughput(std::size_t k, RGB const &p) -> void { get<PathThroughputTag>()[k] *= p; }
+    auto throughput(std::size_t k) -> RGB {
+        auto [r, g, b] = throughputSpans();
+        return {r[k], g[k], b[k]};
+    }
+
+    auto scaleThroughput(std::size_t k, RGB const &p) -> void {
+        auto [r, g, b] = throughputSpans();
+        r[k] *= p(0);
+        g[k] *= p(1);
+        b[k] *= p(2);
+    }
 
     auto accumulateLight(std::size_t k, RGB light) -> void {
-        get<LightInTag>()[k] += throughput(k) * light;
+        auto [r, g, b] = lightInSpans();
+        auto const T = throughput(k);
+        r[k] += T(0) * light(0);
+        g[k] += T(1) * light(1);
+        b[k] += T(2) * light(2);
+    }
+
+    auto lightIn(std::size_t k) -> RGB {
+        auto [r, g, b] = lightInSpans();
+        return {r[k], g[k], b[k]};
+    }
+
+    /**
+     * Starts path k over, with full throughput and no light.
+     */
+    auto resetPath(std::size_t k) -> void {
+        auto [Tr, Tg, Tb] = throughputSpans();
+        Tr[k] = Tg[k] = Tb[k] = 1.0f;
+        auto [r, g, b] = lightInSpans();
+        r[k] = g[k] = b[k] = 0.0f;
+        get<PathDepthTag>()[k] = 0;
+    }
+
+    /**
+     * Returns the light gathered by path k, and clears it.
+     */
+    auto takeLight(std::size_t k) -> RGB {
+        auto light = lightIn(k);
+        auto [r, g, b] = lightInSpans();
+        r[k] = g[k] = b[k] = 0.0f;
+        return light;
+    }
+
+    /**
+     * Makes path k trace the given sample of the given pixel.
+     */
+    auto startSample(std::size_t k, uint32_t pixel, uint32_t sample) -> void {
+        get<FramePixelTag>()[k] = pixel;
+        get<SampleIndexTag>()[k] = sample;
+    }
+
+    /**
+     * The given dimension of the sample of path k, see dimension.
+     */
+    auto random(std::size_t k, uint32_t dimension) -> float {
+        return sampler(get<FramePixelTag>()[k], get<SampleIndexTag>()[k], dimension);
+    }
+
+    /**
+     * Dimension dimensions[k] of the sample of each path k in ids, stored at the path's index in
+     * out. The same numbers as random(k, dimensions[k]) for each k, but several paths at a time.
+     */
+    auto random(span<const std::size_t> ids, span<const uint32_t> dimensions, span<float> out)
+        -> void {
+        sampler.sampleWide(get<FramePixelTag>(), get<SampleIndexTag>(), dimensions, ids, out);
     }
 
     auto rayOrigin(std::size_t k) -> float3 {
@@ -79,24 +384,53 @@ struct RayBatch : public SoAObject<tags::PositionX,
     }
 
     std::vector<std::size_t> activeList;
+    Sampler sampler;
+    BounceScratch scratch;
 };
 
-// Generate camera rays for the pixel given in normalized frame buffer coordinates.
-auto generateCameraRays(TileInfo &tileInfo,
-                        PerspectiveCamera const &cam,
+// Generate a camera ray through the point (phi1, phi2) of the pixel given in normalized frame
+// buffer coordinates, and store it as ray k of the batch.
+auto generateCameraRay(PerspectiveCamera const &cam,
+                       NormalizedFrameBufferCoord const &coord,
+                       float phi1,
+                       float phi2,
+                       RayBatch &raybatch,
+                       std::size_t k) -> void {
+    auto ray = cam(coord.x + phi1 * coord.dx, coord.y + phi2 * coord.dy);
+    setPosition(raybatch, k, float3{ray.eye()[0], ray.eye()[1], ray.eye()[2]});
+    setDirection(raybatch, k, float3{ray.dir()[0], ray.dir()[1], ray.dir()[2]});
+}
+
+// Same as above, through the point of the pixel given by the sample of ray k, which must have been
+// started, see RayBatch::startSample.
+auto generateCameraRay(PerspectiveCamera const &cam,
+                       NormalizedFrameBufferCoord const &coord,
+                       RayBatch &raybatch,
+                       std::size_t k) -> void {
+    float phi1 = raybatch.random(k, dimension::PixelX);
+    float phi2 = raybatch.random(k, dimension::PixelY);
+    generateCameraRay(cam, coord, phi1, phi2, raybatch, k);
+}
+
+// Generate camera rays for the pixel given in normalized frame buffer coordinates, one for each
+// ray of the batch, for the samples of the pixel from firstSample on. The pixel index is the index
+// of the pixel in the frame. The batch must not have been traced yet.
+auto generateCameraRays(PerspectiveCamera const &cam,
                         NormalizedFrameBufferCoord const &coord,
+                        uint32_t pixel,
+                        uint32_t firstSample,
                         RayBatch &raybatch) -> void {
-    // Completely random sampling is known to be substandard, we should use a low-discrepancy
-    // sequence of points, like multi-jittered sampling or Sobol sequences. We will address this in
-    // Milestone 3 when we have generators for these type of sequences.
-    auto x = raybatch.get<tags::PositionX>();
-    for (std::size_t k = 0; k != x.size(); k++) {
-        float phi1 = tileInfo.randomGen();
-        float phi2 = tileInfo.randomGen();
-        auto ray = cam(coord.x + phi1 * coord.dx, coord.y + phi2 * coord.dy);
-        setPosition(raybatch, k, float3{ray.eye()[0], ray.eye()[1], ray.eye()[2]});
-        setDirection(raybatch, k, float3{ray.dir()[0], ray.dir()[1], ray.dir()[2]});
-    }
+    auto const &ids = raybatch.activeList;
+    for (auto k : ids)
+        raybatch.startSample(k, pixel, firstSample + static_cast<uint32_t>(k));
+    auto phi1 = raybatch.scratch.get<Random0Tag>(), phi2 = raybatch.scratch.get<Random1Tag>();
+    auto dimensions = raybatch.scratch.get<DimensionTag>();
+    std::fill(std::begin(dimensions), std::end(dimensions), dimension::PixelX);
+    raybatch.random(ids, dimensions, phi1);
+    std::fill(std::begin(dimensions), std::end(dimensions), dimension::PixelY);
+    raybatch.random(ids, dimensions, phi2);
+    for (auto k : ids)
+        generateCameraRay(cam, coord, phi1[k], phi2[k], raybatch, k);
 }
 
 auto randomSphere(PRNG &prng) -> float3 {
@@ -107,97 +441,382 @@ auto randomSphere(PRNG &prng) -> float3 {
     return float3(cos(phi) * sin(theta), sin(phi) * sin(theta), cos(theta));
 }
 
-auto intersect(SceneData &scene, RayBatch &raybatch, IntersectionData &intersections) -> void {
-    auto [Sx, Sy, Sz] = getPositions(scene.spheres);
-    auto radius = scene.spheres.get<tags::Radius>();
-    auto materialIds = scene.spheres.get<tags::MaterialId>();
-
-    for (decltype(Sx.size()) i = 0; i != Sx.size(); i++) {
-        intersectSphere(getPositions(raybatch),
-                        getDirectionSpans(raybatch),
-                        float3(Sx[i], Sy[i], Sz[i]),
-                        radius[i],
-                        materialIds[i],
-                        intersections,
-                        raybatch.activeList);
-    }
-
-    materialIds = scene.planes.get<tags::MaterialId>();
-    auto width = scene.planes.get<tags::WidthF>();
-    auto height = scene.planes.get<tags::HeightF>();
-    auto [Px, Py, Pz] = getPositions(scene.planes);
-    auto [PNx, PNy, PNz] = getNormalSpans(scene.planes);
-    for (decltype(Px.size()) i = 0; i != Px.size(); i++) {
-        intersectPlane(getPositions(raybatch),
+auto intersect(SceneData &scene,
+               RayBatch &raybatch,
+               IntersectionData &intersections,
+               RenderOptions const &options) -> void {
+    // With path regeneration, camera rays and bounced rays can be in the same batch, and they are
+    // traced differently.
+    auto &cameraRays = raybatch.scratch.cameraRays;
+    auto &bouncedRays = raybatch.scratch.bouncedRays;
+    cameraRays.clear();
+    bouncedRays.clear();
+    auto depth = raybatch.get<PathDepthTag>();
+    for (auto k : raybatch.activeList)
+        (depth[k] == 0 ? cameraRays : bouncedRays).push_back(k);
+
+    if (options.primaryRayTraversal == PrimaryRayTraversal::Packet) {
+        intersectScenePacket(scene,
+                             getPositions(raybatch),
+                             getDirectionSpans(raybatch),
+                             intersections,
+                             cameraRays,
+                             RayDirections::Normalized);
+    } else {
+        intersectScene(scene,
+                       getPositions(raybatch),
                        getDirectionSpans(raybatch),
-                       float3(PNx[i], PNy[i], PNz[i]),
-                       float3(Px[i], Py[i], Pz[i]),
-                       width[i],
-                       height[i],
-                       materialIds[i],
                        intersections,
-                       raybatch.activeList);
+                       cameraRays,
+                       RayDirections::Normalized);
+    }
+    if (options.secondaryRayTraversal == SecondaryRayTraversal::Wide) {
+        intersectSceneWide(scene,
+                           getPositions(raybatch),
+                           getDirectionSpans(raybatch),
+                           intersections,
+                           bouncedRays,
+                           RayDirections::Normalized);
+    } else {
+        intersectScene(scene,
+                       getPositions(raybatch),
+                       getDirectionSpans(raybatch),
+                       intersections,
+                       bouncedRays,
+                       RayDirections::Normalized);
     }
 
     auto params = intersections.get<tags::RayParam0>();
     // Fix up activeList.
-    decltype(RayBatch::activeList) newActiveList;
+    auto &newActiveList = raybatch.scratch.stillActive;
+    newActiveList.clear();
     for (auto k : raybatch.activeList) {
         if (params[k] < INFINITY)
             newActiveList.push_back(k);
     }
-    raybatch.activeList = newActiveList;
+    std::swap(raybatch.activeList, newActiveList);
 }
 
+// The constants of russianRouletteFactor, which shadeStandardQueue also uses for whole SIMD
+// registers of rays.
+constexpr float BaseRussianRouletteFactor = 0.55f;
+constexpr float MinRussianRouletteFactor = 0.05f;
+constexpr float MaxRussianRouletteFactor = 0.99f;
+constexpr int32_t RussianRouletteDepth = 3;
+
 // Returns the probability that a desired ray should survive.
 auto russianRouletteFactor(RGB const &throughput, int32_t depth) -> float {
-    constexpr float BaseRussianRouletteFactor = 0.55f;
     // Always make sure we get good indirect lighting, which is most potent the first two bounces
     // (depth 0 is the camera ray).
-    if (depth < 3) {
-        return 0.99f;
+    if (depth < RussianRouletteDepth) {
+        return MaxRussianRouletteFactor;
     } else {
         float power = std::clamp(mag2(float3(throughput(0), throughput(1), throughput(2))),
-                                 0.05f / BaseRussianRouletteFactor,
-                                 0.99f);
+                                 MinRussianRouletteFactor / BaseRussianRouletteFactor,
+                                 MaxRussianRouletteFactor);
         return BaseRussianRouletteFactor * power;
     }
 }
 
+// Shades a queue of hits on one standard material, as accumulateAndBounce does one ray at a time,
+// but in passes over the whole queue that are SIMD wide: gathering emitted light and russian
+// roulette, sampleWide for the survivors, and scaling the throughput of the survivors. The rays left
+// over after the full SIMD blocks go through a padded block, so a ray is shaded the same whichever
+// part of the queue it is in. The random numbers and the weights of the emitted light are worked
+// out by accumulateAndBounce.
+auto shadeStandardQueue(StandardMaterial const &mat,
+                        RayBatch &raybatch,
+                        IntersectionData &intersections,
+                        span<const std::size_t> queue,
+                        span<const float> rouletteRandom,
+                        SoATuple3f samplePoints,
+                        span<const float> emissionWeight) -> void {
+    auto depth = raybatch.get<PathDepthTag>();
+    auto [Tr, Tg, Tb] = raybatch.throughputSpans();
+    auto [Lr, Lg, Lb] = raybatch.lightInSpans();
+    auto [Px, Py, Pz] = getPositions(intersections);
+    auto [x, y, z] = getPositions(raybatch);
+    auto [dx, dy, dz] = getDirectionSpans(raybatch);
+    RGB const L_e = mat.emission();
+
+    auto roulette = raybatch.scratch.get<RouletteTag>();
+    auto [weightR, weightG, weightB] = raybatch.scratch.bounceWeightSpans();
+    auto survived = raybatch.scratch.get<SurvivedTag>();
+    auto &survivors = raybatch.scratch.survivors;
+    survivors.clear();
+
+#if CORNELIS_SIMD_WIDTH > 1
+    using simd::floatv;
+    using simd::Width;
+    simd::forEachBlock(queue, [&](simd::RayBlock const &block, simd::boolv const &mask) {
+        alignas(32) float laneDepth[Width];
+        for (std::size_t l = 0; l < Width; l++)
+            laneDepth[l] = static_cast<float>(depth[block.ids[l]]);
+        floatv d;
+        d.load_aligned(laneDepth);
+
+        floatv const r = block.load(Tr), g = block.load(Tg), b = block.load(Tb);
+        floatv const w = block.load(emissionWeight);
+        block.store(Lr, block.load(Lr) + r * (L_e(0) * w), mask);
+        block.store(Lg, block.load(Lg) + g * (L_e(1) * w), mask);
+        block.store(Lb, block.load(Lb) + b * (L_e(2) * w), mask);
+
+        // See russianRouletteFactor.
+        floatv const u = block.load(rouletteRandom);
+        floatv const power = xsimd::min(
+            xsimd::max(r * r + g * g + b * b,
+                       floatv(MinRussianRouletteFactor / BaseRussianRouletteFactor)),
+            floatv(MaxRussianRouletteFactor));
+        floatv const prob = xsimd::select(d < floatv(static_cast<float>(RussianRouletteDepth)),
+                                          floatv(MaxRussianRouletteFactor),
+                                          BaseRussianRouletteFactor * power);
+        block.store(roulette, prob, mask);
+
+        auto const alive = simd::lanes(mask & !(prob < u));
+        for (std::size_t l = 0; l < Width; l++) {
+            if (alive[l])
+                survivors.push_back(block.ids[l]);
+        }
+    });
+#else
+    for (auto k : queue) {
+        raybatch.accumulateLight(k, L_e * emissionWeight[k]);
+        auto const prob = russianRouletteFactor(raybatch.throughput(k), depth[k]);
+        if (prob < rouletteRandom[k])
+            continue;
+        roulette[k] = prob;
+        survivors.push_back(k);
+    }
+#endif
+
+    sampleWide(mat.brdf(),
+               {dx, dy, dz},
+               getNormalSpans(intersections),
+               samplePoints,
+               survivors,
+               {dx, dy, dz},
+               {weightR, weightG, weightB},
+               raybatch.get<BouncePdfTag>());
+
+#if CORNELIS_SIMD_WIDTH > 1
+    simd::forEachBlock(survivors, [&](simd::RayBlock const &block, simd::boolv const &mask) {
+        floatv const offset(0.0001f);
+        block.store(x, block.load(Px) + block.load(dx) * offset, mask);
+        block.store(y, block.load(Py) + block.load(dy) * offset, mask);
+        block.store(z, block.load(Pz) + block.load(dz) * offset, mask);
+        floatv const invProb = 1.0f / block.load(roulette);
+        block.store(Tr, block.load(Tr) * block.load(weightR) * invProb, mask);
+        block.store(Tg, block.load(Tg) * block.load(weightG) * invProb, mask);
+        block.store(Tb, block.load(Tb) * block.load(weightB) * invProb, mask);
+    });
+#else
+    for (auto k : survivors) {
+        setPosition(raybatch, k, float3{Px[k], Py[k], Pz[k]} + raybatch.rayDir(k) * 0.0001f);
+        raybatch.scaleThroughput(k, RGB{weightR[k], weightG[k], weightB[k]} / roulette[k]);
+    }
+#endif
+    auto [Nx, Ny, Nz] = getNormalSpans(intersections);
+    auto [bounceNx, bounceNy, bounceNz] = getNormalSpans(raybatch);
+    for (auto k : survivors) {
+        bounceNx[k] = Nx[k];
+        bounceNy[k] = Ny[k];
+        bounceNz[k] = Nz[k];
+        depth[k]++;
+        survived[k] = 1;
+    }
+}
+
+// Next event estimation for the given hits, which must be on surfaces that scatter: picks one of
+// the lights of the scene for each with the light BVH, samples a point on it, and adds the light it
+// sends towards the hit to the path if a shadow ray gets there unblocked. The light is weighed
+// against the BRDF finding it by bouncing, see emissionWeights. Must be called before the paths
+// bounce, while the rays and throughputs are still the ones that led to the hits.
+auto sampleDirectLight(SceneData &scene,
+                       RayBatch &raybatch,
+                       IntersectionData &intersections,
+                       span<const std::size_t> hits) -> void {
+    auto depth = raybatch.get<PathDepthTag>();
+    auto [Px, Py, Pz] = getPositions(intersections);
+    auto [Nx, Ny, Nz] = getNormalSpans(intersections);
+    auto materialIds = intersections.get<tags::MaterialId>();
+    auto &scratch = raybatch.scratch;
+
+    auto x0 = scratch.get<Random0Tag>(), x1 = scratch.get<Random1Tag>(),
+         choice = scratch.get<Random2Tag>();
+    auto dimensions = scratch.get<DimensionTag>();
+    std::pair<span<float>, uint32_t> const draws[] = {{x0, dimension::LightPoint},
+                                                      {x1, dimension::LightPoint + 1},
+                                                      {choice, dimension::LightChoice}};
+    for (auto [numbers, offset] : draws) {
+        for (auto k : hits)
+            dimensions[k] = dimension::light(depth[k]) + offset;
+        raybatch.random(hits, dimensions, numbers);
+    }
+
+    // The shadow rays, and the light each brings to its path if nothing is in the way.
+    auto [ox, oy, oz] = getPositions(scratch);
+    auto [dx, dy, dz] = getDirectionSpans(scratch);
+    auto [lightR, lightG, lightB] = scratch.directLightSpans();
+    auto reach = scratch.get<ShadowReachTag>();
+    auto &shadowRays = scratch.shadowRays;
+    shadowRays.clear();
+    for (auto k : hits) {
+        auto const P = float3{Px[k], Py[k], Pz[k]};
+        auto const N = float3{Nx[k], Ny[k], Nz[k]};
+        LightChoice const chosen = scene.lightBvh.sample(P, N, choice[k]);
+        if (!(chosen.probability > 0.0f))
+            continue;
+        auto const picked = scene.lights[chosen.light];
+        ShapeSample const s = sampleLight(scene, picked, P, float2(x0[k], x1[k]));
+        float const cosTheta = dot(s.wi, N);
+        if (!(s.pdf > 0.0f) || cosTheta <= 0.0f)
+            continue;
+
+        float3 const onLight = P + s.wi * s.distance;
+        RGB const L_e = std::visit([&](auto const &mat) { return mat.emission(onLight); },
+                                   scene.materials[scene.materialId(picked)]);
+        float3 const wo = -raybatch.rayDir(k);
+        float brdfPdf = 0.0f;
+        RGB const f = std::visit(
+            [&]<typename MaterialKind>(MaterialKind const &mat) {
+                if constexpr (MaterialKind::Scatters) {
+                    auto const &brdf = mat.brdf(P, N);
+                    brdfPdf = brdf.pdf(s.wi, wo, constructBasis(N));
+                    return brdf(s.wi, wo, N);
+                } else {
+                    return RGB::black();
+                }
+            },
+            scene.materials[materialIds[k]]);
+        float const pdf = s.pdf * chosen.probability;
+        RGB const light = f * L_e * (cosTheta * powerHeuristic(pdf, brdfPdf) / pdf);
+        if (light == RGB::black())
+            continue;
+        lightR[k] = light(0);
+        lightG[k] = light(1);
+        lightB[k] = light(2);
+
+        // Offset like the rays of the bounces, and stopped short of the light.
+        float3 const origin = P + s.wi * 0.0001f;
+        ox[k] = origin(0);
+        oy[k] = origin(1);
+        oz[k] = origin(2);
+        dx[k] = s.wi(0);
+        dy[k] = s.wi(1);
+        dz[k] = s.wi(2);
+        reach[k] = (s.distance - 0.0001f) * 0.999f;
+        shadowRays.push_back(k);
+    }
+
+    auto params = scratch.shadows.get<tags::RayParam0>();
+    for (auto k : shadowRays)
+        params[k] = INFINITY;
+    intersectSceneWide(
+        scene, {ox, oy, oz}, {dx, dy, dz}, scratch.shadows, shadowRays, RayDirections::Normalized);
+    for (auto k : shadowRays) {
+        if (!(params[k] < reach[k]))
+            raybatch.accumulateLight(k, RGB{lightR[k], lightG[k], lightB[k]});
+    }
+}
+
+// The weight of the light that the hit of each active ray emits towards its path, at the ray's
+// index in weights. With next event estimation, a bounced ray that hits a light found light that
+// sampleDirectLight could have found from the hit before, so the two are weighed against each other
+// with the power heuristic. Otherwise the light counts in full.
+auto emissionWeights(SceneData &scene,
+                     RayBatch &raybatch,
+                     IntersectionData &intersections,
+                     bool nextEvent,
+                     span<float> weights) -> void {
+    auto depth = raybatch.get<PathDepthTag>();
+    auto bouncePdf = raybatch.get<BouncePdfTag>();
+    auto primitives = intersections.get<tags::PrimitiveId>();
+    auto params = intersections.get<tags::RayParam0>();
+    auto [Nx, Ny, Nz] = getNormalSpans(raybatch);
+    auto const &lights = scene.lights;
+    for (auto k : raybatch.activeList) {
+        weights[k] = 1.0f;
+        if (!nextEvent || depth[k] == 0)
+            continue;
+        auto const light = std::lower_bound(lights.begin(), lights.end(), primitives[k]);
+        if (light == lights.end() || *light != primitives[k])
+            continue;
+        // The ray starts where the hit before sampled the lights from, give or take the offset.
+        float3 const P = raybatch.rayOrigin(k);
+        float const chosen = scene.lightBvh.probability(
+            P, float3{Nx[k], Ny[k], Nz[k]}, static_cast<uint32_t>(light - lights.begin()));
+        float const pdf =
+            lightPdf(scene, primitives[k], P, raybatch.rayDir(k), params[k]) * chosen;
+        weights[k] = powerHeuristic(bouncePdf[k], pdf);
+    }
+}
+
+// Adds the light emitted at each hit to its path, and either terminates the path or sets up the ray
+// for the next bounce. With byMaterial the hits are bucketed by material first, and the queue of
+// rays for each material is shaded in one go, by shadeStandardQueue for standard materials. With
+// next event estimation, the hits on surfaces that scatter sample the lights first, see
+// sampleDirectLight, and the emitted light is weighed by emissionWeights.
 auto accumulateAndBounce(SceneData &scene,
                          RayBatch &raybatch,
                          IntersectionData &intersections,
-                         PRNG &randomGen,
-                         int32_t depth) -> void {
-    std::vector<std::size_t> stillActive;
-    for (auto k : raybatch.activeList) {
-        float3 const w_out = -raybatch.rayDir(k);
+                         RenderOptions const &options) -> void {
+    auto depth = raybatch.get<PathDepthTag>();
+    auto [Px, Py, Pz] = getPositions(intersections);
+    auto [Nx, Ny, Nz] = getNormalSpans(intersections);
+    auto materialIds = intersections.get<tags::MaterialId>();
 
-        auto [Px, Py, Pz] = getPositions(intersections);
-        auto [Nx, Ny, Nz] = getNormalSpans(intersections);
-        auto materialIds = intersections.get<tags::MaterialId>();
+    bool const nextEvent = options.nextEventEstimation && !scene.lights.empty();
+    if (nextEvent) {
+        auto &scattering = raybatch.scratch.scattering;
+        scattering.clear();
+        for (auto k : raybatch.activeList) {
+            if (std::visit([](auto const &mat) { return std::decay_t<decltype(mat)>::Scatters; },
+                           scene.materials[materialIds[k]]))
+                scattering.push_back(k);
+        }
+        sampleDirectLight(scene, raybatch, intersections, scattering);
+    }
+    auto &scratch = raybatch.scratch;
+    auto emissionWeight = scratch.get<EmissionWeightTag>();
+    emissionWeights(scene, raybatch, intersections, nextEvent, emissionWeight);
+
+    // The random numbers of this bounce, drawn for all the paths at once: one for russian roulette
+    // and three for sampling the BRDF, from the dimensions of the bounce at the depth of each path.
+    // Paths that terminate here leave theirs unused.
+    auto u = scratch.get<Random0Tag>(), x0 = scratch.get<Random1Tag>(),
+         x1 = scratch.get<Random2Tag>(), x2 = scratch.get<Random3Tag>();
+    auto dimensions = scratch.get<DimensionTag>();
+    std::pair<span<float>, uint32_t> const draws[] = {{u, dimension::Roulette},
+                                                      {x0, dimension::BRDF},
+                                                      {x1, dimension::BRDF + 1},
+                                                      {x2, dimension::BRDF + 2}};
+    for (auto [numbers, offset] : draws) {
+        for (auto k : raybatch.activeList)
+            dimensions[k] = dimension::bounce(depth[k]) + offset;
+        raybatch.random(raybatch.activeList, dimensions, numbers);
+    }
 
-        auto const &mat = scene.materials[materialIds[k]];
+    auto survived = scratch.get<SurvivedTag>();
+    for (auto k : raybatch.activeList)
+        survived[k] = 0;
+    // Russian roulette, then samples the BRDF of mat for the direction of the next ray.
+    auto bounce = [&](std::size_t k, auto const &mat, float3 const &P) {
+        float3 const w_out = -raybatch.rayDir(k);
         // TODO: We can chose a much better russian roulette factor.
-        auto const prob = russianRouletteFactor(raybatch.throughput(k), depth);
-        auto const P = float3{Px[k], Py[k], Pz[k]};
+        auto const prob = russianRouletteFactor(raybatch.throughput(k), depth[k]);
         auto const N = float3{Nx[k], Ny[k], Nz[k]};
-        auto const L_e = mat.emission(P);
-
-        raybatch.accumulateLight(k, L_e);
 
-        if (prob < randomGen()) {
+        if (prob < u[k]) {
             // We killed the ray tree due to russian roulette.
-            continue;
+            return;
         }
 
         Basis basis = constructBasis(N);
-        BRDF const &brdf = mat.brdf(P, N);
+        auto const &brdf = mat.brdf(P, N);
         // TODO: we can do much better here by importance sampling.
-        float pdf = randomHemispherePDF();
-        float3 w_in{};
-        float3 samplePos(randomGen(), randomGen(), randomGen());
-        RGB f = brdf.generateDirection(w_out, samplePos, basis, w_in, pdf);
+        float3 samplePos(x0[k], x1[k], x2[k]);
+        BRDFSample const sample = brdf.sample(w_out, samplePos, basis);
+        float3 const &w_in = sample.wi;
         // float3 w_in = normalize(N + randomSphere(randomGen));
         // float pdf = brdf.pdf(w_in);
 
@@ -210,73 +829,458 @@ auto accumulateAndBounce(SceneData &scene,
         raybatch.scaleThroughput(k,
                                  //   (RGB{P[0], P[1], P[2]} * 0.5f + RGB{0.5, 0.5, 0.5}) / Pi *
                                  //       abs(dot(w_in, N)) / (pdf * prob));
-                                 f * abs(dot(w_in, N)) / (pdf * prob));
+                                 sample.f * sample.cosTheta / (sample.pdf * prob));
+        raybatch.get<BouncePdfTag>()[k] = sample.pdf;
+        setNormal(raybatch, k, N);
+        depth[k]++;
 
-        stillActive.push_back(k);
+        survived[k] = 1;
+    };
+
+    // Called with each kind of material, see Material.
+    auto shade = [&]<typename MaterialKind>(std::size_t k, MaterialKind const &mat) {
+        auto const P = float3{Px[k], Py[k], Pz[k]};
+        raybatch.accumulateLight(k, mat.emission(P) * emissionWeight[k]);
+
+        if constexpr (MaterialKind::Scatters)
+            bounce(k, mat, P);
+    };
+
+    auto const &activeList = raybatch.activeList;
+    if (options.shadeByMaterial) {
+        // Counting sort, which keeps the rays of each queue in ray order.
+        auto &queueStart = scratch.queueStart;
+        queueStart.assign(scene.materials.size() + 1, 0);
+        for (auto k : activeList)
+            queueStart[materialIds[k] + 1]++;
+        std::partial_sum(std::begin(queueStart), std::end(queueStart), std::begin(queueStart));
+        auto &queues = scratch.queues;
+        queues.resize(activeList.size());
+        auto &next = scratch.queueNext;
+        next.assign(std::begin(queueStart), std::end(queueStart));
+        for (auto k : activeList)
+            queues[next[materialIds[k]]++] = k;
+
+        // The kind of material is resolved once per queue, rather than once per ray.
+        for (std::size_t m = 0; m != scene.materials.size(); m++) {
+            auto const queue = span<const std::size_t>(queues).subspan(
+                queueStart[m], queueStart[m + 1] - queueStart[m]);
+            std::visit(
+                [&]<typename MaterialKind>(MaterialKind const &mat) {
+                    if constexpr (std::is_same_v<MaterialKind, StandardMaterial>) {
+                        shadeStandardQueue(mat,
+                                           raybatch,
+                                           intersections,
+                                           queue,
+                                           u,
+                                           {x0, x1, x2},
+                                           emissionWeight);
+                    } else {
+                        for (auto k : queue)
+                            shade(k, mat);
+                    }
+                },
+                scene.materials[m]);
+        }
+    } else {
+        for (auto k : activeList)
+            std::visit([&](auto const &mat) { shade(k, mat); }, scene.materials[materialIds[k]]);
     }
-    raybatch.activeList = stillActive;
+
+    // The active list stays in ray order, which compaction and regeneration rely on.
+    auto &stillActive = scratch.stillActive;
+    stillActive.clear();
+    for (auto k : activeList) {
+        if (survived[k])
+            stillActive.push_back(k);
+    }
+    std::swap(raybatch.activeList, stillActive);
 }
 
+// The samples each pixel of the frame takes in a pass: pixel p takes samples first[p] up to
+// first[p] + count[p], so that each pass carries on where the ones before it stopped.
+struct FramePass {
+    std::vector<uint32_t> first;
+    std::vector<uint32_t> count;
+};
+
+// The light the pixels of the frame have gathered, over all the passes so far.
+struct FrameLight {
+    explicit FrameLight(std::size_t pixels)
+        : sums(pixels), oddSums(pixels), samples(pixels, 0), luminance(pixels) {}
+
+    std::vector<PixelSum> sums;
+    // The light of the odd samples alone, for halfBufferRelativeMSE.
+    std::vector<PixelSum> oddSums;
+    std::vector<uint32_t> samples;
+    // Only kept up to date with adaptive sampling.
+    std::vector<RunningVariance> luminance;
+};
+
+// The relative mean squared error of the frame, estimated from the even and odd samples of its
+// pixels. See halfBufferRelativeMSE.
+auto relativeMSE(FrameLight const &frame) -> double {
+    std::vector<float> even(frame.sums.size()), odd(frame.sums.size());
+    for (std::size_t p = 0; p != frame.sums.size(); p++) {
+        auto const n = frame.samples[p];
+        if (n < 2)
+            continue;
+        PixelSum evenSum = frame.sums[p];
+        evenSum -= frame.oddSums[p];
+        even[p] = luminance(evenSum.average((n + 1) / 2));
+        odd[p] = luminance(frame.oddSums[p].average(n / 2));
+    }
+    return halfBufferRelativeMSE(even, odd, frame.samples);
+}
+
+// The index in the frame of pixel p of a tile, with the pixels of the tile numbered row by row.
+auto framePixel(PixelRect const &bounds, int32_t frameWidth, std::size_t p) -> std::size_t {
+    auto const width = static_cast<std::size_t>(bounds.width());
+    return static_cast<std::size_t>(bounds.min().j + static_cast<int32_t>(p / width)) *
+               static_cast<std::size_t>(frameWidth) +
+           static_cast<std::size_t>(bounds.min().i + static_cast<int32_t>(p % width));
+}
+
+// The light the paths of a tile gather in a pass, by pixel of the tile. With adaptive sampling,
+// the luminance of every sample is kept as well, so that the running variance of each pixel is
+// updated in sample order when the pass is done, whatever order the paths finished in.
+class TileLight {
+  public:
+    TileLight(TileInfo const &tileInfo,
+              int32_t frameWidth,
+              FramePass const &pass,
+              bool keepLuminance)
+        : bounds(tileInfo.bounds), frameWidth_(frameWidth), sums(bounds.area()),
+          oddSums(bounds.area()), first(bounds.area()), count(bounds.area()) {
+        for (std::size_t p = 0; p != sums.size(); p++) {
+            auto const f = framePixel(bounds, frameWidth_, p);
+            first[p] = pass.first[f];
+            count[p] = pass.count[f];
+        }
+        if (keepLuminance) {
+            offsets.resize(sums.size() + 1, 0);
+            for (std::size_t p = 0; p != sums.size(); p++)
+                offsets[p + 1] = offsets[p] + count[p];
+            luminance.resize(offsets.back());
+        }
+    }
+
+    // The samples the pixels of the tile take in the pass.
+    auto samples() const -> std::size_t {
+        return std::accumulate(std::begin(count), std::end(count), std::size_t(0));
+    }
+
+    auto add(uint32_t pixel, uint32_t sample, RGB const &light) -> void {
+        if (PixelSum::invalid(light))
+            invalid_++;
+        sums[pixel] += light;
+        if (sample % 2)
+            oddSums[pixel] += light;
+        if (!luminance.empty())
+            luminance[offsets[pixel] + sample - first[pixel]] =
+                cornelis::luminance(PixelSum::clamp(light));
+    }
+
+    // Adds the light of the pass to the frame, and writes the new averages of the pixels of the
+    // tile to the frame buffer.
+    auto finish(FrameLight &frame, RGBFrameBuffer &fb) const -> void {
+        auto const width = static_cast<std::size_t>(bounds.width());
+        for (std::size_t p = 0; p != sums.size(); p++) {
+            auto const f = framePixel(bounds, frameWidth_, p);
+            frame.sums[f] += sums[p];
+            frame.oddSums[f] += oddSums[p];
+            frame.samples[f] += count[p];
+            if (!luminance.empty()) {
+                for (std::size_t s = offsets[p]; s != offsets[p + 1]; s++)
+                    frame.luminance[f].add(luminance[s]);
+            }
+            // Box-filter 0.5f radius
+            if (frame.samples[f] > 0)
+                fb(bounds.min().i + static_cast<int32_t>(p % width),
+                   bounds.min().j + static_cast<int32_t>(p / width)) =
+                    frame.sums[f].average(frame.samples[f]);
+        }
+    }
+
+    // The sample a pixel of the tile starts the pass at, and how many it takes.
+    auto firstSample(std::size_t p) const -> uint32_t { return first[p]; }
+    auto sampleCount(std::size_t p) const -> uint32_t { return count[p]; }
+
+    // How many samples had NaN or negative light, see PixelSum::invalid.
+    auto invalidSamples() const -> std::size_t { return invalid_; }
+
+  private:
+    PixelRect bounds;
+    int32_t frameWidth_;
+    std::size_t invalid_ = 0;
+    std::vector<PixelSum> sums;
+    std::vector<PixelSum> oddSums;
+    std::vector<uint32_t> first;
+    std::vector<uint32_t> count;
+    // Where the luminance of the samples of each pixel starts.
+    std::vector<std::size_t> offsets;
+    std::vector<float> luminance;
+};
+
 auto integrateTile(TileInfo &tileInfo,
                    RenderOptions const &options,
                    SceneData &scene,
-                   RGBFrameBuffer &fb) -> void {
-    for (auto j = tileInfo.bounds.min().j; j <= tileInfo.bounds.max().j; j++) {
-        for (auto i = tileInfo.bounds.min().i; i <= tileInfo.bounds.max().i; i++) {
-            // printf("Rendering tile %zu on thread %d: pixel %u %u\n",
-            // tileInfo.tileNumber,
-            // tbb::this_task_arena::current_thread_index(),
-            // i, j);
-            NormalizedFrameBufferCoord screenCoord({i, j}, {fb.width(), fb.height()});
-
-            RayBatch raybatch(options.samplesAA);
-            generateCameraRays(tileInfo, scene.camera, screenCoord, raybatch);
-            IntersectionData intersections(options.samplesAA);
-
-            int32_t depth = 0;
-            while (raybatch.activeList.size() > 0) {
-                intersect(scene, raybatch, intersections);
-                // if (raybatch.activeList.size() > 0)
-                //    printf("actives %zu\n", raybatch.activeList.size());
-                accumulateAndBounce(scene, raybatch, intersections, tileInfo.randomGen, depth++);
-                intersections.reset();
-            }
+                   RGBFrameBuffer const &fb,
+                   TileLight &light) -> void {
+    auto const &bounds = tileInfo.bounds;
+    auto const area = static_cast<std::size_t>(bounds.area());
+    for (std::size_t p = 0; p != area; p++) {
+        auto const count = light.sampleCount(p);
+        if (count == 0)
+            continue;
+        auto const first = light.firstSample(p);
+        PixelCoord const pixel{bounds.min().i + static_cast<int32_t>(p % bounds.width()),
+                               bounds.min().j + static_cast<int32_t>(p / bounds.width())};
+        NormalizedFrameBufferCoord screenCoord(pixel, {fb.width(), fb.height()});
 
-            RGB color = RGB::black();
-            for (auto const &term : raybatch.get<LightInTag>()) {
-                color += term;
-            }
-            // Box-filter 0.5f radius
-            color = color * (1.0f / options.samplesAA);
+        RayBatch raybatch(count,
+                          Sampler(options.samplePattern,
+                                  static_cast<uint32_t>(fb.width()),
+                                  static_cast<uint32_t>(options.samplesAA)));
+        generateCameraRays(scene.camera,
+                           screenCoord,
+                           static_cast<uint32_t>(framePixel(bounds, fb.width(), p)),
+                           first,
+                           raybatch);
+        IntersectionData intersections(count);
+
+        while (raybatch.activeList.size() > 0) {
+            intersect(scene, raybatch, intersections, options);
+            accumulateAndBounce(scene, raybatch, intersections, options);
+            intersections.reset();
+        }
+
+        for (uint32_t k = 0; k != count; k++)
+            light.add(static_cast<uint32_t>(p), first + k, raybatch.lightIn(k));
+    }
+}
 
-            fb(i, j) = color;
+// Hands out the samples a tile takes in a pass, path by path, as camera rays: the samples of the
+// first pixel of the tile in order, then those of the next pixel, and so on.
+struct TileSamples {
+    TileSamples(TileInfo &info,
+                PerspectiveCamera const &cam,
+                PixelCoord fbSizeIn,
+                TileLight const &lightIn)
+        : tileInfo(info), camera(cam), fbSize(fbSizeIn), light(lightIn), total(light.samples()) {}
+
+    auto remaining() const noexcept -> std::size_t { return total - next; }
+
+    // Starts the next path in slot k of the batch.
+    auto start(RayBatch &raybatch, std::size_t k) -> void {
+        auto const &bounds = tileInfo.bounds;
+        while (sample == light.sampleCount(pixel)) {
+            pixel++;
+            sample = 0;
         }
+        PixelCoord const p{bounds.min().i + static_cast<int32_t>(pixel % bounds.width()),
+                           bounds.min().j + static_cast<int32_t>(pixel / bounds.width())};
+        raybatch.startSample(
+            k, static_cast<uint32_t>(p.j * fbSize.i + p.i), light.firstSample(pixel) + sample);
+        generateCameraRay(camera, NormalizedFrameBufferCoord(p, fbSize), raybatch, k);
+        raybatch.get<PixelIndexTag>()[k] = static_cast<uint32_t>(pixel);
+        raybatch.resetPath(k);
+        sample++;
+        next++;
     }
+
+    TileInfo &tileInfo;
+    PerspectiveCamera const &camera;
+    PixelCoord fbSize;
+    TileLight const &light;
+    std::size_t total;
+    std::size_t next = 0;
+    // The pixel of the tile and the sample of the pass of the next path.
+    std::size_t pixel = 0;
+    uint32_t sample = 0;
+};
+
+// Moves element order[i] of field to position i, by way of moved.
+template <typename T>
+auto gatherField(span<T> field, span<const std::size_t> order, std::vector<T> &moved) -> void {
+    moved.resize(order.size());
+    for (std::size_t i = 0; i != order.size(); i++)
+        moved[i] = field[order[i]];
+    std::copy(std::begin(moved), std::end(moved), std::begin(field));
 }
 
-auto saveImage(RGBFrameBuffer const &fb) -> void {
+// Adds the light gathered by the paths that are no longer active to their pixels, and moves the
+// active paths to the front of the batch in the given order. The paths carry their pixel index
+// along, so their light still ends up in the right place. The order must not be the active list
+// itself, which is reset to the slots the paths end up in.
+auto movePaths(RayBatch &raybatch, span<const std::size_t> order, TileLight &light) -> void {
+    auto pixel = raybatch.get<PixelIndexTag>();
+    auto sample = raybatch.get<SampleIndexTag>();
+    auto &scratch = raybatch.scratch;
+    auto &active = scratch.active;
+    active.assign(pixel.size(), 0);
+    for (auto k : raybatch.activeList)
+        active[k] = 1;
+    for (std::size_t k = 0; k != pixel.size(); k++) {
+        if (!active[k] && pixel[k] != NoPixel) {
+            light.add(pixel[k], sample[k], raybatch.takeLight(k));
+            pixel[k] = NoPixel;
+        }
+    }
+
+    auto [x, y, z] = getPositions(raybatch);
+    auto [dx, dy, dz] = getDirectionSpans(raybatch);
+    auto [Tr, Tg, Tb] = raybatch.throughputSpans();
+    auto [r, g, b] = raybatch.lightInSpans();
+    auto [Nx, Ny, Nz] = getNormalSpans(raybatch);
+    for (auto field : {x, y, z, dx, dy, dz, Tr, Tg, Tb, r, g, b, Nx, Ny, Nz})
+        gatherField(field, order, scratch.movedFloats);
+    gatherField(raybatch.get<PathDepthTag>(), order, scratch.movedInts);
+    gatherField(pixel, order, scratch.movedUints);
+    gatherField(raybatch.get<FramePixelTag>(), order, scratch.movedUints);
+    gatherField(raybatch.get<SampleIndexTag>(), order, scratch.movedUints);
+    gatherField(raybatch.get<BouncePdfTag>(), order, scratch.movedFloats);
+    // The slots past the active paths hold stale copies, which must not be added to their pixels
+    // again.
+    std::fill(std::begin(pixel) + order.size(), std::end(pixel), NoPixel);
+    std::iota(std::begin(raybatch.activeList), std::end(raybatch.activeList), 0);
+}
+
+// Moves the active paths to the front of the batch, so the kernels see runs of consecutive rays.
+// See movePaths.
+auto compactPaths(RayBatch &raybatch, TileLight &light) -> void {
+    auto &order = raybatch.scratch.order;
+    order.assign(std::begin(raybatch.activeList), std::end(raybatch.activeList));
+    movePaths(raybatch, order, light);
+}
+
+// Sorts the active paths so rays that start close to each other and go in roughly the same
+// direction are next to each other, and moves them to the front of the batch. The key is the
+// octant of the direction, then the Morton code of the origin within the scene bounds. See
+// movePaths.
+auto sortPaths(RayBatch &raybatch, AABB const &sceneBounds, TileLight &light) -> void {
+    auto [x, y, z] = getPositions(raybatch);
+    auto [dx, dy, dz] = getDirectionSpans(raybatch);
+
+    auto &keyed = raybatch.scratch.keyed;
+    keyed.clear();
+    for (auto k : raybatch.activeList) {
+        uint64_t octant = (dx[k] < 0.0f ? 4 : 0) | (dy[k] < 0.0f ? 2 : 0) | (dz[k] < 0.0f ? 1 : 0);
+        keyed.push_back({octant << 30 | mortonCode({x[k], y[k], z[k]}, sceneBounds), k});
+    }
+    std::sort(std::begin(keyed), std::end(keyed));
+
+    auto &order = raybatch.scratch.order;
+    order.resize(keyed.size());
+    for (std::size_t i = 0; i != keyed.size(); i++)
+        order[i] = keyed[i].second;
+    movePaths(raybatch, order, light);
+}
+
+// Adds the light gathered by the paths that are no longer active to their pixels, and starts new
+// paths in their slots for as long as the tile has samples left. The batch stays full until the
+// very end of the tile.
+auto regeneratePaths(RayBatch &raybatch, TileSamples &samples, TileLight &light) -> void {
+    auto pixel = raybatch.get<PixelIndexTag>();
+    auto sample = raybatch.get<SampleIndexTag>();
+
+    auto &newActiveList = raybatch.scratch.stillActive;
+    newActiveList.clear();
+    std::size_t next = 0;
+    for (std::size_t k = 0; k != pixel.size(); k++) {
+        if (next < raybatch.activeList.size() && raybatch.activeList[next] == k) {
+            newActiveList.push_back(k);
+            next++;
+            continue;
+        }
+        if (pixel[k] != NoPixel) {
+            light.add(pixel[k], sample[k], raybatch.takeLight(k));
+            pixel[k] = NoPixel;
+        }
+        if (samples.remaining() > 0) {
+            samples.start(raybatch, k);
+            newActiveList.push_back(k);
+        }
+    }
+    std::swap(raybatch.activeList, newActiveList);
+}
+
+// Does the same as integrateTile, but traces all the samples of the tile in waves of up to
+// options.wavefrontSize paths. Every bounce runs the stages over the whole wave: intersect, shade,
+// and then either compaction of the paths that are still alive, or regeneration of the ones that
+// are not. This keeps the batches large even at deep bounces, where the per pixel batches are down
+// to a few rays. Optionally, the paths are also sorted for coherence before the next bounce.
+auto integrateTileWavefront(TileInfo &tileInfo,
+                            RenderOptions const &options,
+                            SceneData &scene,
+                            RGBFrameBuffer const &fb,
+                            TileLight &light) -> void {
+    TileSamples samples(tileInfo, scene.camera, {fb.width(), fb.height()}, light);
+    if (samples.total == 0)
+        return;
+    std::size_t const waveSize =
+        std::min(samples.total, static_cast<std::size_t>(std::max(options.wavefrontSize, 1)));
+
+    RayBatch raybatch(waveSize,
+                      Sampler(options.samplePattern,
+                              static_cast<uint32_t>(fb.width()),
+                              static_cast<uint32_t>(options.samplesAA)));
+    auto pixel = raybatch.get<PixelIndexTag>();
+    std::fill(std::begin(pixel), std::end(pixel), NoPixel);
+    IntersectionData intersections(waveSize);
+    while (samples.remaining() > 0) {
+        // With regeneration, there is only ever one wave.
+        auto const size = std::min(waveSize, samples.remaining());
+        raybatch.activeList.resize(size);
+        std::iota(std::begin(raybatch.activeList), std::end(raybatch.activeList), 0);
+        for (std::size_t k = 0; k != size; k++)
+            samples.start(raybatch, k);
+
+        while (raybatch.activeList.size() > 0) {
+            intersect(scene, raybatch, intersections, options);
+            accumulateAndBounce(scene, raybatch, intersections, options);
+            intersections.reset();
+            // Once the tile is out of samples, the batch can only drain, and compaction keeps the
+            // last paths together.
+            bool const regenerate = options.pathRegeneration && samples.remaining() > 0;
+            if (regenerate)
+                regeneratePaths(raybatch, samples, light);
+            if (options.sortRays && !scene.bvh.empty())
+                sortPaths(raybatch, scene.bvh.nodes[0].bounds, light);
+            else if (!regenerate)
+                compactPaths(raybatch, light);
+        }
+    }
+}
+
+auto saveImage(RGBFrameBuffer const &fb, MathAccuracy accuracy, std::filesystem::path const &path)
+    -> void {
     SRGBFrameBuffer srgbFb(PixelRect(fb.width(), fb.height()));
-    std::transform(fb.begin(), fb.end(), srgbFb.begin(), toSRGB);
+    std::transform(fb.begin(), fb.end(), srgbFb.begin(), [accuracy](RGB const &rgb) {
+        return toSRGB(rgb, accuracy);
+    });
     auto data8bit = quantizeTo8bit(srgbFb);
 
     // Todo: This is a bit iffy if for some reason the elements of data8bit would be padded.
     stbi_write_png(
-        "cornelisrender2.png", data8bit.width(), data8bit.height(), 3, data8bit.data(), 0);
+        path.string().c_str(), data8bit.width(), data8bit.height(), 3, data8bit.data(), 0);
 }
 
 struct RenderSession::State {
     State(SceneDescription const &sc, RenderOptions opts)
-        : sceneDescr(sc), scene(sceneDescr), options(std::move(opts)) {}
+        : sceneDescr(sc), scene(sceneDescr, opts.bvhBuilder, opts.mathAccuracy),
+          options(std::move(opts)), fb(PixelRect(512, 512)) {}
 
     SceneDescription sceneDescr;
     SceneData scene;
     RenderOptions options;
+    RGBFrameBuffer fb;
     // Used for book-keeping by the render loop. Most of the values are for reporting or user
     // feedback. Values in this will be changed by multiple threads until the render loop is
     // completed.
     struct Progress {
-        // How many rays we expect to trace. For a future progressive mode, this is probably not
-        // computable, and this value would be meaningless.
+        // How many rays we expect to trace at most. Adaptive sampling and a time budget may stop
+        // the render before.
         std::atomic_int64_t primaryRaysTarget;
         // How many primary rays we have launched so far.
         std::atomic_int64_t primayRaysTraced;
@@ -288,11 +1292,17 @@ struct RenderSession::State {
     } progress;
 };
 
+// The samples per pixel of each pass of a render that has a time budget but isn't progressive or
+// adaptive, see RenderOptions::timeBudget.
+constexpr uint32_t TimeBudgetPassSamples = 4;
+
 RenderSession::RenderSession(SceneDescription const &sc, RenderOptions options)
     : me_{std::make_unique<State>(sc, std::move(options))} {}
 
 RenderSession::~RenderSession() {}
 
+auto RenderSession::image() const -> RGBFrameBuffer const & { return me_->fb; }
+
 auto RenderSession::render() -> void {
     render([](auto const &progress, auto const &status) -> RenderCommand {
         return RenderCommand::Continue;
@@ -304,61 +1314,237 @@ auto RenderSession::render(ProgressCallback onProgress) -> void {
     // auto logger = spdlog::stdout_logger_mt("console");
     // logger->set_pattern("[%H:%M:%S %z] (t %t): %v");
 
-    RGBFrameBuffer fb(PixelRect(512, 512));
-    PRNG rootRng;
+    RGBFrameBuffer &fb = me_->fb;
 
     if (me_->options.samplesAA <= 0) { // TODO: create some validation routine.
         printf("AA Samples must be > 0 (not %d).\n", me_->options.samplesAA);
         return;
     }
+    if (me_->options.samplesAA > RenderOptions::MaxSamplesAA ||
+        me_->options.adaptiveMaxSamples > RenderOptions::MaxSamplesAA) {
+        printf("AA Samples and adaptive max samples must be <= %d (not %d and %d).\n",
+               RenderOptions::MaxSamplesAA,
+               me_->options.samplesAA,
+               me_->options.adaptiveMaxSamples);
+        return;
+    }
 
     LOG_F(INFO, "Starting render session.");
     {
         LOG_SCOPE_F(INFO, "Render Options");
         LOG_F(INFO, "AA Samples {:4}", me_->options.samplesAA);
+        if (me_->options.adaptiveErrorTarget > 0.0f)
+            LOG_F(INFO,
+                  "Adaptive   relative error {}, {} to {} samples per pixel",
+                  me_->options.adaptiveErrorTarget,
+                  me_->options.adaptiveMinSamples,
+                  me_->options.adaptiveMaxSamples);
+        else if (me_->options.progressiveSamples > 0)
+            LOG_F(INFO, "Passes     {} samples per pixel each", me_->options.progressiveSamples);
+        else if (me_->options.timeBudget > 0.0)
+            LOG_F(INFO,
+                  "Passes     {} samples per pixel each, for the time limit",
+                  TimeBudgetPassSamples);
+        if (me_->options.convergenceTarget > 0.0f)
+            LOG_F(INFO, "Converged  relative MSE {}", me_->options.convergenceTarget);
+        if (me_->options.timeBudget > 0.0)
+            LOG_F(INFO, "Time limit {} s", me_->options.timeBudget);
+        if (me_->options.integrator == Integrator::Wavefront)
+            LOG_F(INFO,
+                  "Integrator wavefront, {} paths per wave{}",
+                  me_->options.wavefrontSize,
+                  me_->options.pathRegeneration ? ", with path regeneration" : "");
+        else
+            LOG_F(INFO, "Integrator per pixel");
+        LOG_F(INFO,
+              "BVH build  {}",
+              me_->options.bvhBuilder == BVHBuilder::Morton ? "Morton" : "binned SAH");
+        LOG_F(INFO,
+              "Primary    {}",
+              me_->options.primaryRayTraversal == PrimaryRayTraversal::Packet ? "packet"
+                                                                              : "stream");
+        LOG_F(INFO,
+              "Secondary  {}",
+              me_->options.secondaryRayTraversal == SecondaryRayTraversal::Wide ? "wide BVH"
+                                                                                : "binary stream");
+        LOG_F(INFO,
+              "Shading    {}",
+              me_->options.shadeByMaterial ? "queued by material" : "in ray order");
+        LOG_F(INFO,
+              "Sampling   {}",
+              me_->options.samplePattern == SamplePattern::Sobol       ? "scrambled Sobol"
+              : me_->options.samplePattern == SamplePattern::PMJ02     ? "PMJ02 tables"
+              : me_->options.samplePattern == SamplePattern::BlueNoise ? "blue noise Sobol"
+                                                                       : "random");
+        LOG_F(INFO,
+              "Lights     {}",
+              me_->options.nextEventEstimation ? "sampled directly, with MIS"
+                                               : "only found by chance");
+        if (me_->options.samplePattern == SamplePattern::BlueNoise)
+            LOG_F(INFO, "Blue noise {0}x{0} pixel ordering", defaultBlueNoiseOrdering().size());
+        LOG_F(INFO,
+              "Math       {}",
+              me_->options.mathAccuracy == MathAccuracy::Fast ? "fast approximations" : "exact");
     }
     {
         LOG_SCOPE_F(INFO, "Scene information");
         LOG_F(INFO, "Spheres   {:4}", me_->scene.spheres.get<tags::PositionX>().size());
         LOG_F(INFO, "Planes    {:4}", me_->scene.planes.get<tags::PositionX>().size());
         LOG_F(INFO, "Materials {:4}", me_->scene.materials.size());
+        LOG_F(INFO, "Lights    {:4}", me_->scene.lights.size());
+        LOG_F(INFO,
+              "BVH       {:4} nodes, built in {:.3f} s, SAH cost {:.2f}",
+              me_->scene.bvh.nodes.size(),
+              me_->scene.bvhBuildTime,
+              sahCost(me_->scene.bvh));
+        LOG_F(INFO, "Wide BVH  {:4} nodes", me_->scene.wideBvh.nodes.size());
+        LOG_F(INFO, "Light BVH {:4} nodes", me_->scene.lightBvh.nodes.size());
     }
 
-    FrameTiling tiling(PixelRect(fb.width(), fb.height()), PixelRect{32, 32});
-    // Set up PRNGs to start at different points in the period.
-    for (auto &tileInfo : tiling) {
-        tileInfo.randomGen = cloneForThread(rootRng, tileInfo.tileNumber);
-    }
-    me_->progress.tilesTarget = tiling.size();
-    me_->progress.primaryRaysTarget = fb.width() * fb.height() * me_->options.samplesAA;
+    auto const &options = me_->options;
+    auto const tileSize = options.tileSize;
+    FrameTiling tiling(PixelRect(fb.width(), fb.height()), PixelRect{tileSize, tileSize});
+    std::size_t const pixels = static_cast<std::size_t>(fb.width()) * fb.height();
+    me_->progress.primaryRaysTarget = static_cast<int64_t>(pixels) * options.samplesAA;
+
+    // Without adaptive sampling or progressive passes, there is only the one pass, unless there is
+    // a time budget: a single pass cut short would leave the tiles it didn't get to black.
+    bool const adaptive = options.adaptiveErrorTarget > 0.0f;
+    bool const timedPasses = options.progressiveSamples <= 0 && options.timeBudget > 0.0;
+    bool const progressive = !adaptive && (options.progressiveSamples > 0 || timedPasses);
+    auto const samplesAA = static_cast<uint32_t>(options.samplesAA);
+    auto const minSamples =
+        std::clamp(options.adaptiveMinSamples, 2, std::max(options.adaptiveMaxSamples, 2));
+    auto const passSamples =
+        progressive ? std::min(timedPasses ? TimeBudgetPassSamples
+                                           : static_cast<uint32_t>(options.progressiveSamples),
+                               samplesAA)
+                    : samplesAA;
+    auto const firstPassSamples = adaptive ? static_cast<uint32_t>(minSamples) : passSamples;
+    FrameLight frame(pixels);
+    FramePass pass{std::vector<uint32_t>(pixels, 0),
+                   std::vector<uint32_t>(pixels, firstPassSamples)};
+    std::size_t const budget = pixels * static_cast<std::size_t>(options.samplesAA);
+    std::size_t spent = 0;
+
+    auto const renderStart = std::chrono::steady_clock::now();
+    auto const elapsed = [&] {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - renderStart)
+            .count();
+    };
+    std::atomic_bool outOfTime = false;
+    // Only changes between passes.
+    RenderProgress report;
 
     tbb::task_group renderTaskGroup;
+    auto taskStatus = tbb::not_complete;
+    for (int passNumber = 1;; passNumber++) {
+        me_->progress.tilesTarget = tiling.size();
+        me_->progress.tilesCompleted = 0;
+        std::atomic<std::size_t> passSpent = 0;
+        std::atomic<std::size_t> passInvalid = 0;
+        taskStatus = renderTaskGroup.run_and_wait([&] {
+            tbb::parallel_for_each(
+                std::begin(tiling), std::end(tiling), [&](TileInfo &tileInfo) -> void {
+                    // Tiles that have started are always finished, so no samples are thrown away.
+                    // The first pass is always finished too, so there is a whole image to save.
+                    if (options.timeBudget > 0.0 && passNumber > 1 &&
+                        elapsed() >= options.timeBudget) {
+                        outOfTime = true;
+                        renderTaskGroup.cancel();
+                        return;
+                    }
+                    auto threadName = fmt::format("tile thread {}", tileInfo.tileNumber);
+                    loguru::set_thread_name(threadName.c_str());
 
-    auto taskStatus = renderTaskGroup.run_and_wait([&] {
-        tbb::parallel_for_each(
-            std::begin(tiling), std::end(tiling), [&](TileInfo &tileInfo) -> void {
-                auto threadName = fmt::format("tile thread {}", tileInfo.tileNumber);
-                loguru::set_thread_name(threadName.c_str());
-
-                integrateTile(tileInfo, me_->options, me_->scene, fb);
-                me_->progress.tilesCompleted++;
-                me_->progress.primayRaysTraced += tileInfo.bounds.area() * me_->options.samplesAA;
-                if (onProgress({}, RenderStatus::Running) != RenderCommand::Continue) {
-                    tbb::task::self().cancel_group_execution();
-                }
-                auto percentComplete = 100.0f * static_cast<float>(me_->progress.tilesCompleted) /
-                                       me_->progress.tilesTarget;
-                if (static_cast<int>(percentComplete * 10) % 5 == 0)
-                    LOG_F(INFO, "{:1.1f}% done..", percentComplete);
-            });
-    });
+                    TileLight light(tileInfo, fb.width(), pass, adaptive);
+                    if (options.integrator == Integrator::Wavefront)
+                        integrateTileWavefront(tileInfo, options, me_->scene, fb, light);
+                    else
+                        integrateTile(tileInfo, options, me_->scene, fb, light);
+                    light.finish(frame, fb);
+                    passSpent += light.samples();
+                    passInvalid += light.invalidSamples();
+                    me_->progress.tilesCompleted++;
+                    me_->progress.primayRaysTraced += static_cast<int64_t>(light.samples());
+                    if (onProgress(report, RenderStatus::Running) != RenderCommand::Continue) {
+                        renderTaskGroup.cancel();
+                    }
+                    auto percentComplete = 100.0f *
+                                           static_cast<float>(me_->progress.tilesCompleted) /
+                                           me_->progress.tilesTarget;
+                    if (static_cast<int>(percentComplete * 10) % 5 == 0)
+                        LOG_F(INFO, "{:1.1f}% done..", percentComplete);
+                });
+        });
+        spent += passSpent;
+        if (passInvalid > 0)
+            LOG_F(ERROR,
+                  "Pass {}: {} samples had NaN or negative light, and were counted as black.",
+                  passNumber,
+                  passInvalid.load());
+        if (taskStatus == tbb::canceled)
+            break;
+        report.passesCompleted = passNumber;
+        report.relativeMSE = relativeMSE(frame);
+        LOG_F(INFO, "Pass {} done, relative MSE {:.3g}", passNumber, report.relativeMSE);
+        if (!(adaptive || progressive))
+            break;
+        if (options.convergenceTarget > 0.0f && report.relativeMSE <= options.convergenceTarget) {
+            LOG_F(INFO, "Converged to a relative MSE of {}.", options.convergenceTarget);
+            break;
+        }
 
-    if (taskStatus == tbb::canceled)
+        pass.first = frame.samples;
+        std::size_t planned = 0;
+        if (adaptive) {
+            planned = planAdaptivePass(frame.luminance,
+                                       static_cast<std::size_t>(fb.width()),
+                                       options,
+                                       budget - std::min(spent, budget),
+                                       pass.count);
+        } else {
+            for (std::size_t p = 0; p != pixels; p++) {
+                auto const left = samplesAA - std::min(frame.samples[p], samplesAA);
+                pass.count[p] = std::min(passSamples, left);
+                planned += pass.count[p];
+            }
+        }
+        if (planned == 0)
+            break;
+        auto const perPixel = static_cast<double>(spent) / static_cast<double>(pixels);
+        if (adaptive) {
+            auto const noisy = std::count_if(
+                std::begin(pass.count), std::end(pass.count), [](uint32_t c) { return c > 0; });
+            LOG_F(INFO,
+                  "Adaptive pass {}: {} samples for {} pixels, {:.1f} per pixel so far",
+                  passNumber + 1,
+                  planned,
+                  noisy,
+                  perPixel);
+        } else {
+            LOG_F(INFO,
+                  "Progressive pass {}: {:.1f} samples per pixel so far, {:.1f} s",
+                  passNumber + 1,
+                  perPixel,
+                  elapsed());
+        }
+    }
+
+    if (outOfTime)
+        LOG_F(INFO,
+              "Time budget used up after {:.1f} samples per pixel.",
+              static_cast<double>(spent) / static_cast<double>(pixels));
+    else if (taskStatus == tbb::canceled)
         LOG_F(WARNING, "Render was aborted.");
-    onProgress({}, (taskStatus == tbb::canceled) ? RenderStatus::Aborted : RenderStatus::Running);
+    bool const aborted = taskStatus == tbb::canceled && !outOfTime;
+    onProgress(report, aborted ? RenderStatus::Aborted : RenderStatus::Running);
 
     // LOG_F(INFO, "Render took {} s", renderTimer.elapsed());
-    LOG_F(INFO, "Saving image.");
-    saveImage(fb);
+}
+
+auto RenderSession::saveImage(std::filesystem::path const &path) const -> void {
+    LOG_F(INFO, "Saving image to {}.", path.string());
+    cornelis::saveImage(me_->fb, me_->options.mathAccuracy, path);
 }
 } // namespace cornelis
\ No newline at end of file
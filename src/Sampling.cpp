@@ -0,0 +1,301 @@
+#include <algorithm>
+#include <array>
+#include <bit>
+
+#include <cornelis/Sampling.hpp>
+
+#include "Simd.hpp"
+
+namespace cornelis {
+namespace {
+constexpr uint32_t SobolComponents = 4;
+
+// The generator matrices of the first four dimensions of the Sobol sequence, one column per bit of
+// the index, with the first row in the top bit. The first dimension is the van der Corput sequence,
+// the others come from the primitive polynomials and initial direction numbers of Joe and Kuo
+// (new-joe-kuo-6.21201).
+constexpr auto sobolMatrices() -> std::array<std::array<uint32_t, 32>, SobolComponents> {
+    struct Polynomial {
+        uint32_t degree;
+        uint32_t coefficients;
+        std::array<uint32_t, 3> initial;
+    };
+    constexpr Polynomial polynomials[SobolComponents - 1] = {
+        {1, 0, {1, 0, 0}}, {2, 1, {1, 3, 0}}, {3, 1, {1, 3, 1}}};
+
+    std::array<std::array<uint32_t, 32>, SobolComponents> matrices{};
+    for (uint32_t b = 0; b < 32; b++)
+        matrices[0][b] = 1u << (31 - b);
+    for (uint32_t d = 1; d < SobolComponents; d++) {
+        auto const &p = polynomials[d - 1];
+        auto &v = matrices[d];
+        for (uint32_t b = 0; b < p.degree; b++)
+            v[b] = p.initial[b] << (31 - b);
+        for (uint32_t b = p.degree; b < 32; b++) {
+            v[b] = v[b - p.degree] ^ (v[b - p.degree] >> p.degree);
+            for (uint32_t k = 1; k < p.degree; k++) {
+                if ((p.coefficients >> (p.degree - 1 - k)) & 1)
+                    v[b] ^= v[b - k];
+            }
+        }
+    }
+    return matrices;
+}
+
+constexpr auto SobolMatrices = sobolMatrices();
+
+auto reverseBits(uint32_t x) -> uint32_t {
+    x = ((x >> 1) & 0x55555555u) | ((x & 0x55555555u) << 1);
+    x = ((x >> 2) & 0x33333333u) | ((x & 0x33333333u) << 2);
+    x = ((x >> 4) & 0x0f0f0f0fu) | ((x & 0x0f0f0f0fu) << 4);
+    x = ((x >> 8) & 0x00ff00ffu) | ((x & 0x00ff00ffu) << 8);
+    return (x >> 16) | (x << 16);
+}
+
+// A hash where every bit only depends on the bits below it, from Burley's paper. Applied to
+// reversed bits, it is an Owen scrambling.
+auto laineKarras(uint32_t x, uint32_t seed) -> uint32_t {
+    x += seed;
+    x ^= x * 0x6c50b47cu;
+    x ^= x * 0xb82f1e52u;
+    x ^= x * 0xc7afe638u;
+    x ^= x * 0x8d22f6e6u;
+    return x;
+}
+
+auto nestedUniformScramble(uint32_t x, uint32_t seed) -> uint32_t {
+    return reverseBits(laineKarras(reverseBits(x), seed));
+}
+
+// The seed of the set of dimensions that dimension is in, for a pixel. The components of a set
+// use seeds derived from it, see sobolSample.
+auto setSeed(uint32_t seed, uint32_t pixel, uint32_t dimension) -> uint32_t {
+    return detail::hash32(detail::hash32(seed + pixel) + dimension / dimension::PerSet);
+}
+
+// Dimension of the sample of a pixel, from the PMJ02 tables. The dimensions of a set go in pairs,
+// and each pair gets its own table for every PMJ02TableSize samples. The pairs of a pixel take
+// consecutive tables from a random start, and each shuffles the order of the points its own way,
+// like sobolSample does. The points are then flipped with a random xor, a digital shift, which
+// moves the strata of the table around without breaking them up.
+auto pmj02Sample(uint32_t seed, uint32_t pixel, uint32_t sample, uint32_t dimension) -> float {
+    static_assert((PMJ02TableSize & (PMJ02TableSize - 1)) == 0 &&
+                  (PMJ02TableCount & (PMJ02TableCount - 1)) == 0);
+    uint32_t const run = detail::hash32(detail::hash32(seed + pixel) + sample / PMJ02TableSize);
+    uint32_t const pair = dimension / 2;
+    uint32_t const pairSeed = detail::hash32(run + pair);
+    // Bit i of the shuffled index depends on bits i and up of sample, not just the low bits. That's
+    // fine, as run changes every PMJ02TableSize samples, so the high bits are the same within a
+    // run: its samples take every point of the table once, and every aligned power of two prefix
+    // of them takes an aligned run of the table, which is stratified as well.
+    uint32_t const index = nestedUniformScramble(sample, pairSeed) & (PMJ02TableSize - 1);
+    auto const point = pmj02Point((run + pair) & (PMJ02TableCount - 1), index);
+    uint32_t const x = point[dimension & 1] ^ detail::hash32(pairSeed + 1 + (dimension & 1));
+    return static_cast<float>(x >> 8) * 0x1.0p-24f;
+}
+
+#if CORNELIS_SIMD_WIDTH > 1
+using simd::intv;
+
+// The functions above, lane by lane. See simd::shiftRight for the shifts.
+auto reverseBits(intv x) -> intv {
+    auto swap = [](intv const &v, int32_t n, uint32_t mask) {
+        intv const m(static_cast<int32_t>(mask));
+        return (simd::shiftRight(v, n) & m) | ((v & m) << n);
+    };
+    x = swap(x, 1, 0x55555555u);
+    x = swap(x, 2, 0x33333333u);
+    x = swap(x, 4, 0x0f0f0f0fu);
+    x = swap(x, 8, 0x00ff00ffu);
+    return simd::shiftRight(x, 16) | (x << 16);
+}
+
+auto laineKarras(intv x, intv const &seed) -> intv {
+    x = x + seed;
+    x = x ^ (x * intv(0x6c50b47c));
+    x = x ^ (x * intv(static_cast<int32_t>(0xb82f1e52u)));
+    x = x ^ (x * intv(static_cast<int32_t>(0xc7afe638u)));
+    x = x ^ (x * intv(static_cast<int32_t>(0x8d22f6e6u)));
+    return x;
+}
+
+auto nestedUniformScramble(intv const &x, intv const &seed) -> intv {
+    return reverseBits(laineKarras(reverseBits(x), seed));
+}
+
+// sobolSample for a component that is the same in every lane.
+auto sobolSample(intv index, uint32_t component, intv const &seed) -> simd::floatv {
+    index = nestedUniformScramble(index, seed);
+    auto const &matrix = SobolMatrices[component];
+    intv x(0);
+    for (int32_t b = 0; b < 32; b++) {
+        intv const bit = simd::shiftRight(index, b) & intv(1);
+        x = x ^ ((intv(0) - bit) & intv(static_cast<int32_t>(matrix[b])));
+    }
+    x = nestedUniformScramble(x, simd::hash32(seed + intv(static_cast<int32_t>(component + 1))));
+    return xsimd::to_float(simd::shiftRight(x, 8)) * 0x1.0p-24f;
+}
+#endif
+
+// pmj02Sample for every k in ids. The keys are hashed in SIMD lanes, and only the table lookups are
+// done one lane at a time.
+auto pmj02SampleWide(uint32_t seed,
+                     span<const uint32_t> pixels,
+                     span<const uint32_t> samples,
+                     span<const uint32_t> dimensions,
+                     span<const std::size_t> ids,
+                     span<float> out) -> void {
+    std::size_t i = 0;
+#if CORNELIS_SIMD_WIDTH > 1
+    using simd::Width;
+    constexpr int32_t TableBits = std::countr_zero(PMJ02TableSize);
+    for (; i + Width <= ids.size(); i += Width) {
+        simd::RayBlock block(&ids[i]);
+        intv const sample = block.load(samples);
+        intv const dimension = block.load(dimensions);
+        intv const run = simd::hash32(
+            simd::hash32(intv(static_cast<int32_t>(seed)) + block.load(pixels)) +
+            simd::shiftRight(sample, TableBits));
+        intv const pair = simd::shiftRight(dimension, 1);
+        intv const pairSeed = simd::hash32(run + pair);
+        intv const component = dimension & intv(1);
+
+        alignas(32) int32_t index[Width], table[Width], shift[Width], c[Width];
+        (nestedUniformScramble(sample, pairSeed) & intv(PMJ02TableSize - 1)).store_aligned(index);
+        ((run + pair) & intv(PMJ02TableCount - 1)).store_aligned(table);
+        simd::hash32(pairSeed + intv(1) + component).store_aligned(shift);
+        component.store_aligned(c);
+        for (std::size_t l = 0; l < Width; l++) {
+            auto const point = pmj02Point(table[l], index[l]);
+            uint32_t const x = point[c[l]] ^ static_cast<uint32_t>(shift[l]);
+            out[block.ids[l]] = static_cast<float>(x >> 8) * 0x1.0p-24f;
+        }
+    }
+#endif
+    for (auto k : ids.subspan(i))
+        out[k] = pmj02Sample(seed, pixels[k], samples[k], dimensions[k]);
+}
+} // namespace
+
+auto sobolSample(uint32_t index, uint32_t component, uint32_t seed) -> float {
+    index = nestedUniformScramble(index, seed);
+    auto const &matrix = SobolMatrices[component];
+    uint32_t x = 0;
+    for (uint32_t b = 0; b < 32; b++)
+        x ^= matrix[b] & (0u - ((index >> b) & 1u));
+    x = nestedUniformScramble(x, detail::hash32(seed + component + 1));
+    return static_cast<float>(x >> 8) * 0x1.0p-24f;
+}
+
+Sampler::Sampler(SamplePattern pattern,
+                 uint32_t frameWidth,
+                 uint32_t samplesPerPixel,
+                 uint32_t seed)
+    : pattern_(pattern), seed_(seed), frameWidth_(std::max(frameWidth, 1u)),
+      blockSize_(std::bit_ceil(std::max(samplesPerPixel, 1u))) {
+    if (pattern_ == SamplePattern::BlueNoise)
+        ordering_ = &defaultBlueNoiseOrdering();
+}
+
+auto Sampler::sobolKey(uint32_t pixel, uint32_t sample, uint32_t dimension) const
+    -> std::array<uint32_t, 2> {
+    if (pattern_ == SamplePattern::Sobol)
+        return {sample, setSeed(seed_, pixel, dimension)};
+
+    // Each square of the frame that the ordering covers shares one sequence. The pixels take
+    // blocks of blockSize points from it, in the order of their ranks. The ordering is
+    // hierarchical, so the pixels of any aligned square of 2^k by 2^k pixels take consecutive
+    // blocks, and their points together are stratified as a whole. Close pixels get complementary
+    // samples and their errors tend to cancel out, which pushes the error to high frequencies.
+    // Samples past the first block take the same place in later blocks, with another scrambling
+    // each time. See BlueNoiseOrdering.
+    uint32_t const x = pixel % frameWidth_, y = pixel / frameWidth_;
+    uint32_t const size = ordering_->size();
+    uint32_t const square = detail::hash32(detail::hash32(seed_ + x / size) + y / size);
+    uint32_t const round = detail::hash32(square + sample / blockSize_);
+    uint32_t seed = detail::hash32(round + dimension / dimension::PerSet);
+    // With many samples per pixel, the blocks of a square run past the 2^32 points of the
+    // sequence. The pixels past the end start over with a scrambling of their own, rather than
+    // take the points of a pixel before them.
+    uint64_t const index = uint64_t(ordering_->rank(x, y)) * blockSize_ + sample % blockSize_;
+    if (uint32_t const wraps = static_cast<uint32_t>(index >> 32))
+        seed = detail::hash32(seed + wraps);
+    return {static_cast<uint32_t>(index), seed};
+}
+
+auto Sampler::operator()(uint32_t pixel, uint32_t sample, uint32_t dimension) const -> float {
+    switch (pattern_) {
+    case SamplePattern::Random:
+        return sampleRandom(seed_, pixel, sample, dimension);
+    case SamplePattern::Sobol:
+    case SamplePattern::BlueNoise: {
+        auto const [index, seed] = sobolKey(pixel, sample, dimension);
+        return sobolSample(index, dimension % dimension::PerSet, seed);
+    }
+    case SamplePattern::PMJ02:
+        return pmj02Sample(seed_, pixel, sample, dimension);
+    }
+    return 0.0f;
+}
+
+auto Sampler::sampleWide(span<const uint32_t> pixels,
+                         span<const uint32_t> samples,
+                         span<const uint32_t> dimensions,
+                         span<const std::size_t> ids,
+                         span<float> out) const -> void {
+    if (pattern_ == SamplePattern::Random) {
+        sampleRandomWide(seed_, pixels, samples, dimensions, ids, out);
+        return;
+    }
+    if (pattern_ == SamplePattern::PMJ02) {
+        pmj02SampleWide(seed_, pixels, samples, dimensions, ids, out);
+        return;
+    }
+
+    std::size_t i = 0;
+#if CORNELIS_SIMD_WIDTH > 1
+    using simd::Width;
+    simd::boolv const all(true);
+    for (; i + Width <= ids.size(); i += Width) {
+        simd::RayBlock block(&ids[i]);
+        // A batch nearly always asks for the same component in every lane, like the russian
+        // roulette number of each path. Blocks that don't are done one lane at a time.
+        uint32_t const component = dimensions[block.ids[0]] % dimension::PerSet;
+        bool sameComponent = true;
+        for (std::size_t l = 1; l < Width; l++)
+            sameComponent =
+                sameComponent && dimensions[block.ids[l]] % dimension::PerSet == component;
+        if (!sameComponent) {
+            for (std::size_t l = 0; l < Width; l++) {
+                auto const k = block.ids[l];
+                out[k] = (*this)(pixels[k], samples[k], dimensions[k]);
+            }
+            continue;
+        }
+
+        intv index, seed;
+        if (pattern_ == SamplePattern::Sobol) {
+            // See setSeed.
+            intv const set = simd::shiftRight(block.load(dimensions), 2);
+            static_assert(dimension::PerSet == 4);
+            index = block.load(samples);
+            seed = simd::hash32(
+                simd::hash32(intv(static_cast<int32_t>(seed_)) + block.load(pixels)) + set);
+        } else {
+            alignas(32) int32_t indices[Width], seeds[Width];
+            for (std::size_t l = 0; l < Width; l++) {
+                auto const k = block.ids[l];
+                auto const key = sobolKey(pixels[k], samples[k], dimensions[k]);
+                indices[l] = static_cast<int32_t>(key[0]);
+                seeds[l] = static_cast<int32_t>(key[1]);
+            }
+            index.load_aligned(indices);
+            seed.load_aligned(seeds);
+        }
+        block.store(out, sobolSample(index, component, seed), all);
+    }
+#endif
+    for (auto k : ids.subspan(i))
+        out[k] = (*this)(pixels[k], samples[k], dimensions[k]);
+}
+} // namespace cornelis
@@ -1,7 +1,486 @@
+#include <algorithm>
+#include <chrono>
+#include <optional>
+
+#include <tbb/parallel_invoke.h>
+
+#include <cornelis/Color.hpp>
 #include <cornelis/Expects.hpp>
 #include <cornelis/Scene.hpp>
 
+#include "Simd.hpp"
+
 namespace cornelis {
+namespace {
+auto getTangentSpans(PlaneData &planes) -> SoATuple3f {
+    return {
+        planes.get<tags::TangentX>(), planes.get<tags::TangentY>(), planes.get<tags::TangentZ>()};
+}
+
+auto getBitangentSpans(PlaneData &planes) -> SoATuple3f {
+    return {planes.get<tags::BitangentX>(),
+            planes.get<tags::BitangentY>(),
+            planes.get<tags::BitangentZ>()};
+}
+
+// Bounds for all primitives, numbered as described in SceneData::isSphere.
+auto primitiveBounds(SphereData &spheres, PlaneData &planes) -> std::vector<AABB> {
+    std::vector<AABB> bounds;
+
+    auto [Sx, Sy, Sz] = getPositions(spheres);
+    auto radius = spheres.get<tags::Radius>();
+    for (std::size_t i = 0; i != Sx.size(); i++) {
+        float3 center{Sx[i], Sy[i], Sz[i]};
+        float3 r{radius[i]};
+        bounds.push_back({center - r, center + r});
+    }
+
+    auto [Px, Py, Pz] = getPositions(planes);
+    auto [Tx, Ty, Tz] = getTangentSpans(planes);
+    auto [Bx, By, Bz] = getBitangentSpans(planes);
+    auto invHalfWidths = planes.get<tags::InvHalfWidthF>();
+    auto invHalfHeights = planes.get<tags::InvHalfHeightF>();
+    for (std::size_t i = 0; i != Px.size(); i++) {
+        // intersectPlaneWide bounds the plane in its tangent frame, so we do the same.
+        float3 T{Tx[i], Ty[i], Tz[i]};
+        float3 B{Bx[i], By[i], Bz[i]};
+        float3 halfT = T * (1.0f / invHalfWidths[i]);
+        float3 halfB = B * (1.0f / invHalfHeights[i]);
+        float3 extent{RayEpsilon};
+        for (std::size_t c = 0; c < 3; c++)
+            extent(c) += abs(halfT(c)) + abs(halfB(c));
+        float3 P{Px[i], Py[i], Pz[i]};
+        bounds.push_back({P - extent, P + extent});
+    }
+    return bounds;
+}
+
+// The primitives whose material emits light, see SceneData::lights.
+auto emitters(SceneDescription const &descr, SphereData &spheres, PlaneData &planes)
+    -> std::vector<uint32_t> {
+    auto const emits = [&](std::size_t material) {
+        return descr.materials()[material].emissive != RGB::black();
+    };
+    std::vector<uint32_t> lights;
+    auto const sphereMaterials = spheres.get<tags::MaterialId>();
+    auto const planeMaterials = planes.get<tags::MaterialId>();
+    for (std::size_t i = 0; i != sphereMaterials.size(); i++) {
+        if (emits(sphereMaterials[i]))
+            lights.push_back(static_cast<uint32_t>(i));
+    }
+    for (std::size_t i = 0; i != planeMaterials.size(); i++) {
+        if (emits(planeMaterials[i]))
+            lights.push_back(static_cast<uint32_t>(sphereMaterials.size() + i));
+    }
+    return lights;
+}
+
+// The bounds of a light for the light BVH. The lights emit the same radiance everywhere and in
+// every direction, so their power is pi times the luminance of that over their area, and twice
+// that for the planes, which emit from both sides.
+auto boundsOfLight(SceneDescription const &descr,
+                   SphereData &spheres,
+                   PlaneData &planes,
+                   span<const AABB> bounds,
+                   uint32_t light) -> LightBounds {
+    auto const sphereCount = spheres.get<tags::Radius>().size();
+    if (light < sphereCount) {
+        float const radius = spheres.get<tags::Radius>()[light];
+        auto const &emissive = descr.materials()[spheres.get<tags::MaterialId>()[light]].emissive;
+        float const L = luminance(emissive);
+        // Spheres emit in every direction, so the cone of normals is the whole sphere.
+        return {.bounds = bounds[light],
+                .power = Pi * L * 4.0f * Pi * radius * radius,
+                .axis = float3{0.0f, 0.0f, 1.0f},
+                .cosThetaO = -1.0f,
+                .cosThetaE = 0.0f,
+                .twoSided = false};
+    }
+    auto const i = light - sphereCount;
+    auto [Nx, Ny, Nz] = getNormalSpans(planes);
+    float const area = planes.get<tags::WidthF>()[i] * planes.get<tags::HeightF>()[i];
+    float const L = luminance(descr.materials()[planes.get<tags::MaterialId>()[i]].emissive);
+    return {.bounds = bounds[light],
+            .power = 2.0f * Pi * L * area,
+            .axis = float3{Nx[i], Ny[i], Nz[i]},
+            .cosThetaO = 1.0f,
+            .cosThetaE = 0.0f,
+            .twoSided = true};
+}
+
+// Intersects the rays with the primitives of a BVH leaf.
+auto intersectLeaf(SceneData &scene,
+                   uint32_t firstPrimitive,
+                   uint32_t count,
+                   SoATuple3f rayOrigins,
+                   SoATuple3f rayDirs,
+                   IntersectionData &data,
+                   span<const std::size_t> ids,
+                   RayDirections directions) -> void {
+    auto [Sx, Sy, Sz] = getPositions(scene.spheres);
+    auto radius = scene.spheres.get<tags::Radius>();
+    auto sphereMaterials = scene.spheres.get<tags::MaterialId>();
+    auto [Px, Py, Pz] = getPositions(scene.planes);
+    auto [PNx, PNy, PNz] = getNormalSpans(scene.planes);
+    auto [PTx, PTy, PTz] = getTangentSpans(scene.planes);
+    auto [PBx, PBy, PBz] = getBitangentSpans(scene.planes);
+    auto invHalfWidth = scene.planes.get<tags::InvHalfWidthF>();
+    auto invHalfHeight = scene.planes.get<tags::InvHalfHeightF>();
+    auto planeMaterials = scene.planes.get<tags::MaterialId>();
+
+    for (auto p = firstPrimitive; p != firstPrimitive + count; p++) {
+        auto i = scene.bvh.primitives[p];
+        if (scene.isSphere(i)) {
+            intersectSphereWide(rayOrigins,
+                                rayDirs,
+                                float3(Sx[i], Sy[i], Sz[i]),
+                                radius[i],
+                                sphereMaterials[i],
+                                i,
+                                data,
+                                ids,
+                                directions);
+        } else {
+            auto const j = i - static_cast<uint32_t>(Sx.size());
+            intersectPlaneWide(rayOrigins,
+                               rayDirs,
+                               float3(PNx[j], PNy[j], PNz[j]),
+                               float3(Px[j], Py[j], Pz[j]),
+                               float3(PTx[j], PTy[j], PTz[j]),
+                               float3(PBx[j], PBy[j], PBz[j]),
+                               invHalfWidth[j],
+                               invHalfHeight[j],
+                               planeMaterials[j],
+                               i,
+                               data,
+                               ids);
+        }
+    }
+}
+
+// Below this many rays, a packet is split up and the rays traverse the rest of the subtree on
+// their own. Filtering the ray list costs more than it saves at that point.
+constexpr std::size_t SingleRayThreshold = 4;
+
+// Conservative bounds on a packet of rays that share an origin: the range of the reciprocal
+// direction along each axis. Used to cull nodes that none of the rays can hit, without looking at
+// the rays one by one (interval arithmetic, as in Boulos et al. and Wald et al.)
+struct RayInterval {
+    float3 origin;
+    float3 dirMin;
+    float3 dirMax;
+    // Reciprocals of dirMax and dirMin, for the axes where the directions all have the same sign.
+    float3 invMin;
+    float3 invMax;
+    bool sameSign[3];
+};
+
+// Bounds the given rays, unless they start at different points.
+auto makeRayInterval(SoATuple3f rayOrigins, SoATuple3f rayDirs, span<const std::size_t> ids)
+    -> std::optional<RayInterval> {
+    auto [x, y, z] = rayOrigins;
+    auto [dx, dy, dz] = rayDirs;
+    auto const k0 = ids[0];
+    RayInterval packet{.origin = {x[k0], y[k0], z[k0]},
+                       .dirMin = float3{INFINITY},
+                       .dirMax = float3{-INFINITY},
+                       .invMin = float3{0.0f},
+                       .invMax = float3{0.0f},
+                       .sameSign = {false, false, false}};
+    for (auto k : ids) {
+        if (x[k] != x[k0] || y[k] != y[k0] || z[k] != z[k0])
+            return std::nullopt;
+        float const d[] = {dx[k], dy[k], dz[k]};
+        for (std::size_t i = 0; i < 3; i++) {
+            packet.dirMin(i) = std::min(packet.dirMin(i), d[i]);
+            packet.dirMax(i) = std::max(packet.dirMax(i), d[i]);
+        }
+    }
+    for (std::size_t i = 0; i < 3; i++) {
+        packet.sameSign[i] = packet.dirMin(i) > 0.0f || packet.dirMax(i) < 0.0f;
+        if (packet.sameSign[i]) {
+            packet.invMin(i) = 1.0f / packet.dirMax(i);
+            packet.invMax(i) = 1.0f / packet.dirMin(i);
+        }
+    }
+    return packet;
+}
+
+// True if no ray in the packet can pass through the box.
+auto missesAll(AABB const &box, RayInterval const &packet) -> bool {
+    float enter = 0.0f;
+    float exit = INFINITY;
+    for (std::size_t i = 0; i < 3; i++) {
+        if (!packet.sameSign[i]) {
+            // The rays go both ways along this axis. Only the ones heading towards the slab can
+            // reach it, and not before the fastest of them does.
+            float const o = packet.origin(i);
+            if (o < box.min(i))
+                enter = std::max(enter, (box.min(i) - o) / packet.dirMax(i));
+            else if (o > box.max(i))
+                enter = std::max(enter, (box.max(i) - o) / packet.dirMin(i));
+            continue;
+        }
+        // The reciprocals all have the same sign, so the same side of the slab is near for all
+        // of them.
+        bool const positive = packet.invMin(i) > 0.0f;
+        float const near = (positive ? box.min(i) : box.max(i)) - packet.origin(i);
+        float const far = (positive ? box.max(i) : box.min(i)) - packet.origin(i);
+        enter = std::max(enter, std::min(near * packet.invMin(i), near * packet.invMax(i)));
+        exit = std::min(exit, std::max(far * packet.invMin(i), far * packet.invMax(i)));
+    }
+    return enter > exit;
+}
+
+// The buffers of StreamTraversal. They are kept per thread and only ever grow, so that tracing a
+// batch doesn't allocate them again on every bounce.
+struct StreamBuffers {
+    // Reciprocal ray directions, indexed like the rays. Only those of the rays being traced are
+    // up to date.
+    std::vector<float3> invDirs;
+    // The ray lists of the nodes on the current path from the root, stored back to back.
+    std::vector<std::size_t> rayIds;
+    // Nodes left to visit by traceSingle.
+    std::vector<uint32_t> nodeStack;
+};
+
+// Traverses the BVH with a stream of rays. Each visited node filters the ray list of its parent
+// down to the rays that pass through its bounds, so only those rays continue to the children.
+//
+// When the rays form a packet, whole nodes are first culled against the bounds of the packet, and
+// once a node's list gets short the remaining rays finish the subtree one at a time.
+struct StreamTraversal {
+    SceneData &scene;
+    SoATuple3f rayOrigins;
+    SoATuple3f rayDirs;
+    IntersectionData &data;
+    RayDirections directions;
+    span<float> params;
+    // See StreamBuffers.
+    std::vector<float3> &invDirs;
+    std::vector<std::size_t> &rayIds;
+    std::vector<uint32_t> &nodeStack;
+    // Bounds on all the rays, if they form a packet.
+    std::optional<RayInterval> packet;
+
+    auto origin(std::size_t k) -> float3 {
+        auto [x, y, z] = rayOrigins;
+        return {x[k], y[k], z[k]};
+    }
+
+    // Visits the near child of node first, as seen from ray k.
+    auto orderChildren(BVHNode const &node, uint32_t index, std::size_t k)
+        -> std::pair<uint32_t, uint32_t> {
+        auto [dx, dy, dz] = rayDirs;
+        float const d[] = {dx[k], dy[k], dz[k]};
+        if (d[node.axis] < 0.0f)
+            return {node.offset, index + 1};
+        return {index + 1, node.offset};
+    }
+
+    // Traces ray k through the subtree below the interior node at index, which it is known to
+    // pass through.
+    auto traceSingle(uint32_t index, std::size_t k) -> void {
+        nodeStack.clear();
+        auto [nearChild, farChild] = orderChildren(scene.bvh.nodes[index], index, k);
+        nodeStack.push_back(farChild);
+        nodeStack.push_back(nearChild);
+        while (!nodeStack.empty()) {
+            auto const current = nodeStack.back();
+            nodeStack.pop_back();
+            auto const &node = scene.bvh.nodes[current];
+            if (!intersectsAABB(node.bounds, origin(k), invDirs[k], params[k]))
+                continue;
+            if (node.isLeaf()) {
+                intersectLeaf(scene,
+                              node.offset,
+                              node.count,
+                              rayOrigins,
+                              rayDirs,
+                              data,
+                              span<const std::size_t>(&k, 1),
+                              directions);
+            } else {
+                auto [near, far] = orderChildren(node, current, k);
+                nodeStack.push_back(far);
+                nodeStack.push_back(near);
+            }
+        }
+    }
+
+    auto visit(uint32_t index, std::size_t begin, std::size_t end) -> void {
+        auto const &node = scene.bvh.nodes[index];
+        if (packet && missesAll(node.bounds, *packet))
+            return;
+        auto const first = rayIds.size();
+        for (auto i = begin; i != end; i++) {
+            auto k = rayIds[i];
+            if (intersectsAABB(node.bounds, origin(k), invDirs[k], params[k]))
+                rayIds.push_back(k);
+        }
+        auto const last = rayIds.size();
+
+        if (first != last) {
+            if (node.isLeaf()) {
+                intersectLeaf(scene,
+                              node.offset,
+                              node.count,
+                              rayOrigins,
+                              rayDirs,
+                              data,
+                              span<const std::size_t>(rayIds).subspan(first, last - first),
+                              directions);
+            } else if (packet && last - first < SingleRayThreshold) {
+                for (auto i = first; i != last; i++)
+                    traceSingle(index, rayIds[i]);
+            } else {
+                // Visit the child nearest to the (first) ray first, so the far child can be culled
+                // by the hits found in the near one.
+                auto [nearChild, farChild] = orderChildren(node, index, rayIds[first]);
+                visit(nearChild, first, last);
+                visit(farChild, first, last);
+            }
+        }
+        rayIds.resize(first);
+    }
+};
+
+auto traceStream(SceneData &scene,
+                 SoATuple3f rayOrigins,
+                 SoATuple3f rayDirs,
+                 IntersectionData &data,
+                 span<const std::size_t> activeRayIds,
+                 RayDirections directions,
+                 std::optional<RayInterval> packet) -> void {
+    if (scene.bvh.empty() || activeRayIds.empty())
+        return;
+
+    thread_local StreamBuffers buffers;
+    auto [dx, dy, dz] = rayDirs;
+    if (buffers.invDirs.size() < dx.size())
+        buffers.invDirs.resize(dx.size());
+    for (auto k : activeRayIds)
+        buffers.invDirs[k] = float3{1.0f / dx[k], 1.0f / dy[k], 1.0f / dz[k]};
+
+    StreamTraversal traversal{.scene = scene,
+                              .rayOrigins = rayOrigins,
+                              .rayDirs = rayDirs,
+                              .data = data,
+                              .directions = directions,
+                              .params = data.get<tags::RayParam0>(),
+                              .invDirs = buffers.invDirs,
+                              .rayIds = buffers.rayIds,
+                              .nodeStack = buffers.nodeStack,
+                              .packet = packet};
+
+    traversal.rayIds.assign(std::begin(activeRayIds), std::end(activeRayIds));
+    traversal.visit(0, 0, activeRayIds.size());
+}
+
+// Slab test between a ray and all the children of a wide node. Writes the distance at which the
+// ray enters each child to tNear, or INFINITY for the children it misses.
+auto intersectChildren(WideBVHNode const &node,
+                       float3 const &origin,
+                       float3 const &invDir,
+                       float tMax,
+                       float *tNear) -> void {
+#if CORNELIS_SIMD_WIDTH > 1
+    using simd::floatv;
+    static_assert(WideBVHNode::Width % simd::Width == 0);
+
+    floatv const ox(origin(0)), oy(origin(1)), oz(origin(2));
+    floatv const idx(invDir(0)), idy(invDir(1)), idz(invDir(2));
+    for (std::size_t c = 0; c < WideBVHNode::Width; c += simd::Width) {
+        floatv const t0x = (floatv(&node.minX[c], xsimd::aligned_mode()) - ox) * idx;
+        floatv const t1x = (floatv(&node.maxX[c], xsimd::aligned_mode()) - ox) * idx;
+        floatv const t0y = (floatv(&node.minY[c], xsimd::aligned_mode()) - oy) * idy;
+        floatv const t1y = (floatv(&node.maxY[c], xsimd::aligned_mode()) - oy) * idy;
+        floatv const t0z = (floatv(&node.minZ[c], xsimd::aligned_mode()) - oz) * idz;
+        floatv const t1z = (floatv(&node.maxZ[c], xsimd::aligned_mode()) - oz) * idz;
+        floatv const enter = xsimd::max(
+            xsimd::max(xsimd::min(t0x, t1x), xsimd::min(t0y, t1y)),
+            xsimd::max(xsimd::min(t0z, t1z), floatv(0.0f)));
+        floatv const exit = xsimd::min(
+            xsimd::min(xsimd::max(t0x, t1x), xsimd::max(t0y, t1y)),
+            xsimd::min(xsimd::max(t0z, t1z), floatv(tMax)));
+        xsimd::select(enter <= exit, enter, floatv(INFINITY)).store_unaligned(&tNear[c]);
+    }
+#else
+    for (std::size_t c = 0; c < WideBVHNode::Width; c++) {
+        AABB box{{node.minX[c], node.minY[c], node.minZ[c]},
+                 {node.maxX[c], node.maxY[c], node.maxZ[c]}};
+        float enter = 0.0f;
+        for (std::size_t i = 0; i < 3; i++) {
+            float t0 = (box.min(i) - origin(i)) * invDir(i);
+            float t1 = (box.max(i) - origin(i)) * invDir(i);
+            enter = std::max(enter, std::min(t0, t1));
+        }
+        tNear[c] = intersectsAABB(box, origin, invDir, tMax) ? enter : INFINITY;
+    }
+#endif
+}
+
+// Traverses the wide BVH with one ray at a time. The children of a node that the ray passes
+// through are pushed on the stack farthest first, so they are visited in order of distance.
+struct WideTraversal {
+    struct Entry {
+        float tNear;
+        uint32_t offset;
+        // Zero for interior nodes, as in WideBVHNode.
+        uint16_t count;
+    };
+
+    SceneData &scene;
+    SoATuple3f rayOrigins;
+    SoATuple3f rayDirs;
+    IntersectionData &data;
+    RayDirections directions;
+    std::vector<Entry> stack;
+
+    auto trace(std::size_t k) -> void {
+        auto [x, y, z] = rayOrigins;
+        auto [dx, dy, dz] = rayDirs;
+        float3 const origin{x[k], y[k], z[k]};
+        float3 const invDir{1.0f / dx[k], 1.0f / dy[k], 1.0f / dz[k]};
+        auto params = data.get<tags::RayParam0>();
+
+        stack.clear();
+        stack.push_back({0.0f, 0, 0});
+        while (!stack.empty()) {
+            auto const entry = stack.back();
+            stack.pop_back();
+            // Something closer may have been hit since this was pushed.
+            if (entry.tNear > params[k])
+                continue;
+            if (entry.count > 0) {
+                intersectLeaf(scene,
+                              entry.offset,
+                              entry.count,
+                              rayOrigins,
+                              rayDirs,
+                              data,
+                              span<const std::size_t>(&k, 1),
+                              directions);
+                continue;
+            }
+
+            auto const &node = scene.wideBvh.nodes[entry.offset];
+            alignas(32) float tNear[WideBVHNode::Width];
+            intersectChildren(node, origin, invDir, params[k], tNear);
+
+            auto const first = stack.size();
+            for (std::size_t c = 0; c < node.numChildren; c++) {
+                if (tNear[c] < INFINITY)
+                    stack.push_back({tNear[c], node.offset[c], node.count[c]});
+            }
+            std::sort(std::begin(stack) + first, std::end(stack), [](auto &a, auto &b) {
+                return a.tNear > b.tNear;
+            });
+        }
+    }
+};
+} // namespace
+
 SphereData::SphereData(span<const SphereDescription> descriptions)
     : SoAObject(descriptions.size()) {
     auto [x, y, z] = getPositions(*this);
@@ -23,33 +502,159 @@ PlaneData::PlaneData(span<const PlaneDescription> descriptions) : SoAObject(desc
     auto widths = get<tags::WidthF>();
     auto heights = get<tags::HeightF>();
     auto materialId = get<tags::MaterialId>();
+    auto [Tx, Ty, Tz] = getTangentSpans(*this);
+    auto [Bx, By, Bz] = getBitangentSpans(*this);
+    auto invHalfWidths = get<tags::InvHalfWidthF>();
+    auto invHalfHeights = get<tags::InvHalfHeightF>();
     for (std::size_t i = 0; i != descriptions.size(); i++) {
         auto const &descr = descriptions[i];
         x[i] = descr.point[0];
         y[i] = descr.point[1];
         z[i] = descr.point[2];
-        Nx[i] = descr.normal[0];
-        Ny[i] = descr.normal[1];
-        Nz[i] = descr.normal[2];
+        // The normal is made unit length, so that the tangent frame is too, and the pdfs of sampling
+        // plane lights come out right.
+        auto const N = normalize(float3{descr.normal[0], descr.normal[1], descr.normal[2]});
+        Nx[i] = N(0);
+        Ny[i] = N(1);
+        Nz[i] = N(2);
         widths[i] = descr.extents[0];
         heights[i] = descr.extents[1];
         materialId[i] = descr.material.value_or(0);
+
+        Basis b = constructBasis(N);
+        Tx[i] = b.T(0);
+        Ty[i] = b.T(1);
+        Tz[i] = b.T(2);
+        Bx[i] = b.B(0);
+        By[i] = b.B(1);
+        Bz[i] = b.B(2);
+        invHalfWidths[i] = 2.0f / widths[i];
+        invHalfHeights[i] = 2.0f / heights[i];
     }
 }
 
-SceneData::SceneData(SceneDescription const &descr)
+SceneData::SceneData(SceneDescription const &descr,
+                     BVHBuilder bvhBuilder,
+                     MathAccuracy mathAccuracy)
     : camera{PerspectiveCamera::lookAt(descr.camera().origin,
                                        descr.camera().lookAt,
                                        descr.camera().aspect,
                                        descr.camera().horizontalFov)},
       materials{}, spheres{descr.spheres()}, planes{descr.planes()} {
+    auto const bounds = primitiveBounds(spheres, planes);
+    tbb::parallel_invoke(
+        [&] {
+            auto bvhStart = std::chrono::steady_clock::now();
+            bvh = BVH(bounds, bvhBuilder);
+            wideBvh = WideBVH(bvh);
+            bvhBuildTime =
+                std::chrono::duration<double>(std::chrono::steady_clock::now() - bvhStart)
+                    .count();
+        },
+        [&] {
+            lights = emitters(descr, spheres, planes);
+            std::vector<LightBounds> lightBounds;
+            for (auto light : lights)
+                lightBounds.push_back(boundsOfLight(descr, spheres, planes, bounds, light));
+            lightBvh = LightBVH(lightBounds);
+        });
+
     for (auto &matDescr : descr.materials()) {
+        // Without albedo and reflection tint every lobe of the standard BRDF is black.
+        if (matDescr.albedo == RGB::black() && matDescr.reflectionTint == RGB::black()) {
+            materials.push_back(EmissiveMaterial(matDescr.emissive));
+            continue;
+        }
         materials.push_back(StandardMaterial(matDescr.albedo,
                                              matDescr.emissive,
                                              matDescr.reflectionTint,
                                              matDescr.roughness,
-                                             matDescr.ior));
+                                             matDescr.ior,
+                                             mathAccuracy));
+    }
+}
+
+auto sampleLight(SceneData &scene, uint32_t light, float3 const &P, float2 const &x)
+    -> ShapeSample {
+    if (scene.isSphere(light)) {
+        auto [Sx, Sy, Sz] = getPositions(scene.spheres);
+        float3 const center{Sx[light], Sy[light], Sz[light]};
+        return sampleSphere(P, center, scene.spheres.get<tags::Radius>()[light], x);
     }
+    auto const i = light - scene.spheres.get<tags::Radius>().size();
+    auto &planes = scene.planes;
+    auto [Px, Py, Pz] = getPositions(planes);
+    auto [Nx, Ny, Nz] = getNormalSpans(planes);
+    auto [Tx, Ty, Tz] = getTangentSpans(planes);
+    auto [Bx, By, Bz] = getBitangentSpans(planes);
+    return sampleRectangle(P,
+                           float3{Px[i], Py[i], Pz[i]},
+                           float3{Nx[i], Ny[i], Nz[i]},
+                           float3{Tx[i], Ty[i], Tz[i]},
+                           float3{Bx[i], By[i], Bz[i]},
+                           planes.get<tags::WidthF>()[i],
+                           planes.get<tags::HeightF>()[i],
+                           x);
 }
 
+auto lightPdf(SceneData &scene, uint32_t light, float3 const &P, float3 const &wi, float distance)
+    -> float {
+    if (scene.isSphere(light)) {
+        auto [Sx, Sy, Sz] = getPositions(scene.spheres);
+        float3 const center{Sx[light], Sy[light], Sz[light]};
+        return sphereSamplePdf(P, center, scene.spheres.get<tags::Radius>()[light]);
+    }
+    auto const i = light - scene.spheres.get<tags::Radius>().size();
+    auto [Nx, Ny, Nz] = getNormalSpans(scene.planes);
+    return rectangleSamplePdf(wi,
+                              distance,
+                              float3{Nx[i], Ny[i], Nz[i]},
+                              scene.planes.get<tags::WidthF>()[i],
+                              scene.planes.get<tags::HeightF>()[i]);
+}
+
+auto intersectScene(SceneData &scene,
+                    SoATuple3f rayOrigins,
+                    SoATuple3f rayDirs,
+                    IntersectionData &data,
+                    span<const std::size_t> activeRayIds,
+                    RayDirections directions) -> void {
+    traceStream(scene, rayOrigins, rayDirs, data, activeRayIds, directions, std::nullopt);
+}
+
+auto intersectScenePacket(SceneData &scene,
+                          SoATuple3f rayOrigins,
+                          SoATuple3f rayDirs,
+                          IntersectionData &data,
+                          span<const std::size_t> activeRayIds,
+                          RayDirections directions) -> void {
+    if (activeRayIds.empty())
+        return;
+    traceStream(scene,
+                rayOrigins,
+                rayDirs,
+                data,
+                activeRayIds,
+                directions,
+                makeRayInterval(rayOrigins, rayDirs, activeRayIds));
+}
+
+auto intersectSceneWide(SceneData &scene,
+                        SoATuple3f rayOrigins,
+                        SoATuple3f rayDirs,
+                        IntersectionData &data,
+                        span<const std::size_t> activeRayIds,
+                        RayDirections directions) -> void {
+    if (scene.wideBvh.empty())
+        return;
+
+    WideTraversal traversal{.scene = scene,
+                            .rayOrigins = rayOrigins,
+                            .rayDirs = rayDirs,
+                            .data = data,
+                            .directions = directions,
+                            .stack = {}};
+    for (auto k : activeRayIds)
+        traversal.trace(k);
+}
 } // namespace cornelis
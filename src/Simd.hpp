@@ -0,0 +1,162 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+#include <xsimd/xsimd.hpp>
+
+#include <cornelis/Span.hpp>
+
+/*
+    The widest float batch we can use, and helpers for loading and storing SoA fields through lists
+    of ray ids. Kernels built on this should also have a scalar version, which handles everything
+    when CORNELIS_SIMD_WIDTH is 1. Whatever is left over after the full batches goes either to the
+    scalar version, which must then round exactly like the lanes, or through forEachBlock.
+*/
+#if defined(XSIMD_X86_AVX_VERSION_AVAILABLE)
+#define CORNELIS_SIMD_WIDTH 8
+#elif defined(XSIMD_ARM8_64_NEON_VERSION) || defined(XSIMD_X86_SSE2_VERSION_AVAILABLE)
+#define CORNELIS_SIMD_WIDTH 4
+#else
+#define CORNELIS_SIMD_WIDTH 1
+#endif
+
+namespace cornelis::simd {
+constexpr std::size_t Width = CORNELIS_SIMD_WIDTH;
+
+#if CORNELIS_SIMD_WIDTH > 1
+using floatv = xsimd::batch<float, Width>;
+using boolv = xsimd::batch_bool<float, Width>;
+
+/**
+ * Integer lanes, as wide as floatv. The lanes are signed, as that is what xsimd supports
+ * everywhere, but the random number code uses them as 32 bit patterns. See shiftRight.
+ */
+using intv = xsimd::batch<int32_t, Width>;
+
+/**
+ * Turns a mask into one bool per lane, for the parts of a kernel that have to be done lane by lane.
+ */
+inline auto lanes(boolv const &mask) -> std::array<bool, Width> {
+    alignas(32) float values[Width];
+    xsimd::select(mask, floatv(1.0f), floatv(0.0f)).store_aligned(values);
+    std::array<bool, Width> result;
+    for (std::size_t l = 0; l < Width; l++)
+        result[l] = values[l] != 0.0f;
+    return result;
+}
+
+/**
+ * Width ray ids, and the means to load and store the fields belonging to them.
+ *
+ * If the ids are consecutive the fields are loaded directly from memory, otherwise they are
+ * gathered lane by lane.
+ */
+struct RayBlock {
+    RayBlock(std::size_t const *blockIds) : ids(blockIds), contiguous(true) {
+        for (std::size_t l = 1; l < Width; l++)
+            contiguous = contiguous && ids[l] == ids[0] + l;
+    }
+
+    auto load(span<float const> field) const -> floatv {
+        floatv v;
+        if (contiguous) {
+            v.load_unaligned(&field[ids[0]]);
+        } else {
+            alignas(32) float values[Width];
+            for (std::size_t l = 0; l < Width; l++)
+                values[l] = field[ids[l]];
+            v.load_aligned(values);
+        }
+        return v;
+    }
+
+    /**
+     * Same as above, for 32 bit integer fields.
+     */
+    auto load(span<uint32_t const> field) const -> intv {
+        intv v;
+        if (contiguous) {
+            v.load_unaligned(reinterpret_cast<int32_t const *>(&field[ids[0]]));
+        } else {
+            alignas(32) int32_t values[Width];
+            for (std::size_t l = 0; l < Width; l++)
+                values[l] = static_cast<int32_t>(field[ids[l]]);
+            v.load_aligned(values);
+        }
+        return v;
+    }
+
+    /**
+     * Stores the lanes of v where mask is set, leaving the other rays' values untouched.
+     */
+    auto store(span<float> field, floatv const &v, boolv const &mask) const -> void {
+        if (contiguous) {
+            floatv old;
+            old.load_unaligned(&field[ids[0]]);
+            xsimd::select(mask, v, old).store_unaligned(&field[ids[0]]);
+        } else {
+            alignas(32) float values[Width];
+            v.store_aligned(values);
+            auto set = lanes(mask);
+            for (std::size_t l = 0; l < Width; l++) {
+                if (set[l])
+                    field[ids[l]] = values[l];
+            }
+        }
+    }
+
+    std::size_t const *ids;
+    bool contiguous;
+};
+
+/**
+ * Calls kernel(block, mask) for the rays in ids, Width at a time. The rays left over after the full
+ * blocks are padded to a block by repeating the last of them, and mask is only set for the lanes
+ * that hold one of them, so the kernel must only store through mask. Every ray goes through the
+ * same instructions, so it gets the same result whichever part of ids it is in.
+ */
+template <typename Kernel>
+auto forEachBlock(span<const std::size_t> ids, Kernel &&kernel) -> void {
+    boolv const all(true);
+    std::size_t k = 0;
+    for (; k + Width <= ids.size(); k += Width)
+        kernel(RayBlock(&ids[k]), all);
+    if (k == ids.size())
+        return;
+
+    std::array<std::size_t, Width> padded;
+    alignas(32) float set[Width];
+    for (std::size_t l = 0; l < Width; l++) {
+        padded[l] = ids[std::min(k + l, ids.size() - 1)];
+        set[l] = k + l < ids.size() ? 1.0f : 0.0f;
+    }
+    floatv mask;
+    mask.load_aligned(set);
+    kernel(RayBlock(padded.data()), mask != floatv(0.0f));
+}
+
+/**
+ * Logical right shift: the lanes are signed, so >> shifts in copies of the sign bit, which the mask
+ * clears.
+ */
+inline auto shiftRight(intv const &x, int32_t n) -> intv {
+    return (x >> n) & intv(static_cast<int32_t>(0xffffffffu >> n));
+}
+
+/**
+ * detail::hash32 from PRNG.hpp, lane by lane. Multiplication wraps the same for signed and
+ * unsigned lanes.
+ */
+inline auto hash32(intv x) -> intv {
+    x = x ^ shiftRight(x, 16);
+    x = x * intv(0x7feb352d);
+    x = x ^ shiftRight(x, 15);
+    x = x * intv(static_cast<int32_t>(0x846ca68bu));
+    x = x ^ shiftRight(x, 16);
+    return x;
+}
+#endif
+} // namespace cornelis::simd
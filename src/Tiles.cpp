@@ -19,9 +19,9 @@ FrameTiling::FrameTiling(PixelRect dimensions, PixelRect maxTileSize) : tiles_{}
             PixelCoord pMin{i * maxTileSize.width(), j * maxTileSize.height()};
             PixelCoord pMax{(i + 1) * maxTileSize.width() - 1, (j + 1) * maxTileSize.height() - 1};
             if (i == numX - 1 && spillX != 0)
-                pMax.i = spillX - 1;
+                pMax.i = pMin.i + spillX - 1;
             if (j == numY - 1 && spillY != 0)
-                pMax.j = spillY - 1;
+                pMax.j = pMin.j + spillY - 1;
 
             tiles_.emplace_back(number++, PixelRect{pMin, pMax});
         }
@@ -74,6 +74,11 @@ auto cornellBox() -> SceneDescription {
 }
 
 int main(int argc, char *argv[]) {
-    RenderSession session(cornellBox(), RenderOptions{.samplesAA = 4096});
+    // Renders in passes of 16 samples per pixel until the image is clean enough, but no further
+    // than 4096 samples per pixel.
+    RenderSession session(
+        cornellBox(),
+        RenderOptions{.samplesAA = 4096, .progressiveSamples = 16, .convergenceTarget = 1e-3f});
     session.render();
+    session.saveImage("cornelisrender2.png");
 }
\ No newline at end of file
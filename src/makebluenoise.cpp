@@ -0,0 +1,29 @@
+#include <bit>
+#include <cstdio>
+#include <cstdlib>
+
+#include <cornelis/BlueNoise.hpp>
+#include <cornelis/PRNG.hpp>
+
+using namespace cornelis;
+
+// Makes the blue noise pixel ordering that SamplePattern::BlueNoise uses, data/bluenoise.bin:
+//
+//   cornelis-makebluenoise data/bluenoise.bin 128
+//
+// The file is compiled into the library, so the library has to be built again to pick it up.
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        std::printf("Usage: %s <output file> [size, default 128]\n", argv[0]);
+        return 1;
+    }
+    uint32_t const size = argc > 2 ? static_cast<uint32_t>(std::atoi(argv[2])) : 128;
+    if (size == 0 || size > 256 || !std::has_single_bit(size)) {
+        std::printf("The size must be a power of two up to 256 (not %u).\n", size);
+        return 1;
+    }
+
+    BlueNoiseOrdering::generate(size, PRNG::DefaultSeed).save(argv[1]);
+    std::printf("Wrote a %ux%u blue noise ordering to %s.\n", size, size, argv[1]);
+    return 0;
+}
@@ -0,0 +1,134 @@
+#include <cmath>
+#include <numeric>
+#include <vector>
+
+#include <catch2/catch_test_macros.hpp>
+#include <catch2/matchers/catch_matchers_floating.hpp>
+
+#include <cornelis/Adaptive.hpp>
+#include <cornelis/PRNG.hpp>
+
+using namespace cornelis;
+
+namespace {
+auto withSamples(std::vector<float> const &xs) -> RunningVariance {
+    RunningVariance v;
+    for (auto x : xs)
+        v.add(x);
+    return v;
+}
+} // namespace
+
+TEST_CASE("PixelSum: the most samples of the most light don't overflow") {
+    // Samples brighter than the limit, infinite ones too, count as the limit.
+    PixelSum sum;
+    for (int32_t s = 0; s < RenderOptions::MaxSamplesAA; s++)
+        sum += s % 2 ? RGB(INFINITY, INFINITY, INFINITY) : RGB(1e30f, 1e30f, 1e30f);
+
+    int64_t const expected =
+        int64_t(RenderOptions::MaxSamplesAA) * std::llround(PixelSum::MaxLight * PixelSum::Scale);
+    for (int c = 0; c < 3; c++)
+        CHECK(sum.sum[c] == expected);
+    auto const average = sum.average(RenderOptions::MaxSamplesAA);
+    CHECK(average(0) == RenderOptions::MaxSampleLight);
+    CHECK(average(1) == RenderOptions::MaxSampleLight);
+    CHECK(average(2) == RenderOptions::MaxSampleLight);
+}
+
+TEST_CASE("RunningVariance: same as the textbook formulas") {
+    PRNG prng;
+    std::vector<float> xs(1000);
+    for (auto &x : xs)
+        x = 1000.0f + prng();
+    auto const v = withSamples(xs);
+
+    double const mean = std::accumulate(std::begin(xs), std::end(xs), 0.0) / xs.size();
+    double squares = 0.0;
+    for (auto x : xs)
+        squares += (x - mean) * (x - mean);
+    CHECK(v.count() == 1000);
+    CHECK_THAT(v.mean(), Catch::Matchers::WithinRel(mean, 1e-9));
+    CHECK_THAT(v.variance(), Catch::Matchers::WithinRel(squares / 999, 1e-6));
+    CHECK_THAT(v.relativeError(),
+               Catch::Matchers::WithinRel(std::sqrt(squares / 999 / 1000) / mean, 1e-6));
+
+    CHECK(withSamples({}).variance() == 0.0);
+    CHECK(std::isinf(withSamples({0.5f}).relativeError()));
+    // Black pixels don't count as noisy.
+    CHECK(withSamples({0.0f, 0.0f}).relativeError() == 0.0);
+}
+
+TEST_CASE("planAdaptivePass: samples go to the noisy pixels") {
+    RenderOptions options{.adaptiveErrorTarget = 0.05f, .adaptiveMaxSamples = 64};
+    // A row of three flat pixels, a noisy one, and one just as noisy that already has all its
+    // samples.
+    std::vector<RunningVariance> pixels(5);
+    for (int k = 0; k != 16; k++) {
+        for (int p = 0; p != 3; p++)
+            pixels[p].add(0.5f);
+        pixels[3].add(k % 2 ? 0.3f : 0.7f);
+    }
+    for (int k = 0; k != 64; k++)
+        pixels[4].add(k % 2 ? 0.0f : 1.0f);
+
+    std::vector<uint32_t> samples(5);
+    // The noisy pixel needs (0.1 / 0.05)^2 = 4 times the samples it has to reach the target: 48
+    // more, but gets 16, doubling what it has. The flat pixel next to it gets as many, but not the
+    // ones further away.
+    REQUIRE_THAT(pixels[3].relativeError(), Catch::Matchers::WithinRel(0.1, 0.05));
+    CHECK(planAdaptivePass(pixels, 5, options, 1000, samples) == 32);
+    CHECK(samples == std::vector<uint32_t>{0, 0, 16, 16, 0});
+
+    // Short of budget, the pixels share it.
+    CHECK(planAdaptivePass(pixels, 5, options, 16, samples) == 16);
+    CHECK(samples == std::vector<uint32_t>{0, 0, 8, 8, 0});
+
+    // Nothing left to do.
+    options.adaptiveErrorTarget = 1.0f;
+    CHECK(planAdaptivePass(pixels, 5, options, 1000, samples) == 0);
+    CHECK(samples == std::vector<uint32_t>{0, 0, 0, 0, 0});
+}
+
+TEST_CASE("planAdaptivePass: a budget smaller than the noisy pixels is still spent") {
+    RenderOptions options{.adaptiveErrorTarget = 0.05f, .adaptiveMaxSamples = 64};
+    // Noisy pixels far enough apart not to be each other's neighbours, the last one the noisiest.
+    std::vector<RunningVariance> pixels(9);
+    for (int k = 0; k != 16; k++) {
+        for (int p = 0; p != 9; p++) {
+            float const spread = p == 8 ? 0.3f : p % 4 == 0 ? 0.2f : 0.0f;
+            pixels[p].add(k % 2 ? 0.5f - spread : 0.5f + spread);
+        }
+    }
+
+    // Every noisy pixel wants 16 samples. Two go to the noisiest pixel and its neighbour.
+    std::vector<uint32_t> samples(9);
+    CHECK(planAdaptivePass(pixels, 9, options, 2, samples) == 2);
+    CHECK(samples == std::vector<uint32_t>{0, 0, 0, 0, 0, 0, 0, 1, 1});
+
+    CHECK(planAdaptivePass(pixels, 9, options, 5, samples) == 5);
+    CHECK(std::accumulate(std::begin(samples), std::end(samples), 0u) == 5);
+}
+
+TEST_CASE("halfBufferRelativeMSE: matches the error of the mean") {
+    // Pixels with uniform samples between 0 and 1, so the variance of the mean of n samples is
+    // 1 / (12 n), and the squared mean 0.25.
+    PRNG prng;
+    std::size_t const pixels = 10000;
+    std::vector<float> even(pixels), odd(pixels);
+    std::vector<uint32_t> samples(pixels);
+    double expected = 0.0;
+    for (std::size_t p = 0; p != pixels; p++) {
+        samples[p] = p % 2 ? 16 : 33;
+        for (uint32_t k = 0; k != samples[p]; k++)
+            (k % 2 ? odd : even)[p] += prng();
+        even[p] /= (samples[p] + 1) / 2;
+        odd[p] /= samples[p] / 2;
+        expected += 1.0 / (12.0 * samples[p]);
+    }
+    expected /= 0.25 * pixels;
+    CHECK_THAT(halfBufferRelativeMSE(even, odd, samples),
+               Catch::Matchers::WithinRel(expected, 0.05));
+
+    samples[7] = 1;
+    CHECK(std::isinf(halfBufferRelativeMSE(even, odd, samples)));
+}
@@ -0,0 +1,299 @@
+#include <algorithm>
+#include <vector>
+
+#include <catch2/catch_test_macros.hpp>
+#include <catch2/generators/catch_generators.hpp>
+#include <catch2/matchers/catch_matchers_floating.hpp>
+
+#include <cornelis/BVH.hpp>
+#include <cornelis/PRNG.hpp>
+#include <cornelis/Scene.hpp>
+
+using namespace cornelis;
+
+namespace {
+struct TestRays : SoAObject<tags::PositionX,
+                            tags::PositionY,
+                            tags::PositionZ,
+                            tags::DirectionX,
+                            tags::DirectionY,
+                            tags::DirectionZ> {
+    TestRays(std::size_t n) : SoAObject(n) {}
+};
+
+auto contains(AABB const &outer, AABB const &inner) -> bool {
+    for (std::size_t i = 0; i < 3; i++) {
+        if (inner.min(i) < outer.min(i) || inner.max(i) > outer.max(i))
+            return false;
+    }
+    return true;
+}
+
+auto randomBoxes(PRNG &prng, std::size_t n) -> std::vector<AABB> {
+    std::vector<AABB> boxes;
+    for (std::size_t i = 0; i < n; i++) {
+        float3 c{prng() * 100.0f, prng() * 100.0f, prng() * 100.0f};
+        float3 r{prng() * 2.0f, prng() * 2.0f, prng() * 2.0f};
+        boxes.push_back({c - r, c + r});
+    }
+    return boxes;
+}
+
+auto randomScene(PRNG &prng, std::size_t numSpheres) -> SceneDescription {
+    SceneDescription descr;
+    for (std::size_t i = 0; i < numSpheres; i++) {
+        SphereDescription sphere{.center = V3(prng() * 20.0f - 10.0f,
+                                              prng() * 20.0f - 10.0f,
+                                              prng() * 20.0f - 10.0f),
+                                 .radius = 0.1f + prng()};
+        sphere.material = i;
+        descr.addSphere(sphere);
+    }
+    PlaneDescription floor{
+        .normal = V3(0, 1.0f, 0), .point = V3(0, -8.0f, 0), .extents = V3(15.0f, 15.0f, 0)};
+    floor.material = numSpheres;
+    descr.addPlane(floor);
+    PlaneDescription wall{.normal = V3(0.6f, 0, 0.8f),
+                          .point = V3(-5.0f, 0, -5.0f),
+                          .extents = V3(10.0f, 30.0f, 0)};
+    wall.material = numSpheres + 1;
+    descr.addPlane(wall);
+    return descr;
+}
+
+auto randomRays(PRNG &prng, std::size_t n) -> TestRays {
+    TestRays rays(n);
+    for (std::size_t k = 0; k < n; k++) {
+        setPosition(rays, k, float3{prng() * 30.0f - 15.0f, prng() * 30.0f - 15.0f, -20.0f});
+        setDirection(rays, k, normalize(randomHemisphere(prng, constructBasis({0, 0, 1}))));
+    }
+    return rays;
+}
+
+// Intersects the rays with every primitive in turn, the way the renderer did before it had a BVH.
+auto intersectLinear(SceneData &scene,
+                     TestRays &rays,
+                     IntersectionData &data,
+                     span<const std::size_t> activeRayIds) -> void {
+    auto [Sx, Sy, Sz] = getPositions(scene.spheres);
+    auto radius = scene.spheres.get<tags::Radius>();
+    auto materialIds = scene.spheres.get<tags::MaterialId>();
+    for (std::size_t i = 0; i != Sx.size(); i++) {
+        intersectSphere(getPositions(rays),
+                        getDirectionSpans(rays),
+                        float3(Sx[i], Sy[i], Sz[i]),
+                        radius[i],
+                        materialIds[i],
+                        static_cast<uint32_t>(i),
+                        data,
+                        activeRayIds);
+    }
+    auto [Px, Py, Pz] = getPositions(scene.planes);
+    auto [Nx, Ny, Nz] = getNormalSpans(scene.planes);
+    auto width = scene.planes.get<tags::WidthF>();
+    auto height = scene.planes.get<tags::HeightF>();
+    materialIds = scene.planes.get<tags::MaterialId>();
+    for (std::size_t i = 0; i != Px.size(); i++) {
+        intersectPlane(getPositions(rays),
+                       getDirectionSpans(rays),
+                       float3(Nx[i], Ny[i], Nz[i]),
+                       float3(Px[i], Py[i], Pz[i]),
+                       width[i],
+                       height[i],
+                       materialIds[i],
+                       static_cast<uint32_t>(Sx.size() + i),
+                       data,
+                       activeRayIds);
+    }
+}
+
+// Checks that the closest hits in actual are the ones in expected, and returns the number of hits.
+auto checkSameHits(IntersectionData &expected,
+                   IntersectionData &actual,
+                   span<const std::size_t> activeRayIds) -> std::size_t {
+    auto expectedParams = expected.get<tags::RayParam0>();
+    auto actualParams = actual.get<tags::RayParam0>();
+    auto expectedMaterials = expected.get<tags::MaterialId>();
+    auto actualMaterials = actual.get<tags::MaterialId>();
+    auto expectedPrimitives = expected.get<tags::PrimitiveId>();
+    auto actualPrimitives = actual.get<tags::PrimitiveId>();
+    auto [Nx, Ny, Nz] = getNormalSpans(expected);
+    auto [aNx, aNy, aNz] = getNormalSpans(actual);
+
+    std::size_t hits = 0;
+    for (auto k : activeRayIds) {
+        CAPTURE(k);
+        REQUIRE(actualParams[k] == expectedParams[k]);
+        if (expectedParams[k] < INFINITY) {
+            hits++;
+            CHECK(actualMaterials[k] == expectedMaterials[k]);
+            CHECK(actualPrimitives[k] == expectedPrimitives[k]);
+            CHECK((aNx[k] == Nx[k] && aNy[k] == Ny[k] && aNz[k] == Nz[k]));
+        }
+    }
+    return hits;
+}
+} // namespace
+
+TEST_CASE("BVH: empty") {
+    BVH bvh(std::vector<AABB>{});
+    CHECK(bvh.empty());
+    CHECK(bvh.primitives.empty());
+}
+
+TEST_CASE("BVH: structure") {
+    PRNG prng;
+    auto boxes = randomBoxes(prng, 10000);
+
+    for (auto builder : {BVHBuilder::BinnedSAH, BVHBuilder::Morton}) {
+        CAPTURE(static_cast<int>(builder));
+        BVH bvh(boxes, builder);
+
+        REQUIRE(!bvh.empty());
+
+        // Every primitive occurs exactly once.
+        auto sorted = bvh.primitives;
+        std::sort(std::begin(sorted), std::end(sorted));
+        REQUIRE(sorted.size() == boxes.size());
+        for (uint32_t i = 0; i < sorted.size(); i++)
+            REQUIRE(sorted[i] == i);
+
+        // Children are inside their parents, primitives inside their leaves, and every node is
+        // reachable.
+        std::vector<uint32_t> reached(bvh.nodes.size(), 0);
+        reached[0] = 1;
+        for (uint32_t i = 0; i < bvh.nodes.size(); i++) {
+            auto const &node = bvh.nodes[i];
+            if (node.isLeaf()) {
+                for (auto p = node.offset; p != node.offset + node.count; p++)
+                    REQUIRE(contains(node.bounds, boxes[bvh.primitives[p]]));
+            } else {
+                REQUIRE(contains(node.bounds, bvh.nodes[i + 1].bounds));
+                REQUIRE(contains(node.bounds, bvh.nodes[node.offset].bounds));
+                reached[i + 1]++;
+                reached[node.offset]++;
+            }
+        }
+        CHECK(std::all_of(
+            std::begin(reached), std::end(reached), [](uint32_t count) { return count == 1; }));
+    }
+}
+
+TEST_CASE("BVH: SAH builder gives cheaper trees than Morton") {
+    PRNG prng;
+    auto boxes = randomBoxes(prng, 10000);
+
+    float sah = sahCost(BVH(boxes, BVHBuilder::BinnedSAH));
+    float morton = sahCost(BVH(boxes, BVHBuilder::Morton));
+    CHECK(sah > 0.0f);
+    CHECK(sah < morton);
+}
+
+TEST_CASE("WideBVH: structure") {
+    PRNG prng;
+    auto boxes = randomBoxes(prng, 10000);
+    BVH bvh(boxes);
+    WideBVH wide(bvh);
+
+    REQUIRE(!wide.empty());
+    CHECK(wide.nodes.size() < bvh.nodes.size() / 4);
+
+    // Every primitive is in exactly one leaf, inside the bounds stored for that leaf, and every
+    // node is reachable.
+    std::vector<uint32_t> reachedPrimitives(boxes.size(), 0);
+    std::vector<uint32_t> reachedNodes(wide.nodes.size(), 0);
+    reachedNodes[0] = 1;
+    for (auto const &node : wide.nodes) {
+        REQUIRE(node.numChildren >= 1);
+        REQUIRE(node.numChildren <= WideBVHNode::Width);
+        for (std::size_t c = 0; c < node.numChildren; c++) {
+            AABB bounds{{node.minX[c], node.minY[c], node.minZ[c]},
+                        {node.maxX[c], node.maxY[c], node.maxZ[c]}};
+            if (node.count[c] == 0) {
+                reachedNodes[node.offset[c]]++;
+                continue;
+            }
+            for (auto p = node.offset[c]; p != node.offset[c] + node.count[c]; p++) {
+                auto i = bvh.primitives[p];
+                REQUIRE(contains(bounds, boxes[i]));
+                reachedPrimitives[i]++;
+            }
+        }
+    }
+    auto once = [](uint32_t count) { return count == 1; };
+    CHECK(std::all_of(std::begin(reachedPrimitives), std::end(reachedPrimitives), once));
+    CHECK(std::all_of(std::begin(reachedNodes), std::end(reachedNodes), once));
+}
+
+TEST_CASE("intersectsAABB") {
+    AABB box{float3{-1.0f}, float3{1.0f}};
+    auto inv = [](float3 d) { return float3{1.0f / d(0), 1.0f / d(1), 1.0f / d(2)}; };
+
+    CHECK(intersectsAABB(box, {0, 0, -5.0f}, inv({0, 0, 1.0f}), INFINITY));
+    // Too short.
+    CHECK(!intersectsAABB(box, {0, 0, -5.0f}, inv({0, 0, 1.0f}), 3.0f));
+    // Pointing away.
+    CHECK(!intersectsAABB(box, {0, 0, -5.0f}, inv({0, 0, -1.0f}), INFINITY));
+    // Starting inside.
+    CHECK(intersectsAABB(box, {0.5f, 0, 0}, inv({1.0f, 0, 0}), INFINITY));
+    CHECK(!intersectsAABB(box, {0, 2.0f, -5.0f}, inv({0, 0, 1.0f}), INFINITY));
+}
+
+TEST_CASE("intersectScene: same hits as testing every primitive") {
+    PRNG prng;
+    auto descr = randomScene(prng, 300);
+    auto builder = GENERATE(BVHBuilder::BinnedSAH, BVHBuilder::Morton);
+    SceneData scene(descr, builder);
+
+    std::size_t const n = 2000;
+    auto rays = randomRays(prng, n);
+    std::vector<std::size_t> activeRayIds;
+    for (std::size_t k = 0; k < n; k++) {
+        if (k % 7 != 3)
+            activeRayIds.push_back(k);
+    }
+
+    IntersectionData expected(n);
+    intersectLinear(scene, rays, expected, activeRayIds);
+    IntersectionData actual(n);
+    auto wide = GENERATE(false, true);
+    if (wide) {
+        intersectSceneWide(
+            scene, getPositions(rays), getDirectionSpans(rays), actual, activeRayIds);
+    } else {
+        intersectScene(scene, getPositions(rays), getDirectionSpans(rays), actual, activeRayIds);
+    }
+
+    auto hits = checkSameHits(expected, actual, activeRayIds);
+    // Make sure the test actually tests something.
+    CHECK(hits > n / 10);
+    CHECK(hits < activeRayIds.size());
+}
+
+TEST_CASE("intersectScenePacket: same hits as testing every primitive") {
+    PRNG prng;
+    auto descr = randomScene(prng, 300);
+    SceneData scene(descr);
+
+    // A narrow cone of rays from one point, like the camera rays of a pixel, or a wide one. The
+    // directions of the wide one differ in sign along x and y.
+    auto spread = GENERATE(0.01f, 1.0f);
+    std::size_t const n = 500;
+    TestRays rays(n);
+    float3 const axis = normalize(float3{0.1f, -0.05f, 1.0f});
+    std::vector<std::size_t> activeRayIds;
+    for (std::size_t k = 0; k < n; k++) {
+        float3 offset{prng() - 0.5f, prng() - 0.5f, 0.0f};
+        setPosition(rays, k, float3{1.0f, 2.0f, -20.0f});
+        setDirection(rays, k, normalize(axis + offset * float3{spread}));
+        activeRayIds.push_back(k);
+    }
+
+    IntersectionData expected(n);
+    intersectLinear(scene, rays, expected, activeRayIds);
+    IntersectionData actual(n);
+    intersectScenePacket(scene, getPositions(rays), getDirectionSpans(rays), actual, activeRayIds);
+
+    auto hits = checkSameHits(expected, actual, activeRayIds);
+    CHECK(hits > 0);
+}
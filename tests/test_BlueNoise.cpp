@@ -0,0 +1,77 @@
+#include <cornelis/BlueNoise.hpp>
+
+#include <algorithm>
+#include <fstream>
+#include <stdexcept>
+#include <vector>
+
+#include <catch2/catch_test_macros.hpp>
+
+using namespace cornelis;
+
+namespace {
+auto isPermutation(BlueNoiseOrdering const &ordering) -> bool {
+    uint32_t const size = ordering.size();
+    std::vector<int> count(size * size, 0);
+    for (uint32_t y = 0; y != size; y++) {
+        for (uint32_t x = 0; x != size; x++) {
+            if (ordering.rank(x, y) >= count.size())
+                return false;
+            count[ordering.rank(x, y)]++;
+        }
+    }
+    return std::all_of(std::begin(count), std::end(count), [](int c) { return c == 1; });
+}
+} // namespace
+
+TEST_CASE("BlueNoiseOrdering: generate") {
+    auto const ordering = BlueNoiseOrdering::generate(32, 1);
+    REQUIRE(ordering.size() == 32);
+    CHECK(isPermutation(ordering));
+    CHECK(ordering.rank(3, 5) == ordering.rank(3 + 32, 5 + 64));
+
+    // Every aligned square of 2^k by 2^k pixels has consecutive ranks, starting at a multiple of
+    // its area.
+    for (uint32_t side : {2u, 4u, 16u}) {
+        for (uint32_t y0 = 0; y0 != 32; y0 += side) {
+            for (uint32_t x0 = 0; x0 != 32; x0 += side) {
+                uint32_t const start = ordering.rank(x0, y0) / (side * side);
+                for (uint32_t y = y0; y != y0 + side; y++) {
+                    for (uint32_t x = x0; x != x0 + side; x++)
+                        CHECK(ordering.rank(x, y) / (side * side) == start);
+                }
+            }
+        }
+    }
+
+    CHECK_THROWS_AS(BlueNoiseOrdering::generate(24, 1), std::invalid_argument);
+}
+
+TEST_CASE("BlueNoiseOrdering: save and load") {
+    auto const path = std::filesystem::temp_directory_path() / "cornelis_test_bluenoise.bin";
+    auto const ordering = BlueNoiseOrdering::generate(16, 2);
+    ordering.save(path);
+    auto const loaded = BlueNoiseOrdering::load(path);
+    REQUIRE(loaded.size() == 16);
+    for (uint32_t y = 0; y != 16; y++) {
+        for (uint32_t x = 0; x != 16; x++)
+            CHECK(loaded.rank(x, y) == ordering.rank(x, y));
+    }
+
+    // Cut short.
+    std::filesystem::resize_file(path, std::filesystem::file_size(path) - 1);
+    CHECK_THROWS_AS(BlueNoiseOrdering::load(path), std::runtime_error);
+    {
+        std::ofstream garbage(path, std::ios::binary);
+        garbage << "not an ordering at all";
+    }
+    CHECK_THROWS_AS(BlueNoiseOrdering::load(path), std::runtime_error);
+    std::filesystem::remove(path);
+    CHECK_THROWS_AS(BlueNoiseOrdering::load(path), std::runtime_error);
+}
+
+TEST_CASE("BlueNoiseOrdering: the ordering that comes with cornelis") {
+    auto const &ordering = defaultBlueNoiseOrdering();
+    CHECK(ordering.size() == 128);
+    CHECK(isPermutation(ordering));
+}
@@ -0,0 +1,115 @@
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+
+#include <catch2/catch_test_macros.hpp>
+
+#include <cornelis/FastMath.hpp>
+#include <cornelis/Math.hpp>
+
+using namespace cornelis;
+
+namespace {
+#if defined(XSIMD_X86_SSE2_VERSION_AVAILABLE) || defined(XSIMD_ARM8_64_NEON_VERSION)
+using Batch = xsimd::batch<float, 4>;
+#endif
+
+/*
+    The largest error of fast against exact, over n evenly spaced points in [from, to]. Both the
+    scalar and the batch version of fast are checked. error(approx, exact, x) gives the error at
+    a single point.
+*/
+template <typename Fast, typename Exact, typename Error>
+auto maxError(Fast fast, Exact exact, Error error, float from, float to, std::size_t n) -> double {
+    double worst = 0.0;
+    for (std::size_t i = 0; i + 4 <= n; i += 4) {
+        alignas(16) float x[4];
+        for (std::size_t l = 0; l < 4; l++)
+            x[l] = from + (to - from) * static_cast<float>(i + l) / static_cast<float>(n - 1);
+        for (std::size_t l = 0; l < 4; l++)
+            worst = std::max(worst, error(fast(x[l]), exact(x[l]), x[l]));
+#if defined(XSIMD_X86_SSE2_VERSION_AVAILABLE) || defined(XSIMD_ARM8_64_NEON_VERSION)
+        Batch xb;
+        xb.load_aligned(x);
+        Batch const approx = fast(xb);
+        for (std::size_t l = 0; l < 4; l++)
+            worst = std::max(worst, error(approx[l], exact(x[l]), x[l]));
+#endif
+    }
+    return worst;
+}
+
+auto absoluteError(float approx, double exact, float) -> double { return std::abs(approx - exact); }
+
+auto relativeError(float approx, double exact, float) -> double {
+    return std::abs(approx - exact) / std::abs(exact);
+}
+} // namespace
+
+TEST_CASE("fastmath::sincos: error bound") {
+    auto sin = [](auto x) { return fastmath::sincos(x).first; };
+    auto cos = [](auto x) { return fastmath::sincos(x).second; };
+    auto exactSin = [](double x) { return std::sin(x); };
+    auto exactCos = [](double x) { return std::cos(x); };
+
+    CHECK(maxError(sin, exactSin, absoluteError, -2.0f * Pi, 2.0f * Pi, 1 << 20) < 1.5e-7);
+    CHECK(maxError(cos, exactCos, absoluteError, -2.0f * Pi, 2.0f * Pi, 1 << 20) < 1.5e-7);
+    CHECK(maxError(sin, exactSin, absoluteError, -8192.0f, 8192.0f, 1 << 22) < 1.5e-7);
+    CHECK(maxError(cos, exactCos, absoluteError, -8192.0f, 8192.0f, 1 << 22) < 1.5e-7);
+    CHECK(fastmath::sincos(0.0f).first == 0.0f);
+    CHECK(fastmath::sincos(0.0f).second == 1.0f);
+}
+
+TEST_CASE("fastmath::acos: error bound") {
+    auto acos = [](auto x) { return fastmath::acos(x); };
+    auto exact = [](double x) { return std::acos(x); };
+
+    CHECK(maxError(acos, exact, absoluteError, -1.0f, 1.0f, 1 << 20) < 5e-7);
+    CHECK(std::abs(fastmath::acos(1.0f)) < 5e-7);
+    CHECK(std::abs(fastmath::acos(-1.0f) - Pi) < 5e-7);
+}
+
+TEST_CASE("fastmath::exp2: error bound") {
+    auto exp2 = [](auto x) { return fastmath::exp2(x); };
+    auto exact = [](double x) { return std::exp2(x); };
+
+    CHECK(maxError(exp2, exact, relativeError, -126.0f, 127.0f, 1 << 22) < 1.5e-7);
+    CHECK(maxError(exp2, exact, relativeError, -1.0f, 1.0f, 1 << 20) < 1.5e-7);
+    CHECK(fastmath::exp2(0.0f) == 1.0f);
+    CHECK(fastmath::exp2(10.0f) == 1024.0f);
+    CHECK(fastmath::exp2(-127.0f) == 0.0f);
+    CHECK(fastmath::exp2(-1000.0f) == 0.0f);
+}
+
+TEST_CASE("fastmath::log2: error bound") {
+    auto log2 = [](auto x) { return fastmath::log2(x); };
+    auto exact = [](double x) { return std::log2(x); };
+    auto error = [](float approx, double exact, float) {
+        return std::abs(approx - exact) / std::max(1.0, std::abs(exact));
+    };
+
+    CHECK(maxError(log2, exact, error, 0.5f, 2.0f, 1 << 20) < 2e-7);
+    CHECK(maxError(log2, exact, error, 1e-30f, 1e-20f, 1 << 20) < 2e-7);
+    CHECK(maxError(log2, exact, error, 1.0f, 1e30f, 1 << 20) < 2e-7);
+    CHECK(fastmath::log2(1.0f) == 0.0f);
+    CHECK(fastmath::log2(0.25f) == -2.0f);
+}
+
+TEST_CASE("fastmath::pow: error bound") {
+    auto exact = [](double x, double y) { return std::pow(x, y); };
+    for (float y : {-2.5f, -1.0f, 0.5f, 1.0f / 2.4f, 2.4f, 5.0f}) {
+        CAPTURE(y);
+        auto pow = [y](auto x) { return fastmath::pow(x, decltype(x)(y)); };
+        auto error = [y](float approx, double exact, float x) {
+            return std::abs(approx - exact) / exact /
+                   std::max(1.0, std::abs(y * std::log2(static_cast<double>(x))));
+        };
+        auto powY = [&](double x) { return exact(x, y); };
+
+        CHECK(maxError(pow, powY, error, 1e-3f, 1e3f, 1 << 18) < 3e-7);
+        // The range the sRGB transfer function raises to a power.
+        CHECK(maxError(pow, powY, error, 0.0031308f, 1.0f, 1 << 18) < 3e-7);
+    }
+    CHECK(fastmath::pow(0.0f, 2.4f) == 0.0f);
+    CHECK(fastmath::pow(2.0f, 3.0f) == 8.0f);
+}
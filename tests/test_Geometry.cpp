@@ -1,7 +1,11 @@
+#include <cmath>
+
 #include <catch2/catch_test_macros.hpp>
+#include <catch2/generators/catch_generators.hpp>
 #include <catch2/matchers/catch_matchers_floating.hpp>
 
 #include <cornelis/Geometry.hpp>
+#include <cornelis/PRNG.hpp>
 #include <cornelis/SoA.hpp>
 
 using namespace cornelis;
@@ -15,6 +19,71 @@ struct TestRays : SoAObject<tags::PositionX,
                             tags::DirectionZ> {
     TestRays(std::size_t n) : SoAObject(n) {}
 };
+
+// Random rays, some of them bad and some of them already hitting something, for comparing the wide
+// kernels with the scalar ones. The first half of the ids are consecutive and loaded directly by
+// the wide kernels, the others are gathered.
+struct WideKernelTest {
+    WideKernelTest() : rays(n), expected(n), actual(n) {
+        PRNG prng;
+        auto [rx, ry, rz] = getPositions(rays);
+        auto [dirx, diry, dirz] = getDirectionSpans(rays);
+        for (std::size_t k = 0; k < n; k++) {
+            rx[k] = prng() * 4.0f - 2.0f;
+            ry[k] = prng() * 4.0f - 2.0f;
+            rz[k] = -3.0f + prng() * 4.0f;
+            // Every 17th ray is bad.
+            float3 d = k % 17 == 0
+                           ? float3{0.0f}
+                           : normalize(float3{prng() - 0.5f, prng() - 0.5f, prng() + 0.1f});
+            dirx[k] = d(0);
+            diry[k] = d(1);
+            dirz[k] = d(2);
+            float t = k % 5 == 0 ? prng() * 3.0f : INFINITY;
+            for (auto *data : {&expected, &actual}) {
+                data->get<tags::RayParam0>()[k] = t;
+                data->get<tags::Intersected>()[k] = false;
+                data->get<tags::MaterialId>()[k] = 0;
+            }
+            if (k < n / 2 || k % 3 != 0)
+                activeRayIds.push_back(k);
+        }
+    }
+
+    // Checks that actual matches expected, and returns the number of hits with materialId.
+    auto compare(std::size_t materialId) -> std::size_t {
+        using Catch::Matchers::WithinAbs;
+
+        auto [x, y, z] = getPositions(expected);
+        auto [ax, ay, az] = getPositions(actual);
+        auto [Nx, Ny, Nz] = getNormalSpans(expected);
+        auto [aNx, aNy, aNz] = getNormalSpans(actual);
+        std::size_t hits = 0;
+        for (std::size_t k = 0; k < n; k++) {
+            CAPTURE(k);
+            REQUIRE(actual.get<tags::Intersected>()[k] == expected.get<tags::Intersected>()[k]);
+            REQUIRE(actual.get<tags::MaterialId>()[k] == expected.get<tags::MaterialId>()[k]);
+            auto t = expected.get<tags::RayParam0>()[k];
+            REQUIRE_THAT(actual.get<tags::RayParam0>()[k], WithinAbs(t, 1e-5));
+            if (expected.get<tags::MaterialId>()[k] == materialId) {
+                hits++;
+                CHECK_THAT(ax[k], WithinAbs(x[k], 1e-5));
+                CHECK_THAT(ay[k], WithinAbs(y[k], 1e-5));
+                CHECK_THAT(az[k], WithinAbs(z[k], 1e-5));
+                CHECK_THAT(aNx[k], WithinAbs(Nx[k], 1e-5));
+                CHECK_THAT(aNy[k], WithinAbs(Ny[k], 1e-5));
+                CHECK_THAT(aNz[k], WithinAbs(Nz[k], 1e-5));
+            }
+        }
+        return hits;
+    }
+
+    static constexpr std::size_t n = 203;
+    TestRays rays;
+    IntersectionData expected;
+    IntersectionData actual;
+    std::vector<std::size_t> activeRayIds;
+};
 } // namespace
 
 TEST_CASE("intersectSphere") {
@@ -85,12 +154,14 @@ TEST_CASE("intersectSphere") {
                     {-1, 0, 0},
                     1.0f,
                     materialId,
+                    7,
                     intersections,
                     activeRayIds);
 
     auto [x, y, z] = getPositions(intersections);
     auto [Nx, Ny, Nz] = getNormalSpans(intersections);
     auto materialIds = intersections.get<tags::MaterialId>();
+    auto primitiveIds = intersections.get<tags::PrimitiveId>();
 
     CAPTURE(x[0], y[0], z[0], x[1], y[1], z[1], Nx[0], Ny[0], Nz[0]);
 
@@ -106,6 +177,7 @@ TEST_CASE("intersectSphere") {
     // CHECK((Nx[0] == -0.94491 && Ny[0] == 0 && Nz[0] == -0.32731));
     CHECK_THAT(params[0], Catch::Matchers::WithinAbs(2.1339f, 0.001f));
     CHECK(materialIds[0] == materialId);
+    CHECK(primitiveIds[0] == 7);
 
     CHECK(intersected[1] == true);
     CHECK((x[1] == -2.0f && y[1] == 0 && z[1] == 0));
@@ -123,6 +195,32 @@ TEST_CASE("intersectSphere") {
     CHECK(params[5] == -0.5f);
 }
 
+TEST_CASE("intersectSphereWide: same results as intersectSphere") {
+    WideKernelTest test;
+    float3 const center{0.2f, -0.1f, 0.5f};
+    float const radius = 1.2f;
+    intersectSphere(getPositions(test.rays),
+                    getDirectionSpans(test.rays),
+                    center,
+                    radius,
+                    3,
+                    1,
+                    test.expected,
+                    test.activeRayIds);
+    auto directions = GENERATE(RayDirections::Arbitrary, RayDirections::Normalized);
+    intersectSphereWide(getPositions(test.rays),
+                        getDirectionSpans(test.rays),
+                        center,
+                        radius,
+                        3,
+                        1,
+                        test.actual,
+                        test.activeRayIds,
+                        directions);
+
+    CHECK(test.compare(3) > test.n / 8);
+}
+
 TEST_CASE("intersectPlane") {
     TestRays rays(6);
 
@@ -202,6 +300,7 @@ TEST_CASE("intersectPlane") {
                    planeWidth,
                    planeHeight,
                    materialId,
+                   7,
                    intersections,
                    activeRayIds);
 
@@ -236,4 +335,114 @@ TEST_CASE("intersectPlane") {
 
     CHECK(intersected[5] == true);
     CHECK(params[5] == -0.5f);
-}
\ No newline at end of file
+}
+
+TEST_CASE("intersectPlaneWide: same results as intersectPlane") {
+    WideKernelTest test;
+    float3 const N = normalize(float3{0.3f, 0.2f, -1.0f});
+    float3 const P{0.1f, 0.2f, 0.5f};
+    float const width = 4.0f;
+    float const height = 3.0f;
+    intersectPlane(getPositions(test.rays),
+                   getDirectionSpans(test.rays),
+                   N,
+                   P,
+                   width,
+                   height,
+                   5,
+                   1,
+                   test.expected,
+                   test.activeRayIds);
+    Basis b = constructBasis(N);
+    intersectPlaneWide(getPositions(test.rays),
+                       getDirectionSpans(test.rays),
+                       N,
+                       P,
+                       b.T,
+                       b.B,
+                       2.0f / width,
+                       2.0f / height,
+                       5,
+                       1,
+                       test.actual,
+                       test.activeRayIds);
+
+    auto hits = test.compare(5);
+    CHECK(hits > test.n / 8);
+    // Some rays must miss because of the extents, or they aren't tested.
+    CHECK(hits < test.activeRayIds.size() / 2);
+}
+
+TEST_CASE("sampleSphere: uniform over the cone of the sphere") {
+    using Catch::Matchers::WithinAbs;
+    using Catch::Matchers::WithinRel;
+
+    PRNG prng;
+    float3 const P{0.5f, -1.0f, 2.0f};
+    float3 const center{3.0f, 1.0f, -2.0f};
+    float const radius = 1.5f;
+    float const distance = sqrtf(mag2(center - P));
+    float3 const axis = (center - P) * (1.0f / distance);
+    float const cosThetaMax = sqrtf(1.0f - radius * radius / (distance * distance));
+
+    constexpr int n = 100000;
+    double meanCos = 0.0;
+    for (int i = 0; i != n; i++) {
+        auto const s = sampleSphere(P, center, radius, float2(prng(), prng()));
+        REQUIRE_THAT(mag2(s.wi), WithinAbs(1.0, 1e-5));
+        // Every direction hits the sphere, at the given distance.
+        REQUIRE_THAT(sqrtf(mag2(P + s.wi * s.distance - center)), WithinRel(radius, 1e-3f));
+        REQUIRE_THAT(s.pdf, WithinRel(1.0f / (2.0f * Pi * (1.0f - cosThetaMax)), 1e-3f));
+        REQUIRE_THAT(sphereSamplePdf(P, center, radius), WithinRel(s.pdf, 1e-5f));
+        meanCos += dot(s.wi, axis);
+    }
+    // The mean cosine of directions uniform in solid angle over the cone.
+    CHECK_THAT(meanCos / n, WithinAbs((1.0 + cosThetaMax) / 2.0, 1e-4));
+
+    CHECK(sampleSphere(center + float3{0.5f, 0.0f, 0.0f}, center, radius, float2(0.5f, 0.5f))
+              .pdf == 0.0f);
+    CHECK(sphereSamplePdf(center + float3{0.5f, 0.0f, 0.0f}, center, radius) == 0.0f);
+}
+
+TEST_CASE("sampleRectangle: uniform over the area of the rectangle") {
+    using Catch::Matchers::WithinAbs;
+    using Catch::Matchers::WithinRel;
+
+    PRNG prng;
+    float const width = 2.0f, height = 3.0f, h = 1.5f;
+    float3 const normal{0.0f, -1.0f, 0.0f};
+    Basis const b = constructBasis(normal);
+    float3 const center{1.0f, 2.0f, 3.0f};
+    // Right below the middle of the rectangle, which covers this solid angle.
+    float3 const P = center - normal * h;
+    double const solidAngle = 4.0 * std::asin(width * height /
+                                              std::sqrt((width * width + 4 * h * h) *
+                                                        (height * height + 4 * h * h)));
+
+    constexpr int n = 100000;
+    double estimate = 0.0;
+    for (int i = 0; i != n; i++) {
+        auto const s =
+            sampleRectangle(P, center, normal, b.T, b.B, width, height, float2(prng(), prng()));
+        REQUIRE(s.pdf > 0.0f);
+        float3 const Q = P + s.wi * s.distance;
+        REQUIRE_THAT(dot(Q - center, normal), WithinAbs(0.0, 1e-5));
+        REQUIRE(abs(dot(Q - center, b.T)) <= width / 2 + 1e-5f);
+        REQUIRE(abs(dot(Q - center, b.B)) <= height / 2 + 1e-5f);
+        // The pdf of the direction found by tracing it instead.
+        REQUIRE_THAT(rectangleSamplePdf(s.wi, (Q - P)(1) / s.wi(1), normal, width, height),
+                     WithinRel(s.pdf, 1e-4f));
+        estimate += 1.0 / s.pdf;
+    }
+    CHECK_THAT(estimate / n, WithinRel(solidAngle, 0.01));
+
+    // From either side.
+    auto const behind = sampleRectangle(
+        center + normal * h, center, normal, b.T, b.B, width, height, float2(0.25f, 0.75f));
+    CHECK(behind.pdf > 0.0f);
+    CHECK(dot(behind.wi, normal) < 0.0f);
+    // Not from within its plane.
+    CHECK(sampleRectangle(
+              center + b.T * 5.0f, center, normal, b.T, b.B, width, height, float2(0.5f, 0.5f))
+              .pdf == 0.0f);
+}
@@ -0,0 +1,150 @@
+#include <cmath>
+#include <vector>
+
+#include <catch2/catch_test_macros.hpp>
+#include <catch2/generators/catch_generators.hpp>
+#include <catch2/matchers/catch_matchers_floating.hpp>
+
+#include <cornelis/LightBVH.hpp>
+#include <cornelis/PRNG.hpp>
+
+using namespace cornelis;
+
+namespace {
+auto sphereLight(float3 const &center, float radius, float power) -> LightBounds {
+    float3 const r{radius, radius, radius};
+    return LightBounds{.bounds = {center - r, center + r},
+                       .power = power,
+                       .cosThetaO = -1.0f,
+                       .cosThetaE = 0.0f};
+}
+
+// A square panel facing down, like a lamp in a ceiling.
+auto panelLight(float3 const &center, float side, float power) -> LightBounds {
+    float3 const r{side / 2.0f, 0.0f, side / 2.0f};
+    return LightBounds{.bounds = {center - r, center + r},
+                       .power = power,
+                       .axis = {0.0f, -1.0f, 0.0f},
+                       .cosThetaO = 1.0f,
+                       .cosThetaE = 0.0f};
+}
+
+auto randomLights(PRNG &prng, std::size_t n) -> std::vector<LightBounds> {
+    std::vector<LightBounds> lights;
+    for (std::size_t i = 0; i < n; i++) {
+        float3 const c{prng() * 40.0f - 20.0f, prng() * 10.0f, prng() * 40.0f - 20.0f};
+        if (i % 2 == 0)
+            lights.push_back(sphereLight(c, 0.1f + prng(), 1.0f + prng() * 100.0f));
+        else
+            lights.push_back(panelLight(c, 0.5f + prng() * 2.0f, 1.0f + prng() * 100.0f));
+    }
+    return lights;
+}
+} // namespace
+
+TEST_CASE("LightBVH: empty") {
+    LightBVH bvh;
+    CHECK(bvh.empty());
+    CHECK(bvh.sample({0, 0, 0}, {0, 1, 0}, 0.5f).probability == 0.0f);
+}
+
+TEST_CASE("LightBVH: a single light is always picked") {
+    std::vector<LightBounds> lights{sphereLight({0, 5, 0}, 1.0f, 10.0f)};
+    LightBVH bvh(lights);
+    REQUIRE(bvh.nodes.size() == 1);
+    auto const choice = bvh.sample({3, 0, 1}, {0, 1, 0}, 0.7f);
+    CHECK(choice.light == 0);
+    CHECK(choice.probability == 1.0f);
+    CHECK(bvh.probability({3, 0, 1}, {0, 1, 0}, 0) == 1.0f);
+}
+
+TEST_CASE("LightBVH: structure") {
+    auto const n = GENERATE(2, 3, 17, 100);
+    CAPTURE(n);
+    PRNG prng(n);
+    auto const lights = randomLights(prng, n);
+    LightBVH bvh(lights);
+
+    REQUIRE(bvh.nodes.size() == 2 * n - 1);
+    REQUIRE(bvh.leaves.size() == n);
+    std::vector<int> seen(n, 0);
+    for (uint32_t i = 0; i < bvh.nodes.size(); i++) {
+        auto const &node = bvh.nodes[i];
+        if (node.leaf) {
+            REQUIRE(node.offset < n);
+            seen[node.offset]++;
+            CHECK(bvh.leaves[node.offset] == i);
+            continue;
+        }
+        // The first child follows its parent, and both point back at it.
+        CHECK(bvh.nodes[i + 1].parent == i);
+        CHECK(bvh.nodes[node.offset].parent == i);
+        auto const childPower =
+            bvh.nodes[i + 1].bounds.power + bvh.nodes[node.offset].bounds.power;
+        CHECK_THAT(node.bounds.power, Catch::Matchers::WithinRel(childPower, 1e-5f));
+    }
+    for (auto const count : seen)
+        CHECK(count == 1);
+}
+
+TEST_CASE("LightBVH: sample and probability agree") {
+    auto const n = GENERATE(2, 17, 100);
+    CAPTURE(n);
+    PRNG prng(n);
+    auto const lights = randomLights(prng, n);
+    LightBVH bvh(lights);
+
+    for (int i = 0; i < 50; i++) {
+        float3 const P{prng() * 50.0f - 25.0f, prng() * 12.0f - 1.0f, prng() * 50.0f - 25.0f};
+        auto const N = normalize(randomHemisphere(prng, constructBasis({0, 1, 0})));
+
+        // The probabilities of all lights add up to at most one. Less if sample can end up in a
+        // cluster where neither half can reach P.
+        float sum = 0.0f;
+        for (uint32_t light = 0; light < n; light++)
+            sum += bvh.probability(P, N, light);
+        CHECK(sum <= 1.0f + 1e-3f);
+
+        for (int j = 0; j < 10; j++) {
+            auto const choice = bvh.sample(P, N, prng());
+            if (choice.probability == 0.0f) {
+                CHECK(sum < 1.0f);
+                continue;
+            }
+            REQUIRE(choice.light < n);
+            CHECK_THAT(choice.probability,
+                       Catch::Matchers::WithinRel(bvh.probability(P, N, choice.light), 1e-4f));
+        }
+    }
+}
+
+TEST_CASE("LightBVH: nearer and brighter lights are picked more often") {
+    float3 const P{0, 0, 0};
+    float3 const N{0, 1, 0};
+    SECTION("nearer") {
+        std::vector<LightBounds> lights{sphereLight({-1, 2, 0}, 0.5f, 10.0f),
+                                        sphereLight({1, 20, 0}, 0.5f, 10.0f)};
+        LightBVH bvh(lights);
+        CHECK(bvh.probability(P, N, 0) > 0.9f);
+    }
+    SECTION("brighter") {
+        std::vector<LightBounds> lights{sphereLight({-5, 5, 0}, 0.5f, 100.0f),
+                                        sphereLight({5, 5, 0}, 0.5f, 1.0f)};
+        LightBVH bvh(lights);
+        CHECK(bvh.probability(P, N, 0) > 0.9f);
+    }
+    SECTION("facing away") {
+        // A panel facing down lights nothing above it.
+        std::vector<LightBounds> lights{panelLight({-2, -5, 0}, 1.0f, 10.0f),
+                                        panelLight({2, 5, 0}, 1.0f, 10.0f)};
+        LightBVH bvh(lights);
+        CHECK(bvh.probability(P, N, 0) == 0.0f);
+        CHECK(bvh.probability(P, N, 1) == 1.0f);
+    }
+}
+
+TEST_CASE("importance: points inside the bounds") {
+    auto const light = sphereLight({0, 0, 0}, 2.0f, 10.0f);
+    CHECK(importance(light, {0.5f, 0, 0}, {0, 1, 0}) > 0.0f);
+    CHECK(importance(light, {0.5f, 0, 0}, {0, 0, 0}) > 0.0f);
+}
@@ -0,0 +1,166 @@
+#include <cmath>
+#include <utility>
+#include <vector>
+
+#include <catch2/catch_test_macros.hpp>
+#include <catch2/generators/catch_generators.hpp>
+
+#include <cornelis/Materials.hpp>
+#include <cornelis/PRNG.hpp>
+
+using namespace cornelis;
+
+namespace {
+// Equal up to rounding, or both NaN.
+auto same(float a, float b) -> bool {
+    if (std::isnan(a) || std::isnan(b))
+        return std::isnan(a) && std::isnan(b);
+    return std::abs(a - b) <= 1e-5f * std::max(1.0f, std::max(std::abs(a), std::abs(b)));
+}
+} // namespace
+
+TEST_CASE("LayeredBRDF: sample agrees with operator() and pdf") {
+    PRNG prng;
+    auto accuracy = GENERATE(MathAccuracy::Exact, MathAccuracy::Fast);
+    LayeredBRDF brdf(RGB{0.7f, 0.3f, 0.2f}, RGB{0.9f, 0.6f, 0.1f}, 0.3f, 1.5f, accuracy);
+
+    int lobes[2] = {0, 0};
+    for (int i = 0; i < 1000; i++) {
+        CAPTURE(i);
+        Basis b = constructBasis(normalize(float3{prng() - 0.5f, prng() - 0.5f, prng() - 0.5f}));
+        float3 wo = randomHemisphere(prng, b);
+        float3 x(prng(), prng(), prng());
+
+        auto s = brdf.sample(wo, x, b);
+        REQUIRE(s.lobe <= LayeredBRDF::GlossyLobe);
+        lobes[s.lobe]++;
+
+        RGB f = brdf(s.wi, wo, b.N);
+        for (std::size_t c = 0; c < 3; c++)
+            CHECK(same(s.f(c), f(c)));
+        CHECK(same(s.pdf, brdf.pdf(s.wi, wo, b)));
+        CHECK(same(s.cosTheta, std::abs(dot(s.wi, b.N))));
+
+        float3 wi{};
+        float pdf = 0.0f;
+        RGB generated = brdf.generateDirection(wo, x, b, wi, pdf);
+        CHECK(wi == s.wi);
+        CHECK(same(pdf, s.pdf));
+        for (std::size_t c = 0; c < 3; c++)
+            CHECK(same(generated(c), s.f(c)));
+    }
+    CHECK(lobes[LayeredBRDF::DiffuseLobe] > 400);
+    CHECK(lobes[LayeredBRDF::GlossyLobe] > 400);
+}
+
+TEST_CASE("BRDF: default sample") {
+    PRNG prng;
+    LambertBRDF brdf(RGB{0.5f, 0.5f, 0.5f});
+    Basis b = constructBasis(float3{0, 1.0f, 0});
+    float3 wo = randomHemisphere(prng, b);
+
+    auto s = brdf.sample(wo, float3(0.25f, 0.5f, 0.0f), b);
+    CHECK(dot(s.wi, b.N) >= 0.0f);
+    CHECK(s.f == brdf(s.wi, wo, b.N));
+    CHECK(s.pdf == brdf.pdf(s.wi, wo, b));
+    CHECK(s.cosTheta == std::abs(dot(s.wi, b.N)));
+}
+
+TEST_CASE("OrenNayarBRDF: same as the trigonometric form") {
+    PRNG prng;
+    RGB albedo{0.7f, 0.3f, 0.2f};
+    float sigma = 0.4f;
+    OrenNayarBRDF brdf(albedo, sigma);
+
+    float sigma2 = sigma * sigma;
+    float A = 1.0f - (sigma2 / (2.0f * (sigma2 + 0.333f)));
+    float B = 0.45f * sigma2 / (sigma2 + 0.09f);
+    Basis b = constructBasis(float3{0, 0, 1.0f});
+    for (int i = 0; i < 1000; i++) {
+        float3 wi = randomHemisphere(prng, b);
+        float3 wo = randomHemisphere(prng, b);
+        float thetaI = std::acos(wi(2));
+        float thetaO = std::acos(wo(2));
+        float phiI = std::acos(wi(0) / std::sin(thetaI));
+        float phiO = std::acos(wo(0) / std::sin(thetaO));
+        float expected = A + B * std::max(0.0f, std::cos(phiI - phiO)) *
+                                 std::sin(std::max(thetaI, thetaO)) *
+                                 std::sin(std::min(thetaI, thetaO));
+
+        RGB f = brdf(wi, wo, b.N);
+        CAPTURE(i, expected);
+        CHECK(same(f(0), albedo(0) / Pi * expected));
+    }
+}
+
+TEST_CASE("sampleWide: same as LayeredBRDF::sample") {
+    PRNG prng;
+    auto accuracy = GENERATE(MathAccuracy::Exact, MathAccuracy::Fast);
+    LayeredBRDF brdf(RGB{0.7f, 0.3f, 0.2f}, RGB{0.9f, 0.6f, 0.1f}, 0.3f, 1.5f, accuracy);
+
+    // Consecutive ids in the first half, every other id in the second, and a few left over.
+    std::size_t const n = 203;
+    std::vector<float> fields[16];
+    for (auto &field : fields)
+        field.resize(n);
+    auto spans = [&](std::size_t first) -> SoATuple3f {
+        return {fields[first], fields[first + 1], fields[first + 2]};
+    };
+    auto [dx, dy, dz] = spans(0);
+    auto [Nx, Ny, Nz] = spans(3);
+    auto [x0, x1, x2] = spans(6);
+    std::vector<std::size_t> ids;
+    for (std::size_t k = 0; k < n; k++) {
+        float3 N = normalize(float3{prng() - 0.5f, prng() - 0.5f, prng() - 0.5f});
+        float3 d = -randomHemisphere(prng, constructBasis(N));
+        dx[k] = d(0), dy[k] = d(1), dz[k] = d(2);
+        Nx[k] = N(0), Ny[k] = N(1), Nz[k] = N(2);
+        x0[k] = prng(), x1[k] = prng(), x2[k] = prng();
+        if (k < n / 2 || k % 2 == 0)
+            ids.push_back(k);
+    }
+
+    sampleWide(brdf, spans(0), spans(3), spans(6), ids, spans(9), spans(12), fields[15]);
+
+    auto [wix, wiy, wiz] = spans(9);
+    auto [wr, wg, wb] = spans(12);
+    auto const &pdf = fields[15];
+    for (auto k : ids) {
+        CAPTURE(k);
+        auto s = brdf.sample(float3{-dx[k], -dy[k], -dz[k]},
+                             float3{x0[k], x1[k], x2[k]},
+                             constructBasis(float3{Nx[k], Ny[k], Nz[k]}));
+        RGB weight = s.f * (s.cosTheta / s.pdf);
+        CHECK(std::abs(wix[k] - s.wi(0)) < 1e-4f);
+        CHECK(std::abs(wiy[k] - s.wi(1)) < 1e-4f);
+        CHECK(std::abs(wiz[k] - s.wi(2)) < 1e-4f);
+        CHECK(std::abs(pdf[k] - s.pdf) <= 1e-3f * std::max(1.0f, s.pdf));
+        // Rounding in the directions carries over to the weights, relative to their size.
+        for (auto [actual, expected] : {std::pair{wr[k], weight(0)},
+                                        std::pair{wg[k], weight(1)},
+                                        std::pair{wb[k], weight(2)}}) {
+            CAPTURE(actual, expected);
+            CHECK(std::abs(actual - expected) <= 1e-3f * std::max(1.0f, std::abs(expected)));
+        }
+    }
+}
+
+TEST_CASE("LayeredBRDF: fast math samples close to exact") {
+    PRNG prng;
+    LayeredBRDF exact(RGB{0.7f, 0.3f, 0.2f}, RGB{0.9f, 0.6f, 0.1f}, 0.3f, 1.5f);
+    LayeredBRDF fast(
+        RGB{0.7f, 0.3f, 0.2f}, RGB{0.9f, 0.6f, 0.1f}, 0.3f, 1.5f, MathAccuracy::Fast);
+
+    for (int i = 0; i < 1000; i++) {
+        CAPTURE(i);
+        Basis b = constructBasis(normalize(float3{prng() - 0.5f, prng() - 0.5f, prng() - 0.5f}));
+        float3 wo = randomHemisphere(prng, b);
+        float3 x(prng(), prng(), prng());
+
+        auto e = exact.sample(wo, x, b);
+        auto f = fast.sample(wo, x, b);
+        CHECK(f.lobe == e.lobe);
+        for (std::size_t c = 0; c < 3; c++)
+            CHECK(std::abs(f.wi(c) - e.wi(c)) < 1e-5f);
+    }
+}
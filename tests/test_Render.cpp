@@ -0,0 +1,254 @@
+#include <atomic>
+#include <cmath>
+#include <cstddef>
+#include <map>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include <catch2/catch_test_macros.hpp>
+#include <catch2/generators/catch_generators.hpp>
+#include <catch2/matchers/catch_matchers_floating.hpp>
+
+#include <cornelis/Color.hpp>
+#include <cornelis/Render.hpp>
+#include <cornelis/SceneDescription.hpp>
+
+using namespace cornelis;
+
+namespace {
+// A small box with a light, a diffuse and a glossy sphere. The light is a sphere, or a panel in
+// the ceiling.
+auto testScene(bool panelLight = false) -> SceneDescription {
+    SceneDescription scene;
+    scene.setCamera(PerspectiveCameraDescription{
+        .origin = V3(0, 5, -20), .lookAt = V3(0, 5, 0), .aspect = 1.f, .horizontalFov = 0.7f});
+
+    auto white = scene.addMaterial(MaterialDescription{.albedo = RGB{.73f, .73f, .73f}});
+    auto gold = scene.addMaterial(MaterialDescription{.albedo = RGB::black(),
+                                                      .emissive = RGB::black(),
+                                                      .roughness = 0.1f,
+                                                      .reflectionTint = RGB(0.916f, 0.61f, 0.0f),
+                                                      .ior = 0.470});
+    auto light =
+        scene.addMaterial(MaterialDescription{.albedo = RGB::black(), .emissive = RGB{8, 8, 8}});
+
+    PlaneDescription floor{
+        .normal = V3(0, 1.0f, 0), .point = V3(0, 0, 0), .extents = V3(20, 20, 0)};
+    floor.material = white;
+    PlaneDescription backWall{
+        .normal = V3(0, 0, -1.0f), .point = V3(0, 5, 5), .extents = V3(20, 20, 0)};
+    backWall.material = white;
+    scene.addPlane(floor);
+    scene.addPlane(backWall);
+
+    if (panelLight) {
+        PlaneDescription panel{
+            .normal = V3(0, -1.0f, 0), .point = V3(0, 9, 0), .extents = V3(3, 3, 0)};
+        panel.material = light;
+        scene.addPlane(panel);
+    } else {
+        SphereDescription lamp{.center = V3(0, 9, 0), .radius = 1.5f};
+        lamp.material = light;
+        scene.addSphere(lamp);
+    }
+    SphereDescription diffuse{.center = V3(-2.5f, 2, 0), .radius = 2};
+    diffuse.material = white;
+    SphereDescription glossy{.center = V3(2.5f, 2, -1), .radius = 2};
+    glossy.material = gold;
+    scene.addSphere(diffuse);
+    scene.addSphere(glossy);
+    return scene;
+}
+
+auto renderImage(RenderOptions const &options) -> std::vector<RGB> {
+    RenderSession session(testScene(), options);
+    session.render();
+    return {session.image().begin(), session.image().end()};
+}
+
+// The number of pixels that are not bit for bit the same.
+auto countDiffering(std::vector<RGB> const &a, std::vector<RGB> const &b) -> std::size_t {
+    std::size_t differing = 0;
+    for (std::size_t p = 0; p != a.size(); p++) {
+        if (a[p](0) != b[p](0) || a[p](1) != b[p](1) || a[p](2) != b[p](2))
+            differing++;
+    }
+    return differing;
+}
+
+auto meanLuminance(RGBFrameBuffer const &image) -> double {
+    double sum = 0.0;
+    for (auto const &rgb : image)
+        sum += luminance(rgb);
+    return sum / static_cast<double>(image.end() - image.begin());
+}
+} // namespace
+
+TEST_CASE("RenderSession: too many samples are not rendered") {
+    // More than the fixed point sums of the pixels can hold.
+    RenderSession session(testScene(),
+                          RenderOptions{.samplesAA = RenderOptions::MaxSamplesAA + 1});
+    session.render();
+    CHECK(meanLuminance(session.image()) == 0.0);
+}
+
+TEST_CASE("RenderSession: image does not depend on the tile size") {
+    // 48 does not divide the frame, so the tiles along two of the edges are smaller.
+    auto const a = renderImage(RenderOptions{.samplesAA = 4, .tileSize = 16});
+    auto const b = renderImage(RenderOptions{.samplesAA = 4, .tileSize = 48});
+    REQUIRE(a.size() == b.size());
+    CHECK(countDiffering(a, b) == 0);
+}
+
+TEST_CASE("RenderSession: integrators give the same image") {
+    auto const a = renderImage(RenderOptions{.samplesAA = 4, .integrator = Integrator::PerPixel});
+    auto const b = renderImage(
+        RenderOptions{.samplesAA = 4, .integrator = Integrator::Wavefront, .wavefrontSize = 1000});
+    REQUIRE(a.size() == b.size());
+    CHECK(countDiffering(a, b) == 0);
+}
+
+TEST_CASE("RenderSession: path regeneration does not change the image") {
+    // 1000 paths take several waves per tile without regeneration.
+    auto const a = renderImage(
+        RenderOptions{.samplesAA = 4, .wavefrontSize = 1000, .pathRegeneration = true});
+    auto const b = renderImage(
+        RenderOptions{.samplesAA = 4, .wavefrontSize = 1000, .pathRegeneration = false});
+    REQUIRE(a.size() == b.size());
+    CHECK(countDiffering(a, b) == 0);
+}
+
+TEST_CASE("RenderSession: sorting the paths does not change the image") {
+    auto const a = renderImage(RenderOptions{.samplesAA = 4, .sortRays = false});
+    auto const b = renderImage(RenderOptions{.samplesAA = 4, .sortRays = true});
+    REQUIRE(a.size() == b.size());
+    CHECK(countDiffering(a, b) == 0);
+}
+
+TEST_CASE("RenderSession: shading by material gives the same image") {
+    // The queues of standard materials are shaded with SIMD kernels, which round differently from
+    // the scalar code, so a few paths may take another way.
+    auto render = [](bool byMaterial) {
+        RenderSession session(testScene(),
+                              RenderOptions{.samplesAA = 4, .shadeByMaterial = byMaterial});
+        session.render();
+        return meanLuminance(session.image());
+    };
+    CHECK_THAT(render(true), Catch::Matchers::WithinRel(render(false), 0.005));
+}
+
+TEST_CASE("RenderSession: SIMD shading does not depend on how the queues split into blocks") {
+    // Waves of 999 and 1000 paths put most of the rays in different lanes, and in different parts
+    // of their material queues.
+    auto const a = renderImage(
+        RenderOptions{.samplesAA = 4, .wavefrontSize = 999, .shadeByMaterial = true});
+    auto const b = renderImage(
+        RenderOptions{.samplesAA = 4, .wavefrontSize = 1000, .shadeByMaterial = true});
+    REQUIRE(a.size() == b.size());
+    CHECK(countDiffering(a, b) == 0);
+}
+
+TEST_CASE("RenderSession: adaptive sampling does not depend on the tiles or the integrator") {
+    RenderOptions options{.samplesAA = 8,
+                          .adaptiveErrorTarget = 0.1f,
+                          .adaptiveMinSamples = 4,
+                          .adaptiveMaxSamples = 32,
+                          .tileSize = 16};
+    auto const a = renderImage(options);
+    options.tileSize = 48;
+    options.wavefrontSize = 1000;
+    auto const b = renderImage(options);
+    options.integrator = Integrator::PerPixel;
+    auto const c = renderImage(options);
+    REQUIRE(a.size() == b.size());
+    CHECK(countDiffering(a, b) == 0);
+    CHECK(countDiffering(a, c) == 0);
+}
+
+TEST_CASE("RenderSession: progressive passes add up to one render of all the samples") {
+    auto const a = renderImage(RenderOptions{.samplesAA = 5});
+    auto const b = renderImage(RenderOptions{.samplesAA = 5, .progressiveSamples = 2});
+    REQUIRE(a.size() == b.size());
+    CHECK(countDiffering(a, b) == 0);
+}
+
+TEST_CASE("RenderSession: aborting a progressive render keeps the finished passes") {
+    RenderOptions options{.samplesAA = 4, .progressiveSamples = 2, .tileSize = 64};
+    auto const a = renderImage(RenderOptions{.samplesAA = 2, .tileSize = 64});
+
+    // Aborts as soon as the last tile of the first pass is done: the progress callback is only
+    // called after a tile has added its samples.
+    RenderSession session(testScene(), options);
+    std::atomic_int tiles = 0;
+    session.render([&](auto const &, auto const &status) {
+        if (status == RenderStatus::Running && ++tiles == 64)
+            return RenderCommand::Abort;
+        return RenderCommand::Continue;
+    });
+    std::vector<RGB> const b(session.image().begin(), session.image().end());
+    REQUIRE(a.size() == b.size());
+    CHECK(countDiffering(a, b) == 0);
+}
+
+TEST_CASE("RenderSession: running out of time keeps the first pass whole") {
+    // The time is up before the render starts, so only the first pass is rendered. Without
+    // progressive passes, the render is split into passes of a few samples per pixel.
+    auto const progressive = GENERATE(false, true);
+    CAPTURE(progressive);
+    auto const a = renderImage(RenderOptions{.samplesAA = 4, .tileSize = 64});
+    auto const b = renderImage(RenderOptions{.samplesAA = 64,
+                                             .progressiveSamples = progressive ? 4 : 0,
+                                             .timeBudget = 1e-9,
+                                             .tileSize = 64});
+    REQUIRE(a.size() == b.size());
+    CHECK(countDiffering(a, b) == 0);
+}
+
+TEST_CASE("RenderSession: progressive renders stop once the image converges") {
+    RenderOptions const options{
+        .samplesAA = 64, .progressiveSamples = 4, .convergenceTarget = 0.001f, .tileSize = 64};
+    RenderSession session(testScene(), options);
+    // The estimate reported after each pass. The callback may be called from several threads.
+    std::mutex mutex;
+    std::map<int32_t, double> errors;
+    session.render([&](RenderProgress const &progress, auto const &) {
+        std::lock_guard lock(mutex);
+        errors[progress.passesCompleted] = progress.relativeMSE;
+        return RenderCommand::Continue;
+    });
+
+    REQUIRE(errors.size() > 2);
+    CHECK(std::isinf(errors[0]));
+    auto const [passes, error] = *errors.rbegin();
+    CHECK(passes < 16);
+    CHECK(error <= options.convergenceTarget);
+    CHECK(errors[passes - 1] > options.convergenceTarget);
+    CHECK(errors[1] > errors[passes - 1]);
+}
+
+TEST_CASE("RenderSession: next event estimation gives the same image with less noise") {
+    auto const panelLight = GENERATE(false, true);
+    CAPTURE(panelLight);
+    // The mean luminance of the image, and its relative error after the last pass.
+    auto render = [&](bool nextEvent) -> std::pair<double, double> {
+        RenderSession session(testScene(panelLight),
+                              RenderOptions{.samplesAA = 16,
+                                            .nextEventEstimation = nextEvent,
+                                            .progressiveSamples = 8,
+                                            .tileSize = 64});
+        std::mutex mutex;
+        RenderProgress last;
+        session.render([&](RenderProgress const &progress, auto const &) {
+            std::lock_guard lock(mutex);
+            if (progress.passesCompleted >= last.passesCompleted)
+                last = progress;
+            return RenderCommand::Continue;
+        });
+        return {meanLuminance(session.image()), last.relativeMSE};
+    };
+    auto const [withMean, withError] = render(true);
+    auto const [withoutMean, withoutError] = render(false);
+    CHECK_THAT(withMean, Catch::Matchers::WithinRel(withoutMean, 0.02));
+    CHECK(withError < withoutError / 4);
+}
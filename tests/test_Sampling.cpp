@@ -1,9 +1,252 @@
 #include <algorithm>
 #include <array>
+#include <cmath>
+#include <numeric>
+#include <vector>
 
 #include <tbb/parallel_do.h>
 
 #include <catch2/catch_test_macros.hpp>
+#include <catch2/generators/catch_generators.hpp>
 
+#include <cornelis/PRNG.hpp>
 #include <cornelis/Sampling.hpp>
 
+using namespace cornelis;
+
+TEST_CASE("sampleRandom: uniform and uncorrelated") {
+    // Neighbouring keys are what a render asks for, so that is where a weak hash would show.
+    constexpr std::size_t n = 1 << 20;
+    double sum = 0.0, sum2 = 0.0, sumProduct = 0.0;
+    std::array<std::size_t, 16> histogram{};
+    for (uint32_t k = 0; k != n; k++) {
+        uint32_t const pixel = k / 64, sample = (k / 4) % 16, dimension = k % 4;
+        float const u = sampleRandom(1, pixel, sample, dimension);
+        float const v = sampleRandom(1, pixel, sample, dimension + 1);
+        REQUIRE(u >= 0.0f);
+        REQUIRE(u < 1.0f);
+        sum += u;
+        sum2 += u * u;
+        sumProduct += u * v;
+        histogram[static_cast<std::size_t>(u * histogram.size())]++;
+    }
+    CHECK(std::abs(sum / n - 0.5) < 1e-3);
+    CHECK(std::abs(sum2 / n - 1.0 / 3.0) < 1e-3);
+    // The covariance of consecutive dimensions.
+    CHECK(std::abs(sumProduct / n - 0.25) < 1e-3);
+    for (auto count : histogram)
+        CHECK(std::abs(static_cast<double>(count) / n - 1.0 / histogram.size()) < 1e-3);
+}
+
+TEST_CASE("sampleRandom: every part of the key matters") {
+    float const u = sampleRandom(1, 2, 3, 4);
+    CHECK(u == sampleRandom(1, 2, 3, 4));
+    CHECK(u != sampleRandom(2, 2, 3, 4));
+    CHECK(u != sampleRandom(1, 3, 3, 4));
+    CHECK(u != sampleRandom(1, 2, 4, 4));
+    CHECK(u != sampleRandom(1, 2, 3, 5));
+}
+
+TEST_CASE("sampleRandomWide: same numbers as sampleRandom") {
+    constexpr std::size_t n = 1000;
+    std::vector<uint32_t> pixels(n), samples(n), dimensions(n);
+    for (uint32_t k = 0; k != n; k++) {
+        pixels[k] = k * 7919;
+        samples[k] = k % 13;
+        dimensions[k] = k % 5;
+    }
+    // Every third path, so that the keys have to be gathered, and an odd count for the remainder.
+    std::vector<std::size_t> ids;
+    for (std::size_t k = 0; k < n; k += 3)
+        ids.push_back(k);
+
+    std::vector<float> out(n, -1.0f);
+    sampleRandomWide(5, pixels, samples, dimensions, ids, out);
+    for (std::size_t k = 0; k != n; k++) {
+        if (k % 3 == 0)
+            CHECK(out[k] == sampleRandom(5, pixels[k], samples[k], dimensions[k]));
+        else
+            CHECK(out[k] == -1.0f);
+    }
+
+    // Consecutive ids, which are loaded without gathering.
+    ids.resize(n - 1);
+    std::iota(std::begin(ids), std::end(ids), 0);
+    sampleRandomWide(5, pixels, samples, dimensions, ids, out);
+    for (std::size_t k = 0; k != n - 1; k++)
+        CHECK(out[k] == sampleRandom(5, pixels[k], samples[k], dimensions[k]));
+}
+
+TEST_CASE("Sampler: sampleWide gives the same numbers as one at a time") {
+    constexpr std::size_t n = 1000;
+    std::vector<uint32_t> pixels(n), samples(n), mixed(n), sameComponent(n);
+    for (uint32_t k = 0; k != n; k++) {
+        pixels[k] = k * 7919;
+        samples[k] = k % 13;
+        mixed[k] = k % 5;
+        sameComponent[k] = dimension::bounce(static_cast<int32_t>(k % 3)) + dimension::Roulette;
+    }
+    std::vector<std::size_t> gathered, consecutive(n - 1);
+    for (std::size_t k = 0; k < n; k += 3)
+        gathered.push_back(k);
+    std::iota(std::begin(consecutive), std::end(consecutive), 0);
+
+    for (auto pattern : {SamplePattern::Random,
+                         SamplePattern::Sobol,
+                         SamplePattern::PMJ02,
+                         SamplePattern::BlueNoise}) {
+        Sampler const sampler(pattern, 512, 16, 5);
+        for (auto const *dimensions : {&mixed, &sameComponent}) {
+            for (auto const *ids : {&gathered, &consecutive}) {
+                std::vector<float> out(n, -1.0f);
+                sampler.sampleWide(pixels, samples, *dimensions, *ids, out);
+                for (auto k : *ids)
+                    CHECK(out[k] == sampler(pixels[k], samples[k], (*dimensions)[k]));
+            }
+        }
+    }
+}
+
+TEST_CASE("pmj02Point: every aligned power of two run of a table is a (0, 2)-net") {
+    for (uint32_t table : {0u, 17u, PMJ02TableCount - 1}) {
+        for (uint32_t bits = 0; (1u << bits) <= PMJ02TableSize; bits++) {
+            uint32_t const n = 1u << bits;
+            for (uint32_t start : {0u, PMJ02TableSize - n}) {
+                for (uint32_t bitsX = 0; bitsX <= bits; bitsX++) {
+                    uint32_t const bitsY = bits - bitsX;
+                    std::vector<int> count(n, 0);
+                    for (uint32_t i = start; i != start + n; i++) {
+                        auto const [x, y] = pmj02Point(table, i);
+                        uint64_t const cellX = uint64_t(x) >> (32 - bitsX);
+                        uint64_t const cellY = uint64_t(y) >> (32 - bitsY);
+                        count[(cellX << bitsY) | cellY]++;
+                    }
+                    CHECK(std::all_of(
+                        std::begin(count), std::end(count), [](int c) { return c == 1; }));
+                }
+            }
+        }
+    }
+}
+
+TEST_CASE("Sampler: Sobol, PMJ02 and blue noise points of a pixel are stratified") {
+    // The first 256 samples of a pixel in the two pixel dimensions form a (0, 8, 2)-net: every
+    // elementary interval of area 1/256 holds exactly one point, whatever its aspect ratio.
+    auto const pattern =
+        GENERATE(SamplePattern::Sobol, SamplePattern::PMJ02, SamplePattern::BlueNoise);
+    Sampler const sampler(pattern, 512, 256);
+    constexpr uint32_t n = 256;
+    for (uint32_t pixel : {0u, 1u, 4711u}) {
+        std::vector<uint32_t> x(n), y(n);
+        for (uint32_t s = 0; s != n; s++) {
+            x[s] = static_cast<uint32_t>(sampler(pixel, s, dimension::PixelX) * n);
+            y[s] = static_cast<uint32_t>(sampler(pixel, s, dimension::PixelY) * n);
+        }
+        for (uint32_t bitsX = 0; bitsX <= 8; bitsX++) {
+            uint32_t const bitsY = 8 - bitsX;
+            std::vector<int> count(n, 0);
+            for (uint32_t s = 0; s != n; s++)
+                count[((x[s] >> (8 - bitsX)) << bitsY) | (y[s] >> (8 - bitsY))]++;
+            CHECK(std::all_of(std::begin(count), std::end(count), [](int c) { return c == 1; }));
+        }
+
+        // Every dimension of a bounce is stratified on its own, and every prefix of a power of two
+        // samples is too.
+        for (uint32_t d = dimension::bounce(2); d != dimension::bounce(3); d++) {
+            for (uint32_t m : {16u, 64u}) {
+                std::vector<int> count(m, 0);
+                for (uint32_t s = 0; s != m; s++)
+                    count[static_cast<uint32_t>(sampler(pixel, s, d) * m)]++;
+                CHECK(std::all_of(
+                    std::begin(count), std::end(count), [](int c) { return c == 1; }));
+            }
+        }
+    }
+}
+
+TEST_CASE("Sampler: Sobol and PMJ02 integrate with less error than random") {
+    // The mean of a smooth function of the two pixel dimensions over 64 samples, for many pixels.
+    auto f = [](float x, float y) { return std::sin(3.0f * x) * std::exp(y); };
+    double const exact = (1.0 - std::cos(3.0)) / 3.0 * (std::exp(1.0) - 1.0);
+    auto meanSquaredError = [&](SamplePattern pattern) {
+        Sampler const sampler(pattern, 512, 64);
+        double error = 0.0;
+        for (uint32_t pixel = 0; pixel != 256; pixel++) {
+            double sum = 0.0;
+            for (uint32_t s = 0; s != 64; s++)
+                sum += f(sampler(pixel, s, dimension::PixelX),
+                         sampler(pixel, s, dimension::PixelY));
+            error += (sum / 64 - exact) * (sum / 64 - exact);
+        }
+        return error / 256;
+    };
+    double const random = meanSquaredError(SamplePattern::Random);
+    CHECK(meanSquaredError(SamplePattern::Sobol) * 10.0 < random);
+    CHECK(meanSquaredError(SamplePattern::PMJ02) * 10.0 < random);
+}
+
+TEST_CASE("Sampler: blue noise errors cancel out between neighbouring pixels") {
+    // The error of every pixel of a 64x64 frame at 4 samples, and then the error of the mean of
+    // every 3x3 window of pixels, relative to the error of one pixel. When pixels know nothing of
+    // each other that's about 1/9; with the error pushed to high frequencies, the windows do
+    // better.
+    auto f = [](float x, float y) { return std::sin(3.0f * x) * std::exp(y); };
+    double const exact = (1.0 - std::cos(3.0)) / 3.0 * (std::exp(1.0) - 1.0);
+    auto windowError = [&](SamplePattern pattern) {
+        Sampler const sampler(pattern, 64, 4);
+        std::vector<double> error(64 * 64);
+        double pixelError = 0.0;
+        for (uint32_t pixel = 0; pixel != error.size(); pixel++) {
+            double sum = 0.0;
+            for (uint32_t s = 0; s != 4; s++)
+                sum += f(sampler(pixel, s, dimension::PixelX),
+                         sampler(pixel, s, dimension::PixelY));
+            error[pixel] = sum / 4 - exact;
+            pixelError += error[pixel] * error[pixel];
+        }
+        double windowError = 0.0;
+        for (uint32_t y = 0; y + 3 <= 64; y++) {
+            for (uint32_t x = 0; x + 3 <= 64; x++) {
+                double sum = 0.0;
+                for (uint32_t k = 0; k != 9; k++)
+                    sum += error[(y + k / 3) * 64 + x + k % 3];
+                windowError += (sum / 9) * (sum / 9);
+            }
+        }
+        return windowError / (62 * 62) / (pixelError / error.size());
+    };
+    CHECK(windowError(SamplePattern::Sobol) > 0.09);
+    CHECK(windowError(SamplePattern::BlueNoise) < 0.065);
+}
+
+TEST_CASE("Sampler: blue noise pixels keep their own samples at the most samples per pixel") {
+    // Two pixels of the same square whose ranks are 2^13 apart. With 2^19 samples each, their
+    // blocks are 2^32 points apart in the sequence.
+    auto const &ordering = defaultBlueNoiseOrdering();
+    REQUIRE(ordering.size() * ordering.size() > (1u << 13));
+    std::vector<uint32_t> pixelOfRank(ordering.size() * ordering.size());
+    for (uint32_t y = 0; y != ordering.size(); y++) {
+        for (uint32_t x = 0; x != ordering.size(); x++)
+            pixelOfRank[ordering.rank(x, y)] = y * ordering.size() + x;
+    }
+    uint32_t const a = pixelOfRank[5], b = pixelOfRank[5 + (1u << 13)];
+
+    Sampler const sampler(SamplePattern::BlueNoise,
+                          ordering.size(),
+                          static_cast<uint32_t>(RenderOptions::MaxSamplesAA));
+    int same = 0;
+    for (uint32_t s = 0; s != 16; s++) {
+        for (uint32_t d : {dimension::PixelX, dimension::PixelY, dimension::bounce(0)})
+            same += sampler(a, s, d) == sampler(b, s, d);
+    }
+    CHECK(same < 4);
+}
+
+TEST_CASE("powerHeuristic: the weights of two strategies add up to one") {
+    auto const [a, b] = GENERATE(table<float, float>(
+        {{1.0f, 1.0f}, {0.25f, 4.0f}, {3.0f, 0.001f}, {1e30f, 1e-30f}, {2.0f, 0.0f}}));
+    CAPTURE(a, b);
+    CHECK(std::abs(powerHeuristic(a, b) + powerHeuristic(b, a) - 1.0f) < 1e-6f);
+    CHECK((powerHeuristic(a, b) > powerHeuristic(b, a)) == (a > b));
+    CHECK(powerHeuristic(0.0f, 1.0f) == 0.0f);
+}
@@ -1,3 +1,5 @@
+#include <cmath>
+
 #include <cornelis/Scene.hpp>
 
 #include "MathHelpers.hpp"
@@ -56,12 +58,80 @@ TEST_CASE("PlaneData: constructor") {
         CHECK(y[0] == plane1.point[1]);
         CHECK(z[0] == plane1.point[2]);
         
+        // Made unit length.
         auto [Nx, Ny, Nz] = getNormalSpans(data2);
-        CHECK(Nx[0] == plane1.normal[0]);
-        CHECK(Ny[0] == plane1.normal[1]);
-        CHECK(Nz[0] == plane1.normal[2]);
+        CHECK_THAT(Nx[0], Catch::Matchers::WithinRel(1.0f / std::sqrt(3.0f), 1e-6f));
+        CHECK_THAT(Ny[0], Catch::Matchers::WithinRel(1.0f / std::sqrt(3.0f), 1e-6f));
+        CHECK_THAT(Nz[0], Catch::Matchers::WithinRel(1.0f / std::sqrt(3.0f), 1e-6f));
 
         auto matid = data2.get<tags::MaterialId>();
         CHECK(matid[0] == plane1.material);
     }
-}
\ No newline at end of file
+}
+
+TEST_CASE("SceneData: material kinds") {
+    SceneDescription descr;
+    auto light = descr.addMaterial(
+        MaterialDescription{.albedo = RGB::black(), .emissive = RGB{15, 15, 15}});
+    auto metal = descr.addMaterial(
+        MaterialDescription{.albedo = RGB::black(), .reflectionTint = RGB{0.9f, 0.6f, 0.0f}});
+    auto glowingWall =
+        descr.addMaterial(MaterialDescription{.albedo = RGB::red(), .emissive = RGB::red()});
+
+    SceneData scene(descr);
+
+    REQUIRE(scene.materials.size() == 4);
+    CHECK(std::holds_alternative<StandardMaterial>(scene.materials[0]));
+    REQUIRE(std::holds_alternative<EmissiveMaterial>(scene.materials[light]));
+    CHECK(std::get<EmissiveMaterial>(scene.materials[light]).emission({}) == RGB{15, 15, 15});
+    CHECK(std::holds_alternative<StandardMaterial>(scene.materials[metal]));
+    REQUIRE(std::holds_alternative<StandardMaterial>(scene.materials[glowingWall]));
+    CHECK(std::get<StandardMaterial>(scene.materials[glowingWall]).emission({}) == RGB::red());
+}
+
+TEST_CASE("SceneData: lights are the primitives that emit light") {
+    SceneDescription descr;
+    auto light = descr.addMaterial(
+        MaterialDescription{.albedo = RGB::black(), .emissive = RGB{15, 15, 15}});
+    auto glowingWall =
+        descr.addMaterial(MaterialDescription{.albedo = RGB::red(), .emissive = RGB::red()});
+
+    SphereDescription lamp{.center = V3(0, 5, 0), .radius = 1};
+    lamp.material = light;
+    descr.addSphere(SphereDescription{});
+    descr.addSphere(lamp);
+    PlaneDescription wall;
+    wall.material = glowingWall;
+    descr.addPlane(wall);
+    descr.addPlane(PlaneDescription{});
+
+    SceneData scene(descr);
+    // Numbered as in the BVH, with the spheres first.
+    CHECK(scene.lights == std::vector<uint32_t>{1, 2});
+    CHECK(scene.materialId(1) == light);
+    CHECK(scene.materialId(2) == glowingWall);
+}
+
+TEST_CASE("SceneData: plane lights don't depend on the length of their normal") {
+    auto panelScene = [](V3 normal) {
+        SceneDescription descr;
+        auto light = descr.addMaterial(
+            MaterialDescription{.albedo = RGB::black(), .emissive = RGB{15, 15, 15}});
+        PlaneDescription panel{.normal = normal, .point = V3(0, 5, 0), .extents = V3(2, 3, 0)};
+        panel.material = light;
+        descr.addPlane(panel);
+        return descr;
+    };
+    SceneData unit(panelScene(V3(0, -1, 0)));
+    SceneData scaled(panelScene(V3(0, -3, 0)));
+
+    float3 const P{0.5f, 0.0f, -0.5f};
+    for (float2 const x : {float2(0.1f, 0.2f), float2(0.5f, 0.5f), float2(0.9f, 0.3f)}) {
+        auto const a = sampleLight(unit, 0, P, x);
+        auto const b = sampleLight(scaled, 0, P, x);
+        CHECK_THAT(b.pdf, Catch::Matchers::WithinRel(a.pdf, 1e-5f));
+        CHECK_THAT(b.distance, Catch::Matchers::WithinRel(a.distance, 1e-5f));
+        CHECK_THAT(lightPdf(scaled, 0, P, a.wi, a.distance),
+                   Catch::Matchers::WithinRel(a.pdf, 1e-5f));
+    }
+}
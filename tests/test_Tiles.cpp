@@ -34,4 +34,19 @@ TEST_CASE("FrameTiling: dimensions multiple of tile size") {
         CHECK(tiling[i].bounds ==
               PixelRect(PixelCoord{x * 16, y * 3}, PixelCoord{(x + 1) * 16 - 1, (y + 1) * 3 - 1}));
     }
-}
\ No newline at end of file
+}
+
+TEST_CASE("FrameTiling: dimensions not multiple of tile size") {
+    FrameTiling tiling{PixelRect{40, 7}, PixelRect{16, 3}};
+    REQUIRE(tiling.size() == 3 * 3);
+
+    // The last tile of each row and column holds what is left over.
+    CHECK(tiling[2].bounds == PixelRect(PixelCoord{32, 0}, PixelCoord{39, 2}));
+    CHECK(tiling[6].bounds == PixelRect(PixelCoord{0, 6}, PixelCoord{15, 6}));
+    CHECK(tiling[8].bounds == PixelRect(PixelCoord{32, 6}, PixelCoord{39, 6}));
+
+    int area = 0;
+    for (auto const &tile : tiling)
+        area += tile.bounds.area();
+    CHECK(area == 40 * 7);
+}